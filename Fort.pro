@@ -6,7 +6,7 @@
 
 QT       += core gui
 
-greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
+greaterThan(QT_MAJOR_VERSION, 4): QT += widgets concurrent
 
 TARGET = Fort
 TEMPLATE = app
@@ -16,6 +16,14 @@ SOURCES += main.cpp\
         mainwindow.cpp \
     item.cpp \
     itemcollection.cpp \
+    itemcodec.cpp \
+    itemstore.cpp \
+    stringpool.cpp \
+    searchengine.cpp \
+    fuzzymatcher.cpp \
+    searchworker.cpp \
+    itemlistmodel.cpp \
+    itemdelegate.cpp \
     itemdialog.cpp \
     environment.cpp \
     logindialog.cpp \
@@ -27,11 +35,27 @@ SOURCES += main.cpp\
     settingsparser.cpp \
     preferencesdialog.cpp \
     dataexporter.cpp \
-    runguard.cpp
+    runguard.cpp \
+    vaultstorage.cpp \
+    recordcipher.cpp \
+    secretcache.cpp \
+    keyring.cpp \
+    keyrotator.cpp \
+    vaultmigrator.cpp \
+    writebehind.cpp \
+    vaultprefetcher.cpp
 
 HEADERS  += mainwindow.h \
     item.h \
     itemcollection.h \
+    itemcodec.h \
+    itemstore.h \
+    stringpool.h \
+    searchengine.h \
+    fuzzymatcher.h \
+    searchworker.h \
+    itemlistmodel.h \
+    itemdelegate.h \
     itemdialog.h \
     environment.h \
     logindialog.h \
@@ -43,7 +67,15 @@ HEADERS  += mainwindow.h \
     settingsparser.h \
     preferencesdialog.h \
     dataexporter.h \
-    runguard.h
+    runguard.h \
+    vaultstorage.h \
+    recordcipher.h \
+    secretcache.h \
+    keyring.h \
+    keyrotator.h \
+    vaultmigrator.h \
+    writebehind.h \
+    vaultprefetcher.h
 
 FORMS    += mainwindow.ui \
     itemdialog.ui \
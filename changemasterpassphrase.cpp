@@ -105,16 +105,6 @@ bool changemasterpassphrase::validatePassphrase()
     return false;
 }
 
-/* Returns new passphrase hash as QString.
- */
-QString changemasterpassphrase::getNewPassphraseHash()
-{
-    QString passphrase = ui->lineEditPassVerify->text().trimmed();
-    QString hash = Security::createHashFromString(passphrase);
-
-    return hash;
-}
-
 /* Simply checks if all the input fields has some content.
  * If there is data, OK-button is enabled.
  */
@@ -155,8 +145,8 @@ void changemasterpassphrase::on_lineEditPassVerify_cursorPositionChanged
 
 /* When OK-button is clicked.
  *
- * Validates passphrases and sends Accepted result if
- * they match closing the dialog.
+ * Validates passphrases and changes the master passphrase if
+ * they match. Sends Accepted result on success closing the dialog.
  */
 void changemasterpassphrase::on_buttonBox_accepted()
 {
@@ -164,9 +154,13 @@ void changemasterpassphrase::on_buttonBox_accepted()
 
     if(validatePassphrase())
     {
-        _sec->preservePassphraseBcrypt(ui->lineEditPassVerify->text().trimmed());
-        this->close();
-        this->setResult(QDialog::Accepted);
+        if(_sec->changeMasterPassphrase(ui->lineEditPassVerify->text().trimmed()))
+        {
+            this->close();
+            this->setResult(QDialog::Accepted);
+        }
+        else
+            QMessageBox::information(this,"Fort Password Manager",_sec->getLastErrorMessage());
     }
 
     this->setCursor(Qt::ArrowCursor);
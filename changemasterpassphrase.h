@@ -36,7 +36,6 @@ class changemasterpassphrase : public QDialog
 public:
     explicit changemasterpassphrase(Security *sec, QWidget *parent = 0);
     ~changemasterpassphrase();
-    QString getNewPassphraseHash();
 
 private slots:
     void on_lineEditCurrentPass_textChanged(const QString &arg1);
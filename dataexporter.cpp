@@ -34,6 +34,10 @@ DataExporter::DataExporter(ItemCollection *collection)
  * Method does not export item guid at all as the guid
  * is unnecessary information for the user.
  *
+ * Fields are read from the columns of the collection through
+ * item views, no item is materialized. Items whose secrets can't
+ * be decrypted are skipped and the export fails.
+ *
  * If the export path exists, it will be overwritten.
  *
  * Return true on success, false on failure.
@@ -46,19 +50,25 @@ bool DataExporter::exportAll(QString filepath)
     if(file.open(QIODevice::WriteOnly|QIODevice::Truncate))
     {
         QTextStream outStream(&file);
+        bool success = true;
 
         for(int i = 0; i < _collection->itemCount(); i++)
         {
-            Item item = _collection->getItem(i);
+            ItemView item = _collection->getItemView(i);
+            QString password;
+            QString notes;
 
-            QString line = item.getTitle() + "\t" + item.getUser() + "\t" +
-                    item.getPassword() + "\t" + item.getUrl() + "\t" + item.getNotes() + "\n";
+            if(!item.getSecrets(password, notes))
+            {
+                success = false;
+                continue;
+            }
 
-            outStream << line;
+            writeLine(outStream, item.getTitle(), item.getUser(), password, item.getUrl(), notes);
         }
 
         file.close();
-        retval = true;
+        retval = success;
     }
 
     return retval;
@@ -86,16 +96,84 @@ bool DataExporter::exportOneByGuid(QString guid, QString filepath)
 
         if(file.open(QIODevice::WriteOnly | QIODevice::Truncate))
         {
-            QString line = item.getTitle() + "\t" + item.getUser() + "\t" +
-                    item.getPassword() + "\t" + item.getUrl() + "\t" + item.getNotes() + "\n";
-
             QTextStream outStream(&file);
-            outStream << line;
+            retval = writeItem(outStream, item);
 
             file.close();
-            retval = true;
         }
     }
 
     return retval;
 }
+
+/* Export the items with the given guids as plain text to
+ * a file, in the given order. Guids without an item are
+ * skipped. If the export path exists, it will be overwritten.
+ *
+ * Returns true on success, false on failure.
+ */
+bool DataExporter::exportByGuids(const QStringList &guids, QString filepath)
+{
+    bool retval = false;
+    QFile file(filepath);
+
+    if(file.open(QIODevice::WriteOnly|QIODevice::Truncate))
+    {
+        QTextStream outStream(&file);
+        bool success = true;
+
+        foreach(QString guid, guids)
+        {
+            Item item = _collection->getItemByGuid(guid);
+
+            if(item.isEmpty())
+                continue;
+
+            if(!writeItem(outStream, item))
+                success = false;
+        }
+
+        file.close();
+        retval = success;
+    }
+
+    return retval;
+}
+
+/* Write one item as a line of tab separated fields. Returns
+ * false if the sealed password or notes can't be decrypted,
+ * nothing is then written.
+ */
+bool DataExporter::writeItem(QTextStream &out, const Item &item)
+{
+    bool passwordOk;
+    bool notesOk;
+    QString password = item.getPassword(&passwordOk);
+    QString notes = item.getNotes(&notesOk);
+
+    if(!passwordOk || !notesOk)
+    {
+        Item::wipeString(password);
+        Item::wipeString(notes);
+        return false;
+    }
+
+    writeLine(out, item.getTitle(), item.getUser(), password, item.getUrl(), notes);
+
+    return true;
+}
+
+/* Write the fields of an item as one line. The line is built
+ * whole before it is written. Password and notes are wiped.
+ */
+void DataExporter::writeLine(QTextStream &out, const QString &title, const QString &user,
+                             QString &password, const QString &url, QString &notes)
+{
+    QString line = title + '\t' + user + '\t' + password + '\t' + url + '\t' + notes + '\n';
+
+    out << line;
+
+    Item::wipeString(line);
+    Item::wipeString(password);
+    Item::wipeString(notes);
+}
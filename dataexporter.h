@@ -22,6 +22,8 @@
 #define DATAEXPORTER_H
 
 #include <QString>
+#include <QStringList>
+#include <QTextStream>
 #include "itemcollection.h"
 
 class DataExporter
@@ -30,8 +32,12 @@ public:
     DataExporter(ItemCollection *collection);
     bool exportAll(QString filepath);
     bool exportOneByGuid(QString title, QString filepath);
+    bool exportByGuids(const QStringList &guids, QString filepath);
 private:
     ItemCollection *_collection;
+    bool writeItem(QTextStream &out, const Item &item);
+    void writeLine(QTextStream &out, const QString &title, const QString &user,
+                   QString &password, const QString &url, QString &notes);
 };
 
 #endif // DATAEXPORTER_H
@@ -21,8 +21,12 @@
 #include "environment.h"
 #include <QDir>
 #include <QFile>
+#include <QFileInfo>
 #include <QTextStream>
 #include <iostream>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
 #include "settingsparser.h"
 
 /* Static method.
@@ -90,6 +94,43 @@ void Environment::setFirstRunFalse()
     parser.setBoolean("firstrun", false);
 }
 
+/* Static method.
+ *
+ * Replace the file at path with data. Data is written to a temporary
+ * file and synced before it is renamed over the file, and the rename
+ * is synced with the directory. After a crash the file holds either
+ * the old or the new data.
+ *
+ * Returns true on success, false on failure.
+ */
+bool Environment::replaceFile(const QString &path, const QByteArray &data)
+{
+    QString tmpPath = path + ".tmp";
+    QFile file(tmpPath);
+    bool success = file.open(QIODevice::WriteOnly | QIODevice::Truncate);
+
+    success = success && file.write(data) == data.length();
+    success = success && file.flush() && fsync(file.handle()) == 0;
+    file.close();
+
+    if(!success || ::rename(QFile::encodeName(tmpPath).constData(),
+                            QFile::encodeName(path).constData()) != 0)
+    {
+        QFile::remove(tmpPath);
+        return false;
+    }
+
+    int fd = ::open(QFile::encodeName(QFileInfo(path).absolutePath()).constData(), O_RDONLY);
+
+    if(fd < 0)
+        return false;
+
+    success = fsync(fd) == 0;
+    ::close(fd);
+
+    return success;
+}
+
 
 
 
@@ -22,10 +22,17 @@
 #define ENVIRONMENT_H
 
 #include <QString>
+#include <QByteArray>
 
 #define FORT_CONFIG_FILE "fortrc"
 #define FORT_IV_FILE "fort.iv"
 #define FORT_KEY_FILE "fort.pph"
+#define FORT_VAULT_FILE "fort.vault"
+#define FORT_JOURNAL_FILE "fort.journal"
+#define FORT_SHARD_DIR "records"
+#define FORT_DATA_KEY_FILE "fort.dek"
+#define FORT_ROTATION_FILE "fort.rotation"
+#define FORT_FORMAT_FILE "fort.format"
 
 class Environment
 {
@@ -35,6 +42,7 @@ public:
     static bool hasIV();
     static bool isFirstRun();
     static void setFirstRunFalse();
+    static bool replaceFile(const QString &path, const QByteArray &data);
 };
 
 #endif // ENVIRONMENT_H
@@ -0,0 +1,218 @@
+/*
+ * This file is part of Fort.
+ *
+ * Fort is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Fort is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Fort.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2015 Niko Rosvall <niko@ideabyte.net>
+ *
+ */
+
+#include "fuzzymatcher.h"
+#include <QChar>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define FORT_HAVE_SSE2
+#endif
+
+#if defined(_MSC_VER) && defined(FORT_HAVE_SSE2)
+#include <intrin.h>
+#endif
+
+//Scoring, the weights follow fzf
+static const int scoreMatch = 16;
+static const int scoreGapStart = -3;
+static const int scoreGapExtension = -1;
+static const int bonusBoundary = scoreMatch / 2;
+static const int bonusConsecutive = -(scoreGapStart + scoreGapExtension);
+static const int bonusFirstCharMultiplier = 2;
+
+#if defined(FORT_HAVE_SSE2)
+/* Index of the lowest set bit of a non zero mask.
+ */
+static inline int lowestBit(unsigned int mask)
+{
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return int(index);
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+#endif
+
+/* Returns true and sets result to the score of the pattern on
+ * the text, higher is better, if a field of the text contains the
+ * pattern as a subsequence. Scores of long gaps can be negative.
+ * Returns false if no field matches. Empty pattern matches with
+ * score 0.
+ */
+bool FuzzyMatcher::score(const QString &pattern, const QString &text, int &result)
+{
+    const ushort *p = pattern.utf16();
+    const ushort *t = text.utf16();
+    int m = pattern.length();
+    int n = text.length();
+    bool found = false;
+
+    if(m == 0)
+    {
+        result = 0;
+        return true;
+    }
+
+    for(int start = 0; start + m <= n; )
+    {
+        int end = indexOf(t, start, n, '\n');
+
+        if(end < 0)
+            end = n;
+
+        int fieldScore;
+
+        if(scoreField(p, m, t + start, end - start, fieldScore) &&
+           (!found || fieldScore > result))
+        {
+            result = fieldScore;
+            found = true;
+        }
+
+        start = end + 1;
+    }
+
+    return found;
+}
+
+/* Score the pattern p of length m on a single field t of length n.
+ *
+ * The first occurrence of the pattern as a subsequence is found
+ * scanning forward, then the match is shortened scanning backward
+ * from its end, and the shortest match is scored.
+ */
+bool FuzzyMatcher::scoreField(const ushort *p, int m, const ushort *t, int n, int &result)
+{
+    if(m > n)
+        return false;
+
+    int pos = 0;
+
+    for(int i = 0; i < m; i++)
+    {
+        pos = indexOf(t, pos, n, p[i]);
+
+        if(pos < 0)
+            return false;
+
+        pos++;
+    }
+
+    int end = pos;
+    int start = end - 1;
+
+    for(int i = end - 1, pi = m - 1; i >= 0; i--)
+    {
+        if(t[i] == p[pi] && --pi < 0)
+        {
+            start = i;
+            break;
+        }
+    }
+
+    int total = 0;
+    int consecutive = 0;
+    int firstBonus = 0;
+    bool inGap = false;
+
+    for(int i = start, pi = 0; i < end && pi < m; i++)
+    {
+        if(t[i] == p[pi])
+        {
+            int bonus = bonusAt(t, i);
+
+            if(consecutive == 0)
+            {
+                firstBonus = bonus;
+            }
+            else
+            {
+                //Consecutive chunk gets the bonus of its first character
+                if(bonus >= bonusBoundary && bonus > firstBonus)
+                    firstBonus = bonus;
+
+                bonus = qMax(qMax(bonus, firstBonus), bonusConsecutive);
+            }
+
+            if(pi == 0)
+                total += scoreMatch + bonus * bonusFirstCharMultiplier;
+            else
+                total += scoreMatch + bonus;
+
+            inGap = false;
+            consecutive++;
+            pi++;
+        }
+        else
+        {
+            total += inGap ? scoreGapExtension : scoreGapStart;
+            inGap = true;
+            consecutive = 0;
+            firstBonus = 0;
+        }
+    }
+
+    result = total;
+    return true;
+}
+
+/* Returns the index of the first c in text at or after from,
+ * or -1 if there is none.
+ */
+int FuzzyMatcher::indexOf(const ushort *text, int from, int length, ushort c)
+{
+    int i = from;
+
+#if defined(FORT_HAVE_SSE2)
+    const __m128i needle128 = _mm_set1_epi16(short(c));
+
+    for(; i + 8 <= length; i += 8)
+    {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(text + i));
+        unsigned int mask = unsigned(_mm_movemask_epi8(_mm_cmpeq_epi16(chunk, needle128)));
+
+        if(mask != 0)
+            return i + lowestBit(mask) / 2;
+    }
+#endif
+
+    for(; i < length; i++)
+    {
+        if(text[i] == c)
+            return i;
+    }
+
+    return -1;
+}
+
+/* Bonus of a match at pos. Matches at the start of the
+ * text or after a character that is not a letter or a
+ * number begin a word.
+ */
+int FuzzyMatcher::bonusAt(const ushort *text, int pos)
+{
+    if(pos == 0)
+        return bonusBoundary;
+
+    return QChar(text[pos - 1]).isLetterOrNumber() ? 0 : bonusBoundary;
+}
@@ -0,0 +1,51 @@
+/*
+ * This file is part of Fort.
+ *
+ * Fort is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Fort is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Fort.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2015 Niko Rosvall <niko@ideabyte.net>
+ *
+ */
+
+#ifndef FUZZYMATCHER_H
+#define FUZZYMATCHER_H
+
+#include <QString>
+
+/* Scores how well a pattern matches a text as a subsequence.
+ *
+ * Both the pattern and the text must be case folded by the caller.
+ * Matched characters are rewarded, gaps between them penalized and
+ * matches at the start of the text or of a word get a bonus, so
+ * "gml" scores higher on "Gmail" than on "Google Mail".
+ *
+ * Text may hold several fields separated by '\n'. A match never
+ * spans fields, the best scoring field gives the score.
+ *
+ * Searching the text for the characters of the pattern is done on
+ * UTF-16 code units with SSE2 when the compiler targets it, which
+ * every x86-64 CPU has, and with a scalar loop otherwise.
+ */
+class FuzzyMatcher
+{
+public:
+    static bool score(const QString &pattern, const QString &text, int &result);
+
+private:
+    static bool scoreField(const ushort *pattern, int m, const ushort *text, int n, int &result);
+    static int indexOf(const ushort *text, int from, int length, ushort c);
+    static int bonusAt(const ushort *text, int pos);
+};
+
+#endif // FUZZYMATCHER_H
@@ -20,120 +20,193 @@
 
 #include "item.h"
 #include <QUuid>
+#include <QTextStream>
+#include <string.h>
+#include "secretcache.h"
+
+/* Static method.
+ *
+ * Overwrite the character data of a string with zeros
+ * and clear the string.
+ *
+ * Only data the string owns alone is zeroed. Data shared with
+ * other copies, e.g. an Item handed out by ItemStore, is only
+ * released, so wiping one copy never changes another. The copy
+ * wiped last zeroes the data.
+ */
+void Item::wipeString(QString &str)
+{
+    if(!str.isEmpty() && str.isDetached())
+        memset(const_cast<QChar*>(str.constData()), 0, str.size() * sizeof(QChar));
+
+    str.clear();
+}
 
 /* An empty constructor mainly for creating an object
  * without filling all the data.
  */
-Item::Item()
+Item::Item() :
+    d(new ItemData)
 {
-    _isEmpty = true;
 }
 
 /* Constructor. Set default variable values and
  * create a guid for the item.
  */
 Item::Item(const QString &title,const QString &user,
-           const QString &password)
+           const QString &password) :
+    d(new ItemData)
 {
-    _title = title;
-    _user = user;
-    _password = password;
+    d->title = title;
+    d->user = user;
+    d->password = password;
 
     //item unique ID
-    _ID = QUuid::createUuid().toString();
-    _isFavorite = false;
-    _isEmpty = false;
+    d->id = QUuid::createUuid().toString();
+    d->isEmpty = false;
 }
 
 /* Set item url
  */
 void Item::setUrl(const QString &url)
 {
-    _url = url.trimmed();
+    QString trimmed = url.trimmed();
 
-    if(!_url.isEmpty())
+    if(!trimmed.isEmpty())
     {
-        if( (!_url.startsWith("http://")) && (!_url.startsWith("https://")))
-            _url = "http://" + _url;
+        if( (!trimmed.startsWith("http://")) && (!trimmed.startsWith("https://")))
+            trimmed = "http://" + trimmed;
     }
 
-    _isEmpty = false;
+    d->url = trimmed;
+    d->isEmpty = false;
 }
 
 /* Allows to override current ID (guid)
  * This should be only used when loading item data from file.
  */
-void Item::setID(QString id)
+void Item::setID(const QString &id)
 {
-    _ID = id;
-    _isEmpty = false;
+    d->id = id;
+    d->isEmpty = false;
 }
 
-/* Get username of the item as QString.
+/* Get username of the item.
  */
-QString Item::getUser()
+const QString &Item::getUser() const
 {
-    return _user;
+    return d->user;
 }
 
 /* Get notes of the item as QString.
+ * Sealed notes are decrypted on demand, see SecretCache.
+ *
+ * If ok is given, it is set to false when sealed notes can't
+ * be decrypted. An empty string is then returned.
  */
-QString Item::getNotes()
+QString Item::getNotes(bool *ok) const
 {
-    return _notes;
+    if(ok != 0)
+        *ok = true;
+
+    if(!d->sealedSecrets.isEmpty())
+    {
+        QString password;
+        QString notes;
+
+        bool revealed = SecretCache::reveal(d->id, d->sealedSecrets, password, notes);
+        Item::wipeString(password);
+
+        if(ok != 0)
+            *ok = revealed;
+
+        return notes;
+    }
+
+    return d->notes;
 }
 
 /* Set item notes.
+ *
+ * Returns false if the sealed password, which is sealed together
+ * with the notes, can't be decrypted. Item is then not changed.
  */
-void Item::setNotes(QString text)
+bool Item::setNotes(const QString &text)
 {
-    _notes = text;
-    _isEmpty = false;
+    //Notes are sealed together with the password
+    if(!unsealSecrets())
+        return false;
+
+    d->notes = text;
+    d->isEmpty = false;
+
+    return true;
 }
 
-/* Get title of the item as QString.
+/* Get title of the item.
  */
-QString Item::getTitle()
+const QString &Item::getTitle() const
 {
-    return _title;
+    return d->title;
 }
 
 /* Get plain password of the item as QString.
+ * Sealed password is decrypted on demand, see SecretCache.
+ *
+ * If ok is given, it is set to false when the sealed password
+ * can't be decrypted. An empty string is then returned.
  */
-QString Item::getPassword()
+QString Item::getPassword(bool *ok) const
 {
-    return _password;
+    if(ok != 0)
+        *ok = true;
+
+    if(!d->sealedSecrets.isEmpty())
+    {
+        QString password;
+        QString notes;
+
+        bool revealed = SecretCache::reveal(d->id, d->sealedSecrets, password, notes);
+        Item::wipeString(notes);
+
+        if(ok != 0)
+            *ok = revealed;
+
+        return password;
+    }
+
+    return d->password;
 }
 
-/* Get url of the item as QString.
+/* Get url of the item.
  */
-QString Item::getUrl()
+const QString &Item::getUrl() const
 {
-    return _url;
+    return d->url;
 }
 
 /* Get username of the item as QUrl.
  * Used to launch the url on systems default browser.
  */
-QUrl Item::getUrlAsQUrl()
+QUrl Item::getUrlAsQUrl() const
 {
-    QUrl url(_url);
+    QUrl url(d->url);
     return url;
 }
 
-/* Get guid of the item as QString.
+/* Get guid of the item.
  */
-QString Item::getID()
+const QString &Item::getID() const
 {
-    return _ID;
+    return d->id;
 }
 
 /* Return either true of false depending
  * if the item has an url or not.
  */
-bool Item::getHasUrl()
+bool Item::getHasUrl() const
 {
-    if(_url.isEmpty() || _url.isNull())
+    if(d->url.isEmpty() || d->url.isNull())
         return false;
 
     return true;
@@ -143,36 +216,206 @@ bool Item::getHasUrl()
  */
 bool Item::operator==(const Item& other) const
 {
-    return this->_title == other._title;
+    return d->title == other.d->title;
 }
 
 /* Implement < operator for comparing items.
  */
 bool Item::operator<(const Item& other) const
 {
-    return this->_title < other._title;
+    return d->title < other.d->title;
 }
 
 /* Returns true or false depending if the item
  * has data or not.
  */
-bool Item::isEmpty()
+bool Item::isEmpty() const
 {
-    return _isEmpty;
+    return d->isEmpty;
 }
 
 /* Return true or false depending if the item
  * is tagged as a favorite or not.
  */
-bool Item::getIsFavorite()
+bool Item::getIsFavorite() const
 {
-    return _isFavorite;
+    return d->isFavorite;
 }
 
 /* Tag item favorite status.
  */
 void Item::setFavorite(bool value)
 {
-    _isFavorite = value;
-    _isEmpty = false;
+    d->isFavorite = value;
+    d->isEmpty = false;
+}
+
+/* Serialize the item into the plain text format used for
+ * encryption.
+ *
+ * In order: title,user,password,isFav,url,ID,notes
+ * If, in the future, the format changes notes must be the last thing
+ * to be written as it may contain multiple lines.
+ */
+QString Item::toPlainText() const
+{
+    QString data;
+
+    data += d->title + '\n';
+    data += d->user + '\n';
+    data += getPassword() + '\n';
+    data += QString::number(d->isFavorite) + '\n';
+    data += d->url + '\n';
+    data += d->id + '\n';
+    data += getNotes();
+
+    return data;
+}
+
+/* Static method.
+ *
+ * Create an item from data produced by Item::toPlainText()
+ */
+Item Item::fromPlainText(const QString &data)
+{
+    QString copy = data;
+    QTextStream in(&copy, QIODevice::ReadOnly);
+
+    QString title = in.readLine();
+    QString user = in.readLine();
+    QString password = in.readLine();
+    bool fav = in.readLine().toInt();
+    QString url = in.readLine();
+    QString id = in.readLine();
+
+    //Read the rest of the data to get the notes(if any)
+    QString notes = in.readAll();
+
+    Item item(title,user,password);
+    item.setUrl(url);
+    item.setID(id);
+    item.setFavorite(fav);
+    item.setNotes(notes);
+
+    return item;
+}
+
+/* Serialize the metadata of the item. Metadata is everything
+ * except the password and the notes, see Item::toSecretText()
+ *
+ * In order: title,user,isFav,url,ID
+ */
+QString Item::toMetaText() const
+{
+    QString data;
+
+    data += d->title + '\n';
+    data += d->user + '\n';
+    data += QString::number(d->isFavorite) + '\n';
+    data += d->url + '\n';
+    data += d->id;
+
+    return data;
+}
+
+/* Serialize the secrets of the item.
+ *
+ * In order: password,notes
+ * Notes must be the last as they may contain multiple lines.
+ */
+QString Item::toSecretText() const
+{
+    return getPassword() + '\n' + getNotes();
+}
+
+/* Static method.
+ *
+ * Create an item from data produced by Item::toMetaText()
+ * Secrets of the item are set with Item::setSealedSecrets()
+ */
+Item Item::fromMetaText(const QString &data)
+{
+    QString copy = data;
+    QTextStream in(&copy, QIODevice::ReadOnly);
+
+    QString title = in.readLine();
+    QString user = in.readLine();
+    bool fav = in.readLine().toInt();
+    QString url = in.readLine();
+    QString id = in.readLine();
+
+    Item item(title,user,QString());
+    item.setUrl(url);
+    item.setID(id);
+    item.setFavorite(fav);
+
+    return item;
+}
+
+/* Set encrypted secrets (password and notes) of the item.
+ * They are decrypted on demand when password or notes
+ * are requested.
+ */
+void Item::setSealedSecrets(const QByteArray &sealedSecrets)
+{
+    d->sealedSecrets = sealedSecrets;
+    wipeString(d->password);
+    wipeString(d->notes);
+}
+
+/* Get encrypted secrets of the item. Empty if the
+ * secrets are held in plain.
+ */
+const QByteArray &Item::getSealedSecrets() const
+{
+    return d->sealedSecrets;
+}
+
+/* Returns true if password and notes of the item
+ * are held encrypted.
+ */
+bool Item::hasSealedSecrets() const
+{
+    return !d->sealedSecrets.isEmpty();
+}
+
+/* Decrypt sealed password and notes and hold them in plain.
+ * Needed before the item is encrypted with another key.
+ *
+ * Returns false if the secrets can't be decrypted, they
+ * are then kept sealed.
+ */
+bool Item::unsealSecrets()
+{
+    if(d->sealedSecrets.isEmpty())
+        return true;
+
+    QString password;
+    QString notes;
+
+    if(!SecretCache::reveal(d->id, d->sealedSecrets, password, notes))
+        return false;
+
+    d->password = password;
+    d->notes = notes;
+    d->sealedSecrets.clear();
+
+    return true;
+}
+
+/* Zero the memory of all item data not shared with other
+ * copies, see Item::wipeString(). Item is empty after the call.
+ */
+void Item::wipe()
+{
+    wipeString(d->title);
+    wipeString(d->user);
+    wipeString(d->password);
+    wipeString(d->url);
+    wipeString(d->notes);
+    wipeString(d->id);
+    d->sealedSecrets.clear();
+
+    d->isFavorite = false;
+    d->isEmpty = true;
 }
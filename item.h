@@ -25,44 +25,78 @@
 #include <QUrl>
 #include <QIcon>
 #include <QHash>
+#include <QByteArray>
+#include <QSharedData>
+#include <QSharedDataPointer>
 
+/* Shared data of an item, see Item.
+ */
+class ItemData : public QSharedData
+{
+public:
+    ItemData() : isFavorite(false), isEmpty(true) {}
+
+    QString title;
+    QString user;
+    QString password;
+    QString url;
+    QString notes;
+    QString id;
+    bool isFavorite;
+    bool isEmpty;
+    QByteArray sealedSecrets;
+};
+
+/* An item in the collection.
+ *
+ * Item is implicitly shared, copies share the data until
+ * one of them is changed. Getters of the stored fields return
+ * references to the shared data.
+ */
 class Item
 {
 public:
     Item();
     Item(const QString &title,const QString &user,const QString &password);
     void setUrl(const QString &url);
-    QString getTitle();
-    QString getUser();
-    QString getPassword();
-    QString getUrl();
-    QUrl getUrlAsQUrl();
-    QString getNotes();
-    QString getID();
-    void setID(QString id);
-    void setNotes(QString text);
-    bool getHasUrl();
-    bool getIsFavorite();
+    const QString &getTitle() const;
+    const QString &getUser() const;
+    QString getPassword(bool *ok = 0) const;
+    const QString &getUrl() const;
+    QUrl getUrlAsQUrl() const;
+    QString getNotes(bool *ok = 0) const;
+    const QString &getID() const;
+    void setID(const QString &id);
+    bool setNotes(const QString &text);
+    bool getHasUrl() const;
+    bool getIsFavorite() const;
     void setFavorite(bool value);
     bool operator==(const Item &other) const;
     bool operator<(const Item &other) const;
-    QString _title;
-    QString _ID;
-    bool isEmpty();
+    bool isEmpty() const;
+    QString toPlainText() const;
+    static Item fromPlainText(const QString &data);
+    QString toMetaText() const;
+    QString toSecretText() const;
+    static Item fromMetaText(const QString &data);
+    void setSealedSecrets(const QByteArray &sealedSecrets);
+    const QByteArray &getSealedSecrets() const;
+    bool hasSealedSecrets() const;
+    bool unsealSecrets();
+    void wipe();
+    static void wipeString(QString &str);
 
 private:
-    QString _user;
-    QString _password;
-    QString _url;
-    bool _isFavorite;
-    QString _notes;
-    bool _isEmpty;
+    //Store and codec read and write the fields without revealing secrets
+    friend class ItemStore;
+    friend class ItemCodec;
 
+    QSharedDataPointer<ItemData> d;
 };
 
 inline uint qHash(const Item &other)
 {
-    return qHash(other._ID) ^ 0x9e3779b9;
+    return qHash(other.getID()) ^ 0x9e3779b9;
 }
 
 #endif // ITEM_H
@@ -0,0 +1,337 @@
+/*
+ * This file is part of Fort.
+ *
+ * Fort is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Fort is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Fort.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2015 Niko Rosvall <niko@ideabyte.net>
+ *
+ */
+
+#include "itemcodec.h"
+#include <QtEndian>
+
+#define ITEM_CODEC_VERSION 1
+#define ITEM_CODEC_MAGIC_SIZE 3
+#define ITEM_CODEC_HEADER_SIZE 4
+#define ITEM_CODEC_FIELD_SIZE 5
+
+/* Static method.
+ *
+ * Encode the metadata of an item, everything
+ * except the password and the notes.
+ */
+QByteArray ItemCodec::encodeMeta(const Item &item)
+{
+    const ItemData &fields = *item.d;
+    QByteArray data = header();
+
+#define WRITE_FIELD(tag, name) writeField(data, tag, fields.name);
+    ITEM_META_FIELDS(WRITE_FIELD)
+#undef WRITE_FIELD
+
+    return data;
+}
+
+/* Static method.
+ *
+ * Encode the password and the notes of an item. Sealed
+ * secrets are revealed, revealed copies are zeroed.
+ *
+ * Returns false if sealed secrets can't be decrypted,
+ * nothing is encoded then.
+ */
+bool ItemCodec::encodeSecrets(const Item &item, QByteArray &data)
+{
+    bool passwordOk;
+    bool notesOk;
+    QString password = item.getPassword(&passwordOk);
+    QString notes = item.getNotes(&notesOk);
+    ItemData fields;
+
+    //Plain secrets are shared with the item and the store, zero only own copies
+    fields.password = QString(password.unicode(), password.size());
+    fields.notes = QString(notes.unicode(), notes.size());
+
+    if(item.hasSealedSecrets())
+    {
+        Item::wipeString(password);
+        Item::wipeString(notes);
+    }
+
+    data.clear();
+
+    if(passwordOk && notesOk)
+    {
+        data = header();
+
+#define WRITE_FIELD(tag, name) writeField(data, tag, fields.name);
+        ITEM_SECRET_FIELDS(WRITE_FIELD)
+#undef WRITE_FIELD
+    }
+
+    Item::wipeString(fields.password);
+    Item::wipeString(fields.notes);
+
+    return passwordOk && notesOk;
+}
+
+/* Static method.
+ *
+ * Returns true if the data is in the binary format of any
+ * version, false if it is legacy text.
+ */
+bool ItemCodec::isBinary(const QByteArray &data)
+{
+    return data.startsWith(magic());
+}
+
+/* Static method.
+ *
+ * Decode an item with both metadata and secrets, as written
+ * by older versions of Fort into a single record.
+ *
+ * If ok is given, it is set to false when the data is truncated
+ * or of an unknown version. An empty item is returned then.
+ */
+Item ItemCodec::decodeItem(const QByteArray &data, bool *ok)
+{
+    if(ok != 0)
+        *ok = true;
+
+    if(!isBinary(data))
+        return Item::fromPlainText(QString::fromUtf8(data.constData(), data.length()));
+
+    Item item;
+
+    if(!decode(data, *item.d))
+    {
+        item.wipe();
+
+        if(ok != 0)
+            *ok = false;
+
+        return Item();
+    }
+
+    item.d->isEmpty = false;
+
+    return item;
+}
+
+/* Static method.
+ *
+ * Decode the metadata of an item. Secrets of the item are
+ * set with Item::setSealedSecrets()
+ *
+ * If ok is given, it is set to false when the data is truncated
+ * or of an unknown version. An empty item is returned then.
+ */
+Item ItemCodec::decodeMeta(const QByteArray &data, bool *ok)
+{
+    if(ok != 0)
+        *ok = true;
+
+    if(!isBinary(data))
+        return Item::fromMetaText(QString::fromUtf8(data.constData(), data.length()));
+
+    Item item;
+    bool success = decode(data, *item.d);
+
+    //Secrets are never read from the metadata
+    Item::wipeString(item.d->password);
+    Item::wipeString(item.d->notes);
+
+    if(!success)
+    {
+        if(ok != 0)
+            *ok = false;
+
+        return Item();
+    }
+
+    item.d->isEmpty = false;
+
+    return item;
+}
+
+/* Static method.
+ *
+ * Decode the password and the notes of an item. Returns false
+ * if the data is truncated or of an unknown version, password
+ * and notes are left empty then.
+ */
+bool ItemCodec::decodeSecrets(const QByteArray &data, QString &password, QString &notes)
+{
+    if(!isBinary(data))
+    {
+        QString text = QString::fromUtf8(data.constData(), data.length());
+        int separator = text.indexOf('\n');
+
+        password = text.left(separator);
+        notes = separator < 0 ? QString() : text.mid(separator + 1);
+
+        Item::wipeString(text);
+        return true;
+    }
+
+    ItemData fields;
+    bool success = decode(data, fields);
+
+    if(success)
+    {
+        password = fields.password;
+        notes = fields.notes;
+    }
+    else
+    {
+        password.clear();
+        notes.clear();
+        Item::wipeString(fields.password);
+        Item::wipeString(fields.notes);
+    }
+
+    return success;
+}
+
+/* Static method.
+ *
+ * Append a string field.
+ */
+void ItemCodec::writeField(QByteArray &data, int tag, const QString &value)
+{
+    QByteArray utf8 = value.toUtf8();
+    uchar field[ITEM_CODEC_FIELD_SIZE];
+
+    field[0] = tag;
+    qToLittleEndian<quint32>(utf8.length(), field + 1);
+
+    data.append(reinterpret_cast<const char*>(field), ITEM_CODEC_FIELD_SIZE);
+    data.append(utf8);
+
+    //May hold a secret
+    utf8.fill(0);
+}
+
+/* Static method.
+ *
+ * Append a boolean field.
+ */
+void ItemCodec::writeField(QByteArray &data, int tag, bool value)
+{
+    uchar field[ITEM_CODEC_FIELD_SIZE + 1];
+
+    field[0] = tag;
+    qToLittleEndian<quint32>(1, field + 1);
+    field[ITEM_CODEC_FIELD_SIZE] = value ? 1 : 0;
+
+    data.append(reinterpret_cast<const char*>(field), ITEM_CODEC_FIELD_SIZE + 1);
+}
+
+/* Static method.
+ *
+ * Read a string field.
+ */
+void ItemCodec::readField(const char *value, int length, QString &field)
+{
+    field = QString::fromUtf8(value, length);
+}
+
+/* Static method.
+ *
+ * Read a boolean field.
+ */
+void ItemCodec::readField(const char *value, int length, bool &field)
+{
+    field = length > 0 && value[0] != 0;
+}
+
+/* Static method.
+ *
+ * Read binary data of any known version. Returns false if the
+ * version is unknown, i.e. written by a newer Fort, or the data
+ * is truncated.
+ */
+bool ItemCodec::decode(const QByteArray &data, ItemData &fields)
+{
+    if(data.length() < ITEM_CODEC_HEADER_SIZE)
+        return false;
+
+    switch(static_cast<uchar>(data.at(ITEM_CODEC_MAGIC_SIZE)))
+    {
+    case 1:
+        return decodeFields(data, fields);
+    default:
+        return false;
+    }
+}
+
+/* Static method.
+ *
+ * Read the fields of version 1 data. Fields with unknown tags are
+ * skipped. Returns false if the data is truncated, fields read
+ * before that are kept.
+ */
+bool ItemCodec::decodeFields(const QByteArray &data, ItemData &fields)
+{
+    const char *p = data.constData() + ITEM_CODEC_HEADER_SIZE;
+    const char *end = data.constData() + data.length();
+
+    while(end - p >= ITEM_CODEC_FIELD_SIZE)
+    {
+        int tag = static_cast<uchar>(p[0]);
+        quint32 length = qFromLittleEndian<quint32>(reinterpret_cast<const uchar*>(p + 1));
+        p += ITEM_CODEC_FIELD_SIZE;
+
+        if(static_cast<quint32>(end - p) < length)
+            return false;
+
+        switch(tag)
+        {
+#define READ_FIELD(tag, name) case tag: readField(p, length, fields.name); break;
+        ITEM_META_FIELDS(READ_FIELD)
+        ITEM_SECRET_FIELDS(READ_FIELD)
+#undef READ_FIELD
+        default:
+            break;
+        }
+
+        p += length;
+    }
+
+    return p == end;
+}
+
+/* Static method.
+ *
+ * Return the magic of the binary format, any version. Legacy
+ * text never starts with a zero byte.
+ */
+QByteArray ItemCodec::magic()
+{
+    const char data[ITEM_CODEC_MAGIC_SIZE] = { 0, 'F', 'I' };
+    return QByteArray(data, ITEM_CODEC_MAGIC_SIZE);
+}
+
+/* Static method.
+ *
+ * Return the header written to new data, the magic followed
+ * by the current version.
+ */
+QByteArray ItemCodec::header()
+{
+    QByteArray data = magic();
+    data.append(char(ITEM_CODEC_VERSION));
+
+    return data;
+}
@@ -0,0 +1,80 @@
+/*
+ * This file is part of Fort.
+ *
+ * Fort is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Fort is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Fort.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2015 Niko Rosvall <niko@ideabyte.net>
+ *
+ */
+
+#ifndef ITEMCODEC_H
+#define ITEMCODEC_H
+
+#include <QString>
+#include <QByteArray>
+#include "item.h"
+
+/* Fields of the binary item format: tag and the ItemData member.
+ * Tags are stored in the records, never reuse or renumber them. Reader
+ * and writer are both generated from these tables.
+ *
+ * Metadata is decrypted on unlock, secrets are sealed separately
+ * and decrypted when needed, see RecordCipher.
+ */
+#define ITEM_META_FIELDS(X) \
+    X(1, title) \
+    X(2, user) \
+    X(3, isFavorite) \
+    X(4, url) \
+    X(5, id)
+
+#define ITEM_SECRET_FIELDS(X) \
+    X(6, password) \
+    X(7, notes)
+
+/* Encodes items into a versioned, length prefixed binary format.
+ *
+ * Layout: a zero byte, "FI", quint8 version, then for each field
+ * quint8 tag, quint32 length (little endian) and the value. Strings
+ * are UTF-8, booleans one byte. Unknown tags are skipped, so fields
+ * can be added without breaking older readers.
+ *
+ * The magic identifies the format, the version byte selects the layout
+ * to read. Data of an unknown version fails to decode.
+ *
+ * Data without the header is in the legacy line based text format,
+ * see Item::toPlainText(), and is decoded with the text parsers.
+ */
+class ItemCodec
+{
+public:
+    static QByteArray encodeMeta(const Item &item);
+    static bool encodeSecrets(const Item &item, QByteArray &data);
+    static bool isBinary(const QByteArray &data);
+    static Item decodeItem(const QByteArray &data, bool *ok = 0);
+    static Item decodeMeta(const QByteArray &data, bool *ok = 0);
+    static bool decodeSecrets(const QByteArray &data, QString &password, QString &notes);
+
+private:
+    static void writeField(QByteArray &data, int tag, const QString &value);
+    static void writeField(QByteArray &data, int tag, bool value);
+    static void readField(const char *value, int length, QString &field);
+    static void readField(const char *value, int length, bool &field);
+    static bool decode(const QByteArray &data, ItemData &fields);
+    static bool decodeFields(const QByteArray &data, ItemData &fields);
+    static QByteArray magic();
+    static QByteArray header();
+};
+
+#endif // ITEMCODEC_H
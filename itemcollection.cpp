@@ -20,95 +20,143 @@
 
 #include "itemcollection.h"
 #include <QtAlgorithms>
-#include <QFile>
-#include <QDir>
-#include <QTextStream>
-#include "environment.h"
 
-/* Load item list from the filesystem.
+/* Load items into the collection.
  * This method is called after the data has been
- * decrypted.
+ * decrypted into memory, see Security::loadUnlockedItems()
  */
-void ItemCollection::loadItems()
+void ItemCollection::loadItems(const QList<Item> &items)
 {
-    _list.clear();
+    _store.clear();
+    _removedIds.clear();
+    _dirtyIds.clear();
 
-    QString path = Environment::ensurePath();
-    QDir dir(path);
-    QStringList filters;
-    filters << "*.plain";
+    //Favorites on top, the last loaded first
+    for(int i = items.count() - 1; i >= 0; i--)
+    {
+        Item item = items.at(i);
 
-    QFileInfoList entries = dir.entryInfoList(filters,QDir::Files | QDir::NoDotAndDotDot);
+        if(item.getIsFavorite())
+            _store.insert(_store.count(), item);
+    }
 
-    foreach(QFileInfo entryInfo,entries)
+    foreach(Item item, items)
     {
-        QString filePath = entryInfo.absoluteFilePath();
-        QFile file(filePath);
-
-        if(file.open(QIODevice::ReadOnly | QIODevice::Text))
-        {
-            QTextStream in(&file);
-            //In order: title,user,password,isFav,url,ID,notes
-            //If, in the future, the file format changes notes must be the last thing
-            //to be written into the file as it may contain multiple lines.
-            QString title = in.readLine();
-            QString user = in.readLine();
-            QString password = in.readLine();
-            bool fav = in.readLine().toInt();
-            QString url = in.readLine();
-            QString id = in.readLine();
-
-            //Read the rest of the file to get the notes(if any)
-            QString notes = in.readAll();
-
-            Item item(title,user,password);
-            item.setUrl(url);
-            item.setID(id);
-            item.setFavorite(fav);
-            item.setNotes(notes);
-
-            this->addItem(item);
-
-            file.close();
-        }
+        if(!item.getIsFavorite())
+            _store.insert(_store.count(), item);
     }
+
+    rebuildIndexes();
 }
 
 /* Add an item to the internal item collection.
- * This method also adds the new item to the filesystem.
+ * Item is held in memory only and marked dirty, it is
+ * written to the filesystem (encrypted) on lock.
+ *
+ * In a batch the item is appended also if it is a favorite.
  */
 void ItemCollection::addItem(Item &item)
 {
-    _list << item;
-    if(item.getIsFavorite())
-        this->setItemToTop(this->itemCount()-1);
-
-    QString path = Environment::ensurePath();
+    int index = _store.count();
 
-    QFile file(path + item.getID() + ".plain");
+    _store.insert(index, item);
+    indexItem(index);
 
-    if(file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    if(_batchDepth == 0)
     {
-        QString isNumber = QString::number(item.getIsFavorite());
-        QTextStream out(&file);
-
-        out << item.getTitle() + '\n';
-        out << item.getUser() + '\n';
-        out << item.getPassword() + '\n';
-        out << isNumber + '\n';
-        out << item.getUrl() + '\n';
-        out << item.getID() + '\n';
-        out << item.getNotes();
-
-        file.close();
+        _search.insertText(index, searchText(_store.view(index)));
+
+        if(item.getIsFavorite())
+            this->setItemToTop(this->itemCount()-1);
     }
+
+    _removedIds.remove(item.getID());
+    _dirtyIds << item.getID();
+}
+
+/* Change an item in place. Fields of the item with guid are
+ * replaced with the fields of changes, the guid is kept and the
+ * item stays where it is in the list, also when tagged as a favorite.
+ *
+ * Item is marked dirty, so only its record is written on lock.
+ * itemChanged() is emitted with the index of the item, unless
+ * in a batch.
+ *
+ * Returns false if there is no item with the guid.
+ */
+bool ItemCollection::updateItem(const QString &guid, const Item &changes)
+{
+    int index = getItemIndexByGuid(guid);
+
+    if(index < 0)
+        return false;
+
+    unindexItem(index);
+    _store.update(index, changes);
+    indexItem(index);
+    _dirtyIds << guid;
+
+    if(_batchDepth > 0)
+        return true;
+
+    _search.replaceText(index, searchText(_store.view(index)));
+
+    emit itemChanged(index);
+
+    return true;
+}
+
+/* Start a batch of changes. Items added, removed and updated
+ * in a batch are changed in memory only, indexes are rebuilt
+ * and views notified once the batch is committed.
+ *
+ * Items removed in a batch keep their rows until the commit,
+ * so indexes of the other items do not change in a batch.
+ * Batches may be nested, only the outermost commit applies.
+ */
+void ItemCollection::beginBatch()
+{
+    _batchDepth++;
+}
+
+/* Commit a batch of changes started with beginBatch().
+ * Removed rows are dropped in one pass, indexes are rebuilt
+ * and itemsReset() is emitted.
+ *
+ * Changes are written to the filesystem on lock like any other.
+ */
+void ItemCollection::commitBatch()
+{
+    if(_batchDepth == 0 || --_batchDepth > 0)
+        return;
+
+    _store.removeRows(_batchRemovedRows);
+    _batchRemovedRows.clear();
+    rebuildIndexes();
+
+    emit itemsReset();
+}
+
+/* Returns true if changes are done in a batch.
+ */
+bool ItemCollection::isBatching()
+{
+    return _batchDepth > 0;
 }
 
 /* Return an item by index from the collection.
  */
 Item ItemCollection::getItem(int index)
 {
-    return _list.at(index);
+    return _store.item(index);
+}
+
+/* Return a view of an item by index. Unlike ItemCollection::getItem()
+ * no item is materialized, fields are decoded when requested.
+ */
+ItemView ItemCollection::getItemView(int index)
+{
+    return _store.view(index);
 }
 
 /* Return an object of an item by guid.
@@ -117,86 +165,187 @@ Item ItemCollection::getItem(int index)
  */
 Item ItemCollection::getItemByGuid(QString guid)
 {
-    Item item;
+    int index = getItemIndexByGuid(guid);
 
-    for(int i = 0; i < _list.count(); i++)
-    {
-        item = _list.at(i);
+    if(index < 0)
+        return Item();
 
-        if(item.getID().compare(guid) == 0)
-            return item;
-    }
+    return _store.item(index);
+}
 
-    return item;
+/* Return an item index by guid.
+ *
+ * If an item is not found -1 will be returned.
+ */
+int ItemCollection::getItemIndexByGuid(const QString &guid)
+{
+    ItemGuid key;
+
+    if(!_store.findGuid(guid, key))
+        return -1;
+
+    return _guidIndex.value(key, -1);
 }
 
-/* Return an item index by the item name.
- * Loops through the collection until an item
- * with matching name is found.
+/* Return an item index by the item name. If there are
+ * several items with the same name, the first one in
+ * the list is returned.
  *
  * If an item is not found -1 will be returned.
  */
 int ItemCollection::getItemIndexByName(QString name)
 {
-    for(int i = 0; i < this->itemCount(); i++)
-    {
-        if(_list.at(i)._title == name)
-            return i;
-    }
+    QList<int> indexes = getItemIndexesByName(name);
+
+    if(indexes.isEmpty())
+        return -1;
 
-    return -1;
+    return indexes.first();
+}
+
+/* Return indexes of all items with the name in
+ * the order they appear in the list.
+ */
+QList<int> ItemCollection::getItemIndexesByName(const QString &name)
+{
+    QList<int> indexes;
+    quint32 key;
+
+    if(!_store.findTitle(name, key))
+        return indexes;
+
+    foreach(ItemGuid guid, _titleIndex.values(key))
+        indexes << _guidIndex.value(guid);
+
+    qSort(indexes);
+
+    return indexes;
 }
 
 /* Clear the collection.
+ * Memory of the items is zeroed before they are released.
  */
 void ItemCollection::clearItems()
 {
-    _list.clear();
+    _store.wipe();
+    _batchRemovedRows.clear();
+    _removedIds.clear();
+    _dirtyIds.clear();
+    _guidIndex.clear();
+    _titleIndex.clear();
+    _search.clear();
 }
 
-/* Replaces the item list with another list that
- * only hash items which match the search term.
- *
- * Original list is backed up.
+/* Return guids of the items removed since the items
+ * were loaded. Their encrypted files must be removed on lock.
  */
-void ItemCollection::createSearchView(QString searchTerm)
+QSet<QString> ItemCollection::removedIds()
 {
-    _searchSet.clear();
-    _backupList = _list;
+    return _removedIds;
+}
 
-    for(int i = 0; i < this->itemCount(); i++)
-    {
-        Item item = this->getItem(i);
-
-        if(item.getTitle().
-                contains(searchTerm,Qt::CaseInsensitive))
-        {
-            if(!_searchSet.contains(item))
-                _searchSet << item;
-        }
-    }
+/* Return guids of the items added or changed since the
+ * items were loaded or last written.
+ */
+QSet<QString> ItemCollection::dirtyIds()
+{
+    return _dirtyIds;
+}
+
+/* Returns true if the collection has changes which are
+ * not written to the filesystem.
+ */
+bool ItemCollection::isDirty()
+{
+    return !_dirtyIds.isEmpty() || !_removedIds.isEmpty();
+}
+
+/* Mark items to be written on the next lock even
+ * if they have not been changed.
+ */
+void ItemCollection::markDirty(const QSet<QString> &ids)
+{
+    _dirtyIds.unite(ids);
+}
+
+/* Forget the changes. Called once the changes have
+ * been written to the filesystem.
+ */
+void ItemCollection::clearDirtyState()
+{
+    _dirtyIds.clear();
+    _removedIds.clear();
+}
+
+/* Returns indexes of the items whose title, username or
+ * url matches the search term. Fuzzy search ranks the indexes
+ * by score. Exact search returns them in the order of the list,
+ * so favorites stay on top.
+ *
+ * Search is incremental, see SearchEngine::search()
+ *
+ * Unlike the rest of the collection, this method may be called
+ * from another thread while the collection is changed. Revision
+ * of the collection searched is set to revision. Matches are also
+ * handed to sink while they are found. Returns false if the search
+ * was cancelled, see SearchWorker.
+ */
+bool ItemCollection::createSearchView(const QString &searchTerm, QList<int> &indexes,
+                                      int &revision, QAtomicInt *cancel, int generation,
+                                      SearchSink *sink)
+{
+    return _search.search(searchTerm, indexes, revision, cancel, generation, sink);
+}
 
-    _list = QList<Item>::fromSet(_searchSet);
+/* Revision of the collection for search. Search results of
+ * another revision refer to stale indexes.
+ */
+int ItemCollection::searchRevision()
+{
+    return _search.revision();
+}
 
-    for(int i = 0; i < this->itemCount(); i++)
-        if(this->getItem(i).getIsFavorite())
-            this->setItemToTop(i);
+/* Match the search term as a subsequence and rank the
+ * results, or match it as a substring.
+ */
+void ItemCollection::setFuzzySearch(bool fuzzy)
+{
+    _search.setFuzzy(fuzzy);
 }
 
-/* Removes an item from the internal list
- * as well as from the filesystem by an index.
+/* Removes an item from the internal list by an index.
+ * Item is removed from the filesystem on lock.
+ *
+ * In a batch the row is removed on commit.
  */
 void ItemCollection::removeItem(int index)
 {
-    QFile::remove(Environment::ensurePath() + _list[index].getID() + ".plain");
-    _list.removeAt(index);
+    if(_batchRemovedRows.contains(index))
+        return;
+
+    QString id = _store.id(index);
+
+    _dirtyIds.remove(id);
+    _removedIds << id;
+
+    unindexItem(index);
+
+    if(_batchDepth > 0)
+    {
+        _batchRemovedRows << index;
+        return;
+    }
+
+    _store.remove(index);
+    _search.removeText(index);
+    updateSlots(index, _store.count() - 1);
 }
 
 /* Get count of the items.
  */
 int ItemCollection::itemCount()
 {
-    return _list.count();
+    return _store.count();
 }
 
 /* Sort items alphabetically in the list.
@@ -206,7 +355,9 @@ int ItemCollection::itemCount()
  */
 void ItemCollection::sortItemsAscending()
 {
-    qSort(_list.begin(),_list.end());
+    QList<Item> items = allItems();
+    qSort(items.begin(),items.end());
+    replaceItems(items);
 }
 
 /* Sort items from z to a.
@@ -214,7 +365,9 @@ void ItemCollection::sortItemsAscending()
  */
 void ItemCollection::sortItemsDescending()
 {
-    qSort(_list.begin(),_list.end(),qGreater<Item>());
+    QList<Item> items = allItems();
+    qSort(items.begin(),items.end(),qGreater<Item>());
+    replaceItems(items);
 }
 
 /* Move an item to be the first one in the list.
@@ -223,5 +376,88 @@ void ItemCollection::sortItemsDescending()
  */
 void ItemCollection::setItemToTop(int itemIndex)
 {
-    _list.move(itemIndex,0);
+    _store.move(itemIndex,0);
+    _search.moveText(itemIndex, 0);
+    updateSlots(0, itemIndex);
+}
+
+/* Add the item at index to the indexes.
+ */
+void ItemCollection::indexItem(int index)
+{
+    ItemGuid guid = _store.guid(index);
+
+    _guidIndex.insert(guid, index);
+    _titleIndex.insert(_store.titleKey(index), guid);
+}
+
+/* Remove the item at index from the indexes.
+ */
+void ItemCollection::unindexItem(int index)
+{
+    ItemGuid guid = _store.guid(index);
+
+    _guidIndex.remove(guid);
+    _titleIndex.remove(_store.titleKey(index), guid);
+}
+
+/* Update the slots of the items between from and to after
+ * they have been moved in the list. Title index refers to
+ * guids, so it does not change.
+ */
+void ItemCollection::updateSlots(int from, int to)
+{
+    for(int i = from; i <= to; i++)
+        _guidIndex[_store.guid(i)] = i;
+}
+
+/* Build the indexes from scratch. Used when the whole
+ * list is replaced.
+ */
+void ItemCollection::rebuildIndexes()
+{
+    _guidIndex.clear();
+    _titleIndex.clear();
+    _search.clear();
+    _guidIndex.reserve(_store.count());
+    _titleIndex.reserve(_store.count());
+
+    for(int i = 0; i < _store.count(); i++)
+    {
+        indexItem(i);
+        _search.insertText(i, searchText(_store.view(i)));
+    }
+}
+
+/* Materialize all items in the order of the list.
+ */
+QList<Item> ItemCollection::allItems()
+{
+    QList<Item> items;
+
+    for(int i = 0; i < _store.count(); i++)
+        items << _store.item(i);
+
+    return items;
+}
+
+/* Replace the items of the list keeping their order.
+ * Used when the list is sorted.
+ */
+void ItemCollection::replaceItems(const QList<Item> &items)
+{
+    _store.clear();
+
+    foreach(const Item &item, items)
+        _store.insert(_store.count(), item);
+
+    rebuildIndexes();
+}
+
+/* Text of an item the search is done against. Notes are
+ * sealed until revealed, so they are not searchable.
+ */
+QString ItemCollection::searchText(const ItemView &item)
+{
+    return item.getTitle() + '\n' + item.getUser() + '\n' + item.getUrl();
 }
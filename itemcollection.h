@@ -23,30 +23,71 @@
 
 #include <QList>
 #include <QSet>
+#include <QHash>
+#include <QMultiHash>
+#include <QObject>
 #include "item.h"
+#include "searchengine.h"
+#include "itemstore.h"
 
-class ItemCollection
+class ItemCollection : public QObject
 {
+    Q_OBJECT
+
 public:
-    ItemCollection(){}
+    explicit ItemCollection(QObject *parent = 0) : QObject(parent), _batchDepth(0) {}
     void addItem(Item &item);
+    bool updateItem(const QString &guid, const Item &changes);
+    void beginBatch();
+    void commitBatch();
+    bool isBatching();
     Item getItem(int index);
+    ItemView getItemView(int index);
     Item getItemByGuid(QString guid);
+    int getItemIndexByGuid(const QString &guid);
     void removeItem(int index);
     int itemCount();
-    void loadItems();
+    void loadItems(const QList<Item> &items);
     void sortItemsAscending();
     void sortItemsDescending();
     void setItemToTop(int itemIndex);
-    void createSearchView(QString searchTerm);
-    QList<Item> _backupList;
-    QList<Item> _list;
+    bool createSearchView(const QString &searchTerm, QList<int> &indexes, int &revision,
+                          QAtomicInt *cancel = 0, int generation = 0, SearchSink *sink = 0);
+    int searchRevision();
+    void setFuzzySearch(bool fuzzy);
     int getItemIndexByName(QString name);
+    QList<int> getItemIndexesByName(const QString &name);
     void clearItems();
+    QSet<QString> removedIds();
+    QSet<QString> dirtyIds();
+    bool isDirty();
+    void markDirty(const QSet<QString> &ids);
+    void clearDirtyState();
+
+signals:
+    void itemChanged(int index);
+    void itemsReset();
+
 private:
+    ItemStore _store;
+    QSet<QString> _removedIds;
+    QSet<QString> _dirtyIds;
 
+    //Batch depth and rows removed in the batch
+    int _batchDepth;
+    QSet<int> _batchRemovedRows;
 
-    QSet<Item> _searchSet;
+    //Indexes of _store, guid to slot and title to guids
+    QHash<ItemGuid, int> _guidIndex;
+    QMultiHash<quint32, ItemGuid> _titleIndex;
+    SearchEngine _search;
+    void indexItem(int index);
+    void unindexItem(int index);
+    void updateSlots(int from, int to);
+    void rebuildIndexes();
+    QList<Item> allItems();
+    void replaceItems(const QList<Item> &items);
+    static QString searchText(const ItemView &item);
 };
 
 #endif // ITEMCOLLECTION_H
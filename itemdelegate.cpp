@@ -0,0 +1,41 @@
+/*
+ * This file is part of Fort.
+ *
+ * Fort is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Fort is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Fort.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2015 Niko Rosvall <niko@ideabyte.net>
+ *
+ */
+
+#include "itemdelegate.h"
+
+/* Constructor.
+ */
+ItemDelegate::ItemDelegate(QObject *parent) : QStyledItemDelegate(parent)
+{
+}
+
+/* Size of a row. Measured from the first row asked and
+ * measured again only if the font changes.
+ */
+QSize ItemDelegate::sizeHint(const QStyleOptionViewItem &option, const QModelIndex &index) const
+{
+    if(!_sizeHint.isValid() || _sizeHintFont != option.font)
+    {
+        _sizeHint = QStyledItemDelegate::sizeHint(option, index);
+        _sizeHintFont = option.font;
+    }
+
+    return _sizeHint;
+}
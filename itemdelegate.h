@@ -0,0 +1,41 @@
+/*
+ * This file is part of Fort.
+ *
+ * Fort is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Fort is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Fort.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2015 Niko Rosvall <niko@ideabyte.net>
+ *
+ */
+
+#ifndef ITEMDELEGATE_H
+#define ITEMDELEGATE_H
+
+#include <QStyledItemDelegate>
+
+/* Delegate of the item list. All rows have the same size, it is
+ * computed once and reused, so the view does not measure rows
+ * that are not visible.
+ */
+class ItemDelegate : public QStyledItemDelegate
+{
+public:
+    explicit ItemDelegate(QObject *parent = 0);
+    QSize sizeHint(const QStyleOptionViewItem &option, const QModelIndex &index) const;
+
+private:
+    mutable QSize _sizeHint;
+    mutable QFont _sizeHintFont;
+};
+
+#endif // ITEMDELEGATE_H
@@ -0,0 +1,230 @@
+/*
+ * This file is part of Fort.
+ *
+ * Fort is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Fort is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Fort.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2015 Niko Rosvall <niko@ideabyte.net>
+ *
+ */
+
+#include "itemlistmodel.h"
+
+/* Constructor. Icons are created once and shared by all rows.
+ */
+ItemListModel::ItemListModel(ItemCollection *collection, QObject *parent) :
+    QAbstractListModel(parent),
+    _collection(collection),
+    _hasSearchResult(false),
+    _favoriteIcon(":/icons/Tag.png"),
+    _itemIcon(":/icons/Tag2.png")
+{
+    connect(_collection, SIGNAL(itemChanged(int)), this, SLOT(onItemChanged(int)));
+    connect(_collection, SIGNAL(itemsReset()), this, SLOT(onItemsReset()));
+}
+
+/* Number of rows shown, either all items or
+ * the items of the search result.
+ */
+int ItemListModel::rowCount(const QModelIndex &parent) const
+{
+    if(parent.isValid())
+        return 0;
+
+    return _hasSearchResult ? _rows.count() : _collection->itemCount();
+}
+
+/* Data of a row. Title is displayed with an icon depending if
+ * the item is tagged as a favorite or not. Username is shown
+ * as the status tip.
+ */
+QVariant ItemListModel::data(const QModelIndex &index, int role) const
+{
+    int current = collectionIndex(index.row());
+
+    if(!index.isValid() || current < 0)
+        return QVariant();
+
+    ItemView item = _collection->getItemView(current);
+
+    switch(role)
+    {
+    case Qt::DisplayRole:
+        return item.getTitle();
+    case Qt::DecorationRole:
+        return item.getIsFavorite() ? _favoriteIcon : _itemIcon;
+    case Qt::StatusTipRole:
+        return item.getUser();
+    case Qt::UserRole:
+        return item.getID();
+    default:
+        return QVariant();
+    }
+}
+
+/* Get the collection index of the item on a row.
+ * If there is no such row -1 is returned.
+ */
+int ItemListModel::collectionIndex(int row) const
+{
+    if(row < 0 || row >= rowCount())
+        return -1;
+
+    return _hasSearchResult ? _rows.at(row) : row;
+}
+
+/* Get the row of a collection index. If the item is
+ * not shown -1 is returned.
+ */
+int ItemListModel::rowOfCollectionIndex(int index) const
+{
+    if(_hasSearchResult)
+        return _rows.indexOf(index);
+
+    return index < _collection->itemCount() ? index : -1;
+}
+
+/* Add an item to the collection. Favorites are added on top
+ * of the list, others to the end.
+ *
+ * While a search result is shown the new item is not, the search
+ * should be repeated. Returns the row of the item or -1.
+ */
+int ItemListModel::addItem(Item &item)
+{
+    bool favorite = item.getIsFavorite();
+    int index = favorite ? 0 : _collection->itemCount();
+
+    if(_hasSearchResult)
+    {
+        _collection->addItem(item);
+
+        //Favorite moves every other item one slot down
+        if(favorite)
+        {
+            for(int i = 0; i < _rows.count(); i++)
+                _rows[i]++;
+        }
+
+        return -1;
+    }
+
+    beginInsertRows(QModelIndex(), index, index);
+    _collection->addItem(item);
+    endInsertRows();
+
+    return index;
+}
+
+/* Remove the item on a row from the collection.
+ */
+void ItemListModel::removeItem(int row)
+{
+    int index = collectionIndex(row);
+
+    if(index < 0)
+        return;
+
+    beginRemoveRows(QModelIndex(), row, row);
+
+    _collection->removeItem(index);
+
+    if(_hasSearchResult)
+    {
+        _rows.removeAt(row);
+
+        for(int i = 0; i < _rows.count(); i++)
+        {
+            if(_rows.at(i) > index)
+                _rows[i]--;
+        }
+    }
+
+    endRemoveRows();
+}
+
+/* Show only the items of a search result. Indexes
+ * refer to the collection.
+ */
+void ItemListModel::setSearchResult(const QList<int> &indexes)
+{
+    beginResetModel();
+    _rows = indexes;
+    _hasSearchResult = true;
+    endResetModel();
+}
+
+/* Append indexes to the search result shown. Used when
+ * a search result arrives in chunks.
+ */
+void ItemListModel::appendSearchResult(const QList<int> &indexes)
+{
+    if(!_hasSearchResult || indexes.isEmpty())
+        return;
+
+    beginInsertRows(QModelIndex(), _rows.count(), _rows.count() + indexes.count() - 1);
+    _rows += indexes;
+    endInsertRows();
+}
+
+/* Show all items of the collection.
+ */
+void ItemListModel::clearSearchResult()
+{
+    if(!_hasSearchResult)
+        return;
+
+    beginResetModel();
+    _rows.clear();
+    _hasSearchResult = false;
+    endResetModel();
+}
+
+/* Returns true if a search result is shown.
+ */
+bool ItemListModel::hasSearchResult() const
+{
+    return _hasSearchResult;
+}
+
+/* Notify views that the collection has been loaded or
+ * cleared. Search result is dropped.
+ */
+void ItemListModel::reload()
+{
+    beginResetModel();
+    _rows.clear();
+    _hasSearchResult = false;
+    endResetModel();
+}
+
+/* Called when an item is changed in place in the collection.
+ * Only the row of the item is updated in views.
+ */
+void ItemListModel::onItemChanged(int index)
+{
+    int row = rowOfCollectionIndex(index);
+
+    if(row < 0)
+        return;
+
+    emit dataChanged(this->index(row), this->index(row));
+}
+
+/* Called when a batch of changes is committed to the
+ * collection. Search result is dropped.
+ */
+void ItemListModel::onItemsReset()
+{
+    reload();
+}
@@ -0,0 +1,70 @@
+/*
+ * This file is part of Fort.
+ *
+ * Fort is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Fort is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Fort.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2015 Niko Rosvall <niko@ideabyte.net>
+ *
+ */
+
+#ifndef ITEMLISTMODEL_H
+#define ITEMLISTMODEL_H
+
+#include <QAbstractListModel>
+#include <QIcon>
+#include <QList>
+#include "itemcollection.h"
+
+/* Exposes an ItemCollection to a list view.
+ *
+ * Items are added and removed through the model and changed in
+ * place through the collection, so views are notified with row
+ * level signals instead of being repopulated. The model can show
+ * a search result, a list of collection indexes, instead of the
+ * whole collection.
+ *
+ * Rows are materialized by the view only when they are painted.
+ * Guid of the item is returned for Qt::UserRole.
+ */
+class ItemListModel : public QAbstractListModel
+{
+    Q_OBJECT
+
+public:
+    explicit ItemListModel(ItemCollection *collection, QObject *parent = 0);
+    int rowCount(const QModelIndex &parent = QModelIndex()) const;
+    QVariant data(const QModelIndex &index, int role) const;
+    int collectionIndex(int row) const;
+    int rowOfCollectionIndex(int index) const;
+    int addItem(Item &item);
+    void removeItem(int row);
+    void setSearchResult(const QList<int> &indexes);
+    void appendSearchResult(const QList<int> &indexes);
+    void clearSearchResult();
+    bool hasSearchResult() const;
+    void reload();
+
+private slots:
+    void onItemChanged(int index);
+    void onItemsReset();
+
+private:
+    ItemCollection *_collection;
+    QList<int> _rows;
+    bool _hasSearchResult;
+    QIcon _favoriteIcon;
+    QIcon _itemIcon;
+};
+
+#endif // ITEMLISTMODEL_H
@@ -0,0 +1,486 @@
+/*
+ * This file is part of Fort.
+ *
+ * Fort is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Fort is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Fort.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2015 Niko Rosvall <niko@ideabyte.net>
+ *
+ */
+
+#include "itemstore.h"
+#include "secretcache.h"
+#include <QUuid>
+
+//Marks a guid kept as text in the string pool
+static const quint64 textGuid = ~quint64(0);
+
+/* Insert a bit into a bit array, moving the bits
+ * after it one position up.
+ */
+static void insertBit(QBitArray &bits, int pos, bool value)
+{
+    int count = bits.size();
+    bits.resize(count + 1);
+
+    for(int i = count; i > pos; i--)
+        bits.setBit(i, bits.testBit(i - 1));
+
+    bits.setBit(pos, value);
+}
+
+/* Remove a bit from a bit array, moving the bits
+ * after it one position down.
+ */
+static void removeBit(QBitArray &bits, int pos)
+{
+    int count = bits.size();
+
+    for(int i = pos; i < count - 1; i++)
+        bits.setBit(i, bits.testBit(i + 1));
+
+    bits.resize(count - 1);
+}
+
+/* Move an element of a vector like QList::move()
+ */
+template <typename T>
+static void moveElement(QVector<T> &vector, int from, int to)
+{
+    T value = vector.at(from);
+    vector.remove(from);
+    vector.insert(to, value);
+}
+
+/* Remove the elements of a vector at the given positions
+ * in one pass.
+ */
+template <typename T>
+static void removeElements(QVector<T> &vector, const QSet<int> &positions)
+{
+    int to = 0;
+
+    for(int from = 0; from < vector.count(); from++)
+    {
+        if(positions.contains(from))
+            continue;
+
+        if(to != from)
+            vector[to] = vector.at(from);
+
+        to++;
+    }
+
+    vector.resize(to);
+}
+
+/* Constructor.
+ */
+ItemView::ItemView(const ItemStore *store, int row) :
+    _store(store),
+    _row(row)
+{
+}
+
+/* Get title of the item.
+ */
+QString ItemView::getTitle() const
+{
+    return _store->title(_row);
+}
+
+/* Get username of the item.
+ */
+QString ItemView::getUser() const
+{
+    return _store->user(_row);
+}
+
+/* Get url of the item.
+ */
+QString ItemView::getUrl() const
+{
+    return _store->url(_row);
+}
+
+/* Get guid of the item.
+ */
+QString ItemView::getID() const
+{
+    return _store->id(_row);
+}
+
+/* Returns true if the item is tagged as a favorite.
+ */
+bool ItemView::getIsFavorite() const
+{
+    return _store->isFavorite(_row);
+}
+
+/* Returns true if the item has an url.
+ */
+bool ItemView::getHasUrl() const
+{
+    return _store->url(_row).length() > 0;
+}
+
+/* Get password and notes of the item, see ItemStore::secrets()
+ */
+bool ItemView::getSecrets(QString &password, QString &notes) const
+{
+    return _store->secrets(_row, password, notes);
+}
+
+/* Constructor.
+ */
+ItemStore::ItemStore()
+{
+}
+
+/* Get count of the items.
+ */
+int ItemStore::count() const
+{
+    return _titles.count();
+}
+
+/* Insert an item at row. Secrets are taken as they are,
+ * sealed secrets are not revealed.
+ */
+void ItemStore::insert(int row, const Item &item)
+{
+    const ItemData *data = item.d.constData();
+
+    _titles.insert(row, _strings.intern(data->title));
+    _users.insert(row, _strings.intern(data->user));
+    _urls.insert(row, _strings.intern(data->url));
+    _guids.insert(row, internGuid(data->id));
+    insertBit(_favorites, row, data->isFavorite);
+
+    _passwords.insert(row, data->password);
+    _notes.insert(row, data->notes);
+    _sealedSecrets.insert(row, data->sealedSecrets);
+}
+
+/* Remove the item at row.
+ */
+void ItemStore::remove(int row)
+{
+    _strings.release(_titles.at(row));
+    _strings.release(_users.at(row));
+    _strings.release(_urls.at(row));
+    releaseGuid(_guids.at(row));
+
+    _titles.remove(row);
+    _users.remove(row);
+    _urls.remove(row);
+    _guids.remove(row);
+    removeBit(_favorites, row);
+    _passwords.remove(row);
+    _notes.remove(row);
+    _sealedSecrets.remove(row);
+}
+
+/* Remove the items at rows. Rows after them move down,
+ * like removing them one by one from the last, but the
+ * columns are compacted only once.
+ */
+void ItemStore::removeRows(const QSet<int> &rows)
+{
+    if(rows.isEmpty())
+        return;
+
+    foreach(int row, rows)
+    {
+        _strings.release(_titles.at(row));
+        _strings.release(_users.at(row));
+        _strings.release(_urls.at(row));
+        releaseGuid(_guids.at(row));
+    }
+
+    int to = 0;
+
+    for(int from = 0; from < _favorites.size(); from++)
+    {
+        if(!rows.contains(from))
+            _favorites.setBit(to++, _favorites.testBit(from));
+    }
+
+    _favorites.resize(to);
+
+    removeElements(_titles, rows);
+    removeElements(_users, rows);
+    removeElements(_urls, rows);
+    removeElements(_guids, rows);
+    removeElements(_passwords, rows);
+    removeElements(_notes, rows);
+    removeElements(_sealedSecrets, rows);
+}
+
+/* Replace the fields of the item at row with the fields
+ * of item. Guid of the row is kept.
+ */
+void ItemStore::update(int row, const Item &item)
+{
+    const ItemData *data = item.d.constData();
+
+    //Intern before releasing, so unchanged strings stay in place
+    quint32 title = _strings.intern(data->title);
+    quint32 user = _strings.intern(data->user);
+    quint32 url = _strings.intern(data->url);
+
+    _strings.release(_titles.at(row));
+    _strings.release(_users.at(row));
+    _strings.release(_urls.at(row));
+
+    _titles[row] = title;
+    _users[row] = user;
+    _urls[row] = url;
+    _favorites.setBit(row, data->isFavorite);
+
+    _passwords[row] = data->password;
+    _notes[row] = data->notes;
+    _sealedSecrets[row] = data->sealedSecrets;
+}
+
+/* Move the item at from to be at to.
+ */
+void ItemStore::move(int from, int to)
+{
+    if(from == to)
+        return;
+
+    bool favorite = _favorites.testBit(from);
+    removeBit(_favorites, from);
+    insertBit(_favorites, to, favorite);
+
+    moveElement(_titles, from, to);
+    moveElement(_users, from, to);
+    moveElement(_urls, from, to);
+    moveElement(_guids, from, to);
+    moveElement(_passwords, from, to);
+    moveElement(_notes, from, to);
+    moveElement(_sealedSecrets, from, to);
+}
+
+/* Remove all items. String pool is zeroed, plain
+ * secrets may be shared with items and are not.
+ */
+void ItemStore::clear()
+{
+    _strings.clear();
+    _titles.clear();
+    _users.clear();
+    _urls.clear();
+    _guids.clear();
+    _favorites.clear();
+    _passwords.clear();
+    _notes.clear();
+    _sealedSecrets.clear();
+}
+
+/* Zero plain secrets not shared with items handed out,
+ * see Item::wipeString(), and remove all items.
+ */
+void ItemStore::wipe()
+{
+    for(int i = 0; i < count(); i++)
+    {
+        Item::wipeString(_passwords[i]);
+        Item::wipeString(_notes[i]);
+    }
+
+    clear();
+}
+
+/* Materialize the item at row.
+ */
+Item ItemStore::item(int row) const
+{
+    Item item;
+    ItemData *data = item.d.data();
+
+    data->title = title(row);
+    data->user = user(row);
+    data->url = url(row);
+    data->id = id(row);
+    data->isFavorite = isFavorite(row);
+    data->password = _passwords.at(row);
+    data->notes = _notes.at(row);
+    data->sealedSecrets = _sealedSecrets.at(row);
+    data->isEmpty = false;
+
+    return item;
+}
+
+/* Get a view of the item at row.
+ */
+ItemView ItemStore::view(int row) const
+{
+    return ItemView(this, row);
+}
+
+/* Get title of the item at row.
+ */
+QString ItemStore::title(int row) const
+{
+    return _strings.string(_titles.at(row));
+}
+
+/* Get username of the item at row.
+ */
+QString ItemStore::user(int row) const
+{
+    return _strings.string(_users.at(row));
+}
+
+/* Get url of the item at row.
+ */
+QString ItemStore::url(int row) const
+{
+    return _strings.string(_urls.at(row));
+}
+
+/* Get guid of the item at row in the QUuid text form,
+ * or as it was given if it was not in that form.
+ */
+QString ItemStore::id(int row) const
+{
+    const ItemGuid &guid = _guids.at(row);
+
+    if(guid.hi == textGuid)
+        return _strings.string(quint32(guid.lo));
+
+    QUuid uuid(uint(guid.hi >> 32), ushort(guid.hi >> 16), ushort(guid.hi),
+               uchar(guid.lo >> 56), uchar(guid.lo >> 48), uchar(guid.lo >> 40),
+               uchar(guid.lo >> 32), uchar(guid.lo >> 24), uchar(guid.lo >> 16),
+               uchar(guid.lo >> 8), uchar(guid.lo));
+
+    return uuid.toString();
+}
+
+/* Returns true if the item at row is tagged as a favorite.
+ */
+bool ItemStore::isFavorite(int row) const
+{
+    return _favorites.testBit(row);
+}
+
+/* Get password and notes of the item at row. Sealed secrets are
+ * revealed together, see SecretCache. Returns false if they can't
+ * be decrypted, password and notes are then empty.
+ */
+bool ItemStore::secrets(int row, QString &password, QString &notes) const
+{
+    const QByteArray &sealedSecrets = _sealedSecrets.at(row);
+
+    if(sealedSecrets.isEmpty())
+    {
+        password = _passwords.at(row);
+        notes = _notes.at(row);
+        return true;
+    }
+
+    if(SecretCache::reveal(id(row), sealedSecrets, password, notes))
+        return true;
+
+    Item::wipeString(password);
+    Item::wipeString(notes);
+
+    return false;
+}
+
+/* Key of the title of the item at row. Items with
+ * equal titles have equal keys.
+ */
+quint32 ItemStore::titleKey(int row) const
+{
+    return _titles.at(row);
+}
+
+/* Get guid of the item at row in binary.
+ */
+ItemGuid ItemStore::guid(int row) const
+{
+    return _guids.at(row);
+}
+
+/* Find the binary guid of a guid in text form. Returns
+ * false if no item in the store can have the guid.
+ */
+bool ItemStore::findGuid(const QString &id, ItemGuid &guid) const
+{
+    if(parseGuid(id, guid))
+        return true;
+
+    quint32 key;
+
+    if(!_strings.find(id, key))
+        return false;
+
+    guid.hi = textGuid;
+    guid.lo = key;
+
+    return true;
+}
+
+/* Find the key of a title. Returns false if no item
+ * in the store has the title.
+ */
+bool ItemStore::findTitle(const QString &title, quint32 &key) const
+{
+    return _strings.find(title, key);
+}
+
+/* Convert a guid to binary, adding the guid to the string
+ * pool if it is not in the QUuid text form.
+ */
+ItemGuid ItemStore::internGuid(const QString &id)
+{
+    ItemGuid guid;
+
+    if(parseGuid(id, guid))
+        return guid;
+
+    guid.hi = textGuid;
+    guid.lo = _strings.intern(id);
+
+    return guid;
+}
+
+/* Release a guid kept in the string pool.
+ */
+void ItemStore::releaseGuid(const ItemGuid &guid)
+{
+    if(guid.hi == textGuid)
+        _strings.release(quint32(guid.lo));
+}
+
+/* Parse a guid in the QUuid text form. Returns false if
+ * the text would not be given back as is.
+ */
+bool ItemStore::parseGuid(const QString &id, ItemGuid &guid)
+{
+    QUuid uuid(id);
+
+    if(uuid.toString() != id)
+        return false;
+
+    guid.hi = (quint64(uuid.data1) << 32) | (quint64(uuid.data2) << 16) | uuid.data3;
+    guid.lo = 0;
+
+    for(int i = 0; i < 8; i++)
+        guid.lo = (guid.lo << 8) | uuid.data4[i];
+
+    return guid.hi != textGuid;
+}
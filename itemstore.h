@@ -0,0 +1,128 @@
+/*
+ * This file is part of Fort.
+ *
+ * Fort is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Fort is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Fort.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2015 Niko Rosvall <niko@ideabyte.net>
+ *
+ */
+
+#ifndef ITEMSTORE_H
+#define ITEMSTORE_H
+
+#include <QString>
+#include <QByteArray>
+#include <QVector>
+#include <QBitArray>
+#include <QHash>
+#include <QSet>
+#include "item.h"
+#include "stringpool.h"
+
+class ItemStore;
+
+/* Guid of an item as 128 bits. Guids which are not in the
+ * QUuid text form are kept in the string pool of the store,
+ * hi is then all ones, which a QUuid never is.
+ */
+struct ItemGuid
+{
+    quint64 hi;
+    quint64 lo;
+
+    bool operator==(const ItemGuid &other) const
+    {
+        return hi == other.hi && lo == other.lo;
+    }
+};
+
+inline uint qHash(const ItemGuid &guid)
+{
+    return qHash(guid.hi ^ (guid.lo * 0x9e3779b97f4a7c15ULL));
+}
+
+/* Read only view of an item in a store. Fields are decoded
+ * when requested, nothing is copied when the view is created.
+ * A view is valid until the store is changed.
+ */
+class ItemView
+{
+public:
+    ItemView(const ItemStore *store, int row);
+    QString getTitle() const;
+    QString getUser() const;
+    QString getUrl() const;
+    QString getID() const;
+    bool getIsFavorite() const;
+    bool getHasUrl() const;
+    bool getSecrets(QString &password, QString &notes) const;
+
+private:
+    const ItemStore *_store;
+    int _row;
+};
+
+/* Items stored by columns.
+ *
+ * Titles, users and urls are interned in a string pool, guids are
+ * held in binary and favorites in a bit array. Secrets are kept as
+ * they are in Item, sealed or, for items not encrypted yet, plain.
+ *
+ * Rows are inserted, removed and moved like in a list. Items are
+ * materialized on request, see ItemStore::item() and ItemView.
+ */
+class ItemStore
+{
+public:
+    ItemStore();
+    int count() const;
+    void insert(int row, const Item &item);
+    void remove(int row);
+    void removeRows(const QSet<int> &rows);
+    void update(int row, const Item &item);
+    void move(int from, int to);
+    void clear();
+    void wipe();
+    Item item(int row) const;
+    ItemView view(int row) const;
+    QString title(int row) const;
+    QString user(int row) const;
+    QString url(int row) const;
+    QString id(int row) const;
+    bool isFavorite(int row) const;
+    bool secrets(int row, QString &password, QString &notes) const;
+    quint32 titleKey(int row) const;
+    ItemGuid guid(int row) const;
+    bool findGuid(const QString &id, ItemGuid &guid) const;
+    bool findTitle(const QString &title, quint32 &key) const;
+
+private:
+    StringPool _strings;
+    QVector<quint32> _titles;
+    QVector<quint32> _users;
+    QVector<quint32> _urls;
+    QVector<ItemGuid> _guids;
+    QBitArray _favorites;
+
+    //Plain secrets are set only for items not sealed yet
+    QVector<QString> _passwords;
+    QVector<QString> _notes;
+    QVector<QByteArray> _sealedSecrets;
+
+    ItemGuid internGuid(const QString &id);
+    void releaseGuid(const ItemGuid &guid);
+    static bool parseGuid(const QString &id, ItemGuid &guid);
+};
+
+#endif // ITEMSTORE_H
@@ -0,0 +1,153 @@
+/*
+ * This file is part of Fort.
+ *
+ * Fort is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Fort is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Fort.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2015 Niko Rosvall <niko@ideabyte.net>
+ *
+ */
+
+#include "keyring.h"
+#include <QtEndian>
+#include <string.h>
+
+using namespace Botan;
+
+/* Serialized entry: quint32 generation, quint32 creation time
+ * (seconds since epoch, little endian) and the 256bit key. The size
+ * is a multiple of eight, as required by AES key wrap.
+ */
+#define KEY_SIZE 32
+#define KEY_ENTRY_SIZE (8 + KEY_SIZE)
+
+/* Add a key. A key of the same generation is replaced.
+ */
+void KeyRing::addKey(quint32 generation, const SymmetricKey &key, quint32 created)
+{
+    _keys.insert(generation, key);
+    _created.insert(generation, created);
+}
+
+/* Remove all keys except the current one. Called once every
+ * record is encrypted with the current key.
+ */
+void KeyRing::retireOldKeys()
+{
+    while(_keys.count() > 1)
+    {
+        _created.remove(_keys.begin().key());
+        _keys.erase(_keys.begin());
+    }
+}
+
+/* Remove all keys.
+ */
+void KeyRing::clear()
+{
+    _keys.clear();
+    _created.clear();
+}
+
+/* Returns true if the ring has no keys.
+ */
+bool KeyRing::isEmpty() const
+{
+    return _keys.isEmpty();
+}
+
+/* Returns the number of key generations in the ring.
+ */
+int KeyRing::keyCount() const
+{
+    return _keys.count();
+}
+
+/* Returns true if the ring has the key of a generation.
+ */
+bool KeyRing::hasKey(quint32 generation) const
+{
+    return _keys.contains(generation);
+}
+
+/* Get the key of a generation. Empty key is returned
+ * if there is no such generation.
+ */
+SymmetricKey KeyRing::key(quint32 generation) const
+{
+    return _keys.value(generation);
+}
+
+/* Get the key new records are encrypted with.
+ */
+SymmetricKey KeyRing::currentKey() const
+{
+    return _keys.isEmpty() ? SymmetricKey() : _keys.values().last();
+}
+
+/* Get the generation of the current key.
+ */
+quint32 KeyRing::currentGeneration() const
+{
+    return _keys.isEmpty() ? 0 : _keys.keys().last();
+}
+
+/* Get the time the current key was created as
+ * seconds since epoch. Zero if not known.
+ */
+quint32 KeyRing::currentKeyCreated() const
+{
+    return _created.value(currentGeneration());
+}
+
+/* Serialize the ring for key wrapping.
+ */
+SecureVector<byte> KeyRing::serialize() const
+{
+    SecureVector<byte> data(_keys.count() * KEY_ENTRY_SIZE);
+    byte *entry = data.begin();
+
+    for(QMap<quint32, SymmetricKey>::const_iterator i = _keys.constBegin(); i != _keys.constEnd(); ++i)
+    {
+        qToLittleEndian<quint32>(i.key(), entry);
+        qToLittleEndian<quint32>(_created.value(i.key()), entry + 4);
+        memcpy(entry + 8, i.value().begin(), KEY_SIZE);
+        entry += KEY_ENTRY_SIZE;
+    }
+
+    return data;
+}
+
+/* Static method.
+ *
+ * Read a ring produced by serialize().
+ * Returns false if the data is not a valid ring.
+ */
+bool KeyRing::deserialize(const MemoryRegion<byte> &data, KeyRing &ring)
+{
+    if(data.empty() || data.size() % KEY_ENTRY_SIZE != 0)
+        return false;
+
+    ring.clear();
+
+    for(size_t offset = 0; offset < data.size(); offset += KEY_ENTRY_SIZE)
+    {
+        const byte *entry = data.begin() + offset;
+
+        ring.addKey(qFromLittleEndian<quint32>(entry),
+                    SymmetricKey(entry + 8, KEY_SIZE),
+                    qFromLittleEndian<quint32>(entry + 4));
+    }
+
+    return true;
+}
@@ -0,0 +1,56 @@
+/*
+ * This file is part of Fort.
+ *
+ * Fort is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Fort is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Fort.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2015 Niko Rosvall <niko@ideabyte.net>
+ *
+ */
+
+#ifndef KEYRING_H
+#define KEYRING_H
+
+#include <QMap>
+#include <botan/symkey.h>
+#include <botan/secmem.h>
+
+/* Data keys by key generation.
+ *
+ * Records are encrypted with the key of the newest generation. Keys of
+ * older generations are kept while there are records that have not been
+ * rotated to the newest key yet, see KeyRotator.
+ */
+class KeyRing
+{
+public:
+    KeyRing() {}
+    void addKey(quint32 generation, const Botan::SymmetricKey &key, quint32 created);
+    void retireOldKeys();
+    void clear();
+    bool isEmpty() const;
+    int keyCount() const;
+    bool hasKey(quint32 generation) const;
+    Botan::SymmetricKey key(quint32 generation) const;
+    Botan::SymmetricKey currentKey() const;
+    quint32 currentGeneration() const;
+    quint32 currentKeyCreated() const;
+    Botan::SecureVector<Botan::byte> serialize() const;
+    static bool deserialize(const Botan::MemoryRegion<Botan::byte> &data, KeyRing &ring);
+
+private:
+    QMap<quint32, Botan::SymmetricKey> _keys;
+    QMap<quint32, quint32> _created;
+};
+
+#endif // KEYRING_H
@@ -0,0 +1,348 @@
+/*
+ * This file is part of Fort.
+ *
+ * Fort is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Fort is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Fort.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2015 Niko Rosvall <niko@ideabyte.net>
+ *
+ */
+
+#include "keyrotator.h"
+#include <QFile>
+#include <QTextStream>
+#include <QStringList>
+#include <QHash>
+#include <QSet>
+#include <QElapsedTimer>
+#include <QMutexLocker>
+#include <QtAlgorithms>
+#include "environment.h"
+#include "vaultstorage.h"
+#include "recordcipher.h"
+#include "vaultmigrator.h"
+
+/* Constructor. Records are encrypted with the current key
+ * of the ring, older keys are used to decrypt them.
+ */
+KeyRotator::KeyRotator(const KeyRing &keys, QMutex *storageMutex)
+    : _keys(keys), _storageMutex(storageMutex), _batchSize(500), _batchDelay(100),
+      _stopRequested(false), _complete(false)
+{
+    _progress.running = false;
+    _progress.totalRecords = 0;
+    _progress.processedRecords = 0;
+    _progress.rotatedRecords = 0;
+    _progress.recordsPerSecond = 0;
+    _progress.secondsRemaining = -1;
+}
+
+/* Set how many records are processed in one batch.
+ */
+void KeyRotator::setBatchSize(int size)
+{
+    _batchSize = qMax(1, size);
+}
+
+/* Set how long the thread sleeps between the batches.
+ */
+void KeyRotator::setBatchDelay(int milliseconds)
+{
+    _batchDelay = qMax(0, milliseconds);
+}
+
+/* Ask the thread to stop after the current batch.
+ * Call wait() to block until it has stopped.
+ */
+void KeyRotator::stop()
+{
+    QMutexLocker locker(&_stateMutex);
+    _stopRequested = true;
+}
+
+bool KeyRotator::stopRequested()
+{
+    QMutexLocker locker(&_stateMutex);
+    return _stopRequested;
+}
+
+/* Returns true once every record is encrypted
+ * with the current key.
+ */
+bool KeyRotator::isComplete()
+{
+    QMutexLocker locker(&_stateMutex);
+    return _complete;
+}
+
+/* Get the progress counters. Safe to call while
+ * the rotation is running.
+ */
+KeyRotationProgress KeyRotator::progress()
+{
+    QMutexLocker locker(&_stateMutex);
+    return _progress;
+}
+
+/* Rotation sets _lastErrorMessage on failure.
+ * This method is used to access that message.
+ */
+QString KeyRotator::getLastErrorMessage()
+{
+    QMutexLocker locker(&_stateMutex);
+    return _lastErrorMessage;
+}
+
+void KeyRotator::fail(const QString &message)
+{
+    QMutexLocker locker(&_stateMutex);
+    _lastErrorMessage = message;
+    _progress.running = false;
+}
+
+/* Thread entry point.
+ */
+void KeyRotator::run()
+{
+    quint32 generation = _keys.currentGeneration();
+    quint32 savedGeneration;
+    QString lastId;
+    QStringList ids;
+    QElapsedTimer timer;
+    RecordCipher cipher(_keys);
+    bool journaled = false;
+    QStringList pending;
+    bool complete = false;
+    int cursor = 0;
+    int processed = 0;
+
+    if(!listRecords(ids, false))
+        return;
+
+    //Continue after the last guid processed. Guids are sorted, so records
+    //removed meanwhile do not move the position of the rest.
+    if(readProgress(savedGeneration, lastId) && savedGeneration == generation)
+        cursor = qUpperBound(ids.begin(), ids.end(), lastId) - ids.begin();
+
+    {
+        QMutexLocker locker(&_stateMutex);
+        _progress.running = true;
+        _progress.totalRecords = ids.count();
+        _progress.processedRecords = cursor;
+    }
+
+    timer.start();
+
+    while(!stopRequested())
+    {
+        while(cursor < ids.count() && !stopRequested())
+        {
+            QStringList batch = ids.mid(cursor, _batchSize);
+            QHash<QString, QByteArray> records;
+
+            {
+                QMutexLocker locker(_storageMutex);
+                VaultStorage storage;
+
+                if(!storage.open())
+                {
+                    fail(storage.getLastErrorMessage());
+                    return;
+                }
+
+                foreach(QString id, batch)
+                {
+                    QByteArray record = storage.readRecord(id);
+                    QByteArray rotated;
+
+                    //Removed since the rotation started or stored on lock
+                    if(record.isEmpty() || RecordCipher::isSealedWith(record, generation))
+                        continue;
+
+                    //Records of older formats are upgraded on the way
+                    QString errorMessage;
+
+                    if(!VaultMigrator::upgrade(cipher, id, record, rotated, errorMessage))
+                    {
+                        fail(errorMessage);
+                        return;
+                    }
+
+                    records.insert(id, rotated);
+                }
+
+                //Rewriting the packed vault for every batch would copy it over
+                //and over, batches are journaled and compacted once at the end
+                if(storage.isPacked())
+                {
+                    storage.setJournaled(true);
+                    journaled = journaled || !records.isEmpty();
+                }
+
+                if(!records.isEmpty() && !storage.commit(records, QSet<QString>()))
+                {
+                    fail(storage.getLastErrorMessage());
+                    return;
+                }
+            }
+
+            cursor += batch.count();
+            processed += batch.count();
+            writeProgress(generation, batch.last());
+
+            {
+                QMutexLocker locker(&_stateMutex);
+                double seconds = timer.elapsed() / 1000.0;
+
+                _progress.processedRecords = qMin(_progress.processedRecords + batch.count(),
+                                                  _progress.totalRecords);
+                _progress.rotatedRecords += records.count();
+
+                if(seconds > 0)
+                {
+                    _progress.recordsPerSecond = processed / seconds;
+                    _progress.secondsRemaining = static_cast<int>((ids.count() - cursor) /
+                                                                  _progress.recordsPerSecond);
+                }
+            }
+
+            if(cursor < ids.count())
+                msleep(_batchDelay);
+        }
+
+        if(stopRequested())
+            break;
+
+        //Old keys are retired only once every stored record is
+        //known to be sealed with the new one, whatever the cursor says
+        if(!listRecords(ids, true))
+            return;
+
+        if(ids.isEmpty())
+        {
+            complete = true;
+            break;
+        }
+
+        //Same records left again, they can't be read
+        if(ids == pending)
+        {
+            fail("Unable to rotate the key of the remaining items.");
+            return;
+        }
+
+        pending = ids;
+        cursor = 0;
+    }
+
+    if(complete && journaled)
+    {
+        QMutexLocker locker(_storageMutex);
+        VaultStorage storage;
+
+        if(!storage.compact())
+        {
+            fail(storage.getLastErrorMessage());
+            return;
+        }
+    }
+
+    QMutexLocker locker(&_stateMutex);
+    _progress.running = false;
+    _complete = complete;
+
+    if(_complete)
+    {
+        _progress.processedRecords = _progress.totalRecords;
+        _progress.secondsRemaining = 0;
+    }
+}
+
+/* List the guids of the stored records, sorted. If pendingOnly
+ * is set, only records not sealed with the current key are listed.
+ * Returns false on failure, the rotation has then failed.
+ */
+bool KeyRotator::listRecords(QStringList &ids, bool pendingOnly)
+{
+    quint32 generation = _keys.currentGeneration();
+    QMutexLocker locker(_storageMutex);
+    VaultStorage storage;
+
+    ids.clear();
+
+    if(!storage.open())
+    {
+        fail(storage.getLastErrorMessage());
+        return false;
+    }
+
+    foreach(QString id, storage.recordIds())
+    {
+        if(!pendingOnly || !RecordCipher::isSealedWith(storage.readRecord(id), generation))
+            ids << id;
+    }
+
+    ids.sort();
+
+    return true;
+}
+
+/* Static method.
+ *
+ * Read the persisted progress of an interrupted rotation: the
+ * target key generation and the guid of the last record processed.
+ * Returns false if no rotation is in progress.
+ */
+bool KeyRotator::readProgress(quint32 &generation, QString &lastId)
+{
+    QFile file(Environment::ensurePath() + FORT_ROTATION_FILE);
+
+    if(!file.open(QIODevice::ReadOnly | QIODevice::Text))
+        return false;
+
+    QTextStream in(&file);
+    QString line = in.readLine();
+    bool generationOk = false;
+
+    file.close();
+
+    if(!line.contains('$'))
+        return false;
+
+    generation = line.section('$', 0, 0).toUInt(&generationOk);
+    lastId = line.section('$', 1);
+
+    return generationOk;
+}
+
+/* Static method.
+ *
+ * Persist the target key generation and the guid of the
+ * last record processed, empty before the first batch.
+ * File is replaced atomically, see Environment::replaceFile()
+ */
+bool KeyRotator::writeProgress(quint32 generation, const QString &lastId)
+{
+    QString line = QString("%1$%2\n").arg(generation).arg(lastId);
+
+    return Environment::replaceFile(Environment::ensurePath() + FORT_ROTATION_FILE, line.toUtf8());
+}
+
+/* Static method.
+ *
+ * Remove the persisted progress once the rotation is done.
+ */
+void KeyRotator::clearProgress()
+{
+    QFile::remove(Environment::ensurePath() + FORT_ROTATION_FILE);
+}
@@ -0,0 +1,91 @@
+/*
+ * This file is part of Fort.
+ *
+ * Fort is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Fort is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Fort.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2015 Niko Rosvall <niko@ideabyte.net>
+ *
+ */
+
+#ifndef KEYROTATOR_H
+#define KEYROTATOR_H
+
+#include <QThread>
+#include <QMutex>
+#include <QString>
+#include <QStringList>
+#include "keyring.h"
+
+/* Progress of a data key rotation.
+ */
+struct KeyRotationProgress
+{
+    bool running;
+    int totalRecords;
+    int processedRecords;
+    int rotatedRecords;
+    double recordsPerSecond;
+    int secondsRemaining;
+};
+
+/* Encrypts every stored record again with the current key of a key
+ * ring on a background thread.
+ *
+ * Records are processed in batches sorted by guid. Each batch is read,
+ * encrypted and committed while holding the storage mutex, so items
+ * stored on lock are never overwritten with older data. Between the
+ * batches the thread sleeps to leave disk and CPU to the user.
+ *
+ * Progress is persisted to fort.rotation after every batch, so an
+ * interrupted rotation continues where it stopped. Records that are
+ * already encrypted with the current key are skipped. The rotation is
+ * complete only once a final pass finds every record encrypted with
+ * the current key. Batches of a packed vault are journaled and the
+ * vault is rewritten once at the end.
+ */
+class KeyRotator : public QThread
+{
+public:
+    KeyRotator(const KeyRing &keys, QMutex *storageMutex);
+    void setBatchSize(int size);
+    void setBatchDelay(int milliseconds);
+    void stop();
+    bool isComplete();
+    KeyRotationProgress progress();
+    QString getLastErrorMessage();
+    static bool readProgress(quint32 &generation, QString &lastId);
+    static bool writeProgress(quint32 generation, const QString &lastId);
+    static void clearProgress();
+
+protected:
+    void run();
+
+private:
+    KeyRing _keys;
+    QMutex *_storageMutex;
+    QMutex _stateMutex;
+    int _batchSize;
+    int _batchDelay;
+    bool _stopRequested;
+    bool _complete;
+    KeyRotationProgress _progress;
+    QString _lastErrorMessage;
+    bool listRecords(QStringList &ids, bool pendingOnly);
+    bool stopRequested();
+    void fail(const QString &message);
+
+    Q_DISABLE_COPY(KeyRotator)
+};
+
+#endif // KEYROTATOR_H
@@ -21,13 +21,16 @@
 #include "logindialog.h"
 #include "ui_logindialog.h"
 #include <QMessageBox>
+#include <QtConcurrentRun>
 
 /* Constructor.
  * Setup ui and default variables.
  */
 LogInDialog::LogInDialog(Security *sec, QWidget *parent) :
     QDialog(parent),
-    ui(new Ui::LogInDialog)
+    ui(new Ui::LogInDialog),
+    _decryptStarted(false),
+    _speculative(false)
 {
     ui->setupUi(this);
 
@@ -40,6 +43,12 @@ LogInDialog::LogInDialog(Security *sec, QWidget *parent) :
     //As passphrase input field theme is modified on error, take a copy of
     //the original style of the widget.
     _lineEditPassStyle = ui->linePassword->styleSheet();
+
+    ui->progressBar->setVisible(false);
+
+    connect(&_verifyWatcher, SIGNAL(finished()), this, SLOT(onLoginStepFinished()));
+    connect(&_decryptWatcher, SIGNAL(finished()), this, SLOT(onLoginStepFinished()));
+    connect(&_progressTimer, SIGNAL(timeout()), this, SLOT(onProgressTimerTick()));
 }
 
 /* Deconstructor.
@@ -71,45 +80,166 @@ void LogInDialog::on_pushButtonCancel_clicked()
 /* Called when OK button is clicked.
  * Perform decryption of the data.
  *
- * On decryption failure passphrase field css style is modified
- * to indicate an error. Last error message is also displayed.
- * On failure the dialog does not close.
+ * Passphrase is validated with bcrypt on a worker thread. At the same
+ * time the data is decrypted speculatively into memory, the items are
+ * only used if the passphrase turns out to be valid. The dialog stays
+ * responsive and shows the decryption progress.
+ *
+ * Data keys are never created or written to fort.dek before the
+ * validation. If there is no fort.dek, decryption is started only after
+ * the validation. If fort.dek protects no items and can't be unwrapped,
+ * the speculative decryption fails and is run again after the validation,
+ * replacing the keys.
  */
 void LogInDialog::on_pushButtonOK_clicked()
 {
-    this->setCursor(Qt::WaitCursor);
+    if(isBusy())
+        return;
+
+    QString passphrase = ui->linePassword->text().trimmed();
+
+    setBusy(true);
+    _decryptStarted = false;
+    _speculative = false;
+
+    //When login dialog is active the data is always encrypted
+    _sec->setMasterPassphraseHash(Security::createHashFromString(passphrase));
+    _verifyWatcher.setFuture(QtConcurrent::run(Security::checkPassphrase, passphrase));
+
+    if(Security::hasDataKeys())
+    {
+        _decryptStarted = true;
+        _speculative = true;
+        _decryptWatcher.setFuture(QtConcurrent::run(_sec, &Security::decryptAll, false));
+    }
+}
+
+/* Called when validation or decryption finishes. Once both are done
+ * the decrypted items are either accepted or wiped.
+ *
+ * On failure passphrase field css style is modified to indicate an
+ * error, see LogInDialog::showLoginError(). On failure the dialog
+ * does not close.
+ */
+void LogInDialog::onLoginStepFinished()
+{
+    //Both steps may finish before the first notification is handled
+    if(!_progressTimer.isActive() || _verifyWatcher.isRunning() || _decryptWatcher.isRunning())
+        return;
+
+    QString error = _verifyWatcher.result();
+
+    if(!error.isEmpty())
+    {
+        showLoginError(error);
+        return;
+    }
+
+    //Keys are created only now that the passphrase is valid
+    if(!_decryptStarted ||
+       (_speculative && !_decryptWatcher.result() && !Security::hasStoredData()))
+    {
+        _decryptStarted = true;
+        _speculative = false;
+        _decryptWatcher.setFuture(QtConcurrent::run(_sec, &Security::decryptAll, true));
+        return;
+    }
+
+    //If working return Accepted result
+    if(_decryptWatcher.result())
+    {
+        setBusy(false);
+        this->close();
+        this->setResult(QDialog::Accepted);
+    }
+    else
+        showLoginError(_sec->getLastErrorMessage());
+}
+
+/* Show how many of the items have been decrypted.
+ */
+void LogInDialog::onProgressTimerTick()
+{
+    int done;
+    int total;
+
+    _sec->decryptProgress(done, total);
+
+    //Busy indicator until the number of items is known
+    if(!_decryptStarted || total == 0)
+        ui->progressBar->setRange(0, 0);
+    else
+    {
+        ui->progressBar->setRange(0, total);
+        ui->progressBar->setValue(done);
+    }
+}
+
+/* Returns true while the login is being processed.
+ */
+bool LogInDialog::isBusy()
+{
+    return _verifyWatcher.isRunning() || _decryptWatcher.isRunning() || _progressTimer.isActive();
+}
+
+/* Disable input and show progress while the login is processed.
+ */
+void LogInDialog::setBusy(bool busy)
+{
+    ui->linePassword->setEnabled(!busy);
+    ui->pushButtonOK->setEnabled(!busy);
+    ui->pushButtonCancel->setEnabled(!busy);
+    ui->pushButtonExit->setEnabled(!busy);
+    ui->progressBar->setVisible(busy);
 
-    //First validate the passphrase.
-    if(_sec->validateLogin(ui->linePassword->text().trimmed()))
+    if(busy)
     {
-        //When login dialog is active the data is always encrypted
-        //This method will decrypt the data
-        QString hash = Security::createHashFromString(ui->linePassword->text().trimmed());
-        _sec->setMasterPassphraseHash(hash);
-
-        //If working return Accepted result
-        if(_sec->decryptAll())
-        {
-            this->close();
-            this->setResult(QDialog::Accepted);
-        }
-        else
-        {
-            //Clear password field and set an error color if passphrase is invalid
-            ui->linePassword->setText("");
-            ui->linePassword->setStyleSheet("QLineEdit{border:2px solid red;}");
-
-            QMessageBox::information(this,"Fort Password Manager",_sec->getLastErrorMessage());
-        }
+        ui->progressBar->setRange(0, 0);
+        _progressTimer.start(100);
+        this->setCursor(Qt::BusyCursor);
     }
     else
     {
-        QMessageBox::information(this,"Fort Password Manager",_sec->getLastErrorMessage());
-        ui->linePassword->setText("");
-        ui->linePassword->setStyleSheet("QLineEdit{border:2px solid red;}");
+        _progressTimer.stop();
+        this->setCursor(Qt::ArrowCursor);
     }
+}
+
+/* Clear password field and set an error color if passphrase is invalid.
+ * Anything decrypted, the data keys and the passphrase hash are wiped,
+ * whichever step failed.
+ */
+void LogInDialog::showLoginError(const QString &message)
+{
+    _sec->discardUnlockedItems();
+    _sec->clearMasterPassphraseHashFromMemory();
+    setBusy(false);
+
+    ui->linePassword->setText("");
+    ui->linePassword->setStyleSheet("QLineEdit{border:2px solid red;}");
+    ui->linePassword->setFocus();
+
+    QMessageBox::information(this,"Fort Password Manager",message);
+}
+
+/* Start reading the encrypted data while the user
+ * types the passphrase.
+ */
+void LogInDialog::showEvent(QShowEvent *event)
+{
+    _sec->startPrefetch();
+    QDialog::showEvent(event);
+}
+
+/* Closing the dialog is ignored while the login is processed,
+ * the workers use the Security instance.
+ */
+void LogInDialog::reject()
+{
+    if(isBusy())
+        return;
 
-    this->setCursor(Qt::ArrowCursor);
+    QDialog::reject();
 }
 
 /* If an error occurred on decryption, passphrase field css style
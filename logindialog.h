@@ -22,6 +22,8 @@
 #define LOGINDIALOG_H
 
 #include <QDialog>
+#include <QFutureWatcher>
+#include <QTimer>
 #include "security.h"
 
 namespace Ui {
@@ -45,10 +47,25 @@ private slots:
 
     void on_pushButtonExit_clicked();
 
+    void onLoginStepFinished();
+    void onProgressTimerTick();
+
+protected:
+    void reject();
+    void showEvent(QShowEvent *event);
+
 private:
     Ui::LogInDialog *ui;
     Security *_sec;
     QString _lineEditPassStyle;
+    QFutureWatcher<QString> _verifyWatcher;
+    QFutureWatcher<bool> _decryptWatcher;
+    QTimer _progressTimer;
+    bool _decryptStarted;
+    bool _speculative;
+    bool isBusy();
+    void setBusy(bool busy);
+    void showLoginError(const QString &message);
 };
 
 #endif // LOGINDIALOG_H
@@ -22,7 +22,9 @@
 #include <QFile>
 #include <QTextStream>
 #include <QMessageBox>
+#include <QThread>
 #include <iostream>
+#include <botan/init.h>
 #include "mainwindow.h"
 #include "masterpassphrasesetup.h"
 #include "environment.h"
@@ -30,6 +32,7 @@
 #include "security.h"
 #include "settingsparser.h"
 #include "runguard.h"
+#include "secretcache.h"
 
 /* Simple helper function to create the fort configuration
  * file if it does not exist.
@@ -56,6 +59,9 @@ int main(int argc, char *argv[])
 {
      QApplication a(argc, argv);
 
+    //Items are encrypted and decrypted on multiple threads.
+    Botan::LibraryInitializer init("thread_safe=true");
+
     //Simple sha1 hash of "fortpasswordmanager"
     RunGuard guard("ececb360a80961cdd61ced9cd5d7418449ca09f7");
 
@@ -66,13 +72,25 @@ int main(int argc, char *argv[])
         return 0;
     }
 
-    a.setStyleSheet("QListWidget:item{padding:5px;}");
+    a.setStyleSheet("QListView:item{padding:5px;}");
 
     createInitialConfigurationFile();
 
     Security sec;
     bool firstRun = false;
 
+    //Number of threads used for encryption and decryption.
+    SettingsParser settings;
+    sec.setThreadCount(settings.getInt("cryptothreads", QThread::idealThreadCount()));
+
+    //Decrypted passwords and notes kept in memory and for how many seconds.
+    SecretCache::setLimits(settings.getInt("secretcachesize", 16),
+                           settings.getInt("secretcachetimeout", 30));
+
+    //Records encrypted per batch and milliseconds between batches on key rotation.
+    sec.setKeyRotationThrottle(settings.getInt("keyrotationbatch", 500),
+                               settings.getInt("keyrotationdelay", 100));
+
     if(Environment::isFirstRun())
     {
         MasterPassphraseSetup setupDialog(&sec);
@@ -92,9 +110,8 @@ int main(int argc, char *argv[])
     //If we just created the master password, no need to ask it again.
     //There should be no data to decrypt anyway, but make an additional check
     //if, for some reason there's data...and try to decrypt it with newly created
-    //master passphrase. We can assume that if IV exists, there's data. If there's
-    //no IV but some data still exists, it's broken anyway.
-    if(!firstRun || Environment::hasIV())
+    //master passphrase.
+    if(!firstRun || Security::hasStoredData())
     {
         LogInDialog loginDialog(&sec);
 
@@ -32,13 +32,15 @@
 #include "aboutdialog.h"
 #include "preferencesdialog.h"
 #include "dataexporter.h"
+#include "secretcache.h"
+#include "itemdelegate.h"
 
 /* Main window constructor.
  * Setup ui and initial flag statuses.
  *
  * Once program execution is in this point, possible data
- * is already decrypted. Decrypted data is populated to the
- * view.
+ * is already decrypted into memory. Decrypted data is populated
+ * to the view.
  */
 MainWindow::MainWindow(Security *sec, QWidget *parent) :
     QMainWindow(parent),
@@ -51,9 +53,32 @@ MainWindow::MainWindow(Security *sec, QWidget *parent) :
     _wantClose = false;
     _windowStateLoginDialog = NULL;
 
-    _collection.loadItems();
-    populateFromCollection(_collection);
+    _model = new ItemListModel(&_collection, this);
+    ui->listView->setModel(_model);
+    ui->listView->setItemDelegate(new ItemDelegate(ui->listView));
+    connect(ui->listView->selectionModel(),
+            SIGNAL(selectionChanged(QItemSelection,QItemSelection)),
+            this, SLOT(onListViewSelectionChanged()));
+
+    //Search is evaluated on a thread of its own, shortly after typing pauses
+    _searchWorker = new SearchWorker(&_collection, this);
+    connect(_searchWorker, SIGNAL(resultsReady(int,int,QList<int>,bool)),
+            this, SLOT(onSearchResultsReady(int,int,QList<int>,bool)));
+    connect(_searchWorker, SIGNAL(searchStale(int)), this, SLOT(onSearchStale(int)));
+    _searchWorker->start();
+    _searchGeneration = 0;
+    _searchFirstChunk = false;
+    _lastSearchLatency = 0;
+
+    _searchTimer = new QTimer(this);
+    _searchTimer->setSingleShot(true);
+    _searchTimer->setInterval(150);
+    connect(_searchTimer, SIGNAL(timeout()), this, SLOT(startSearch()));
+
+    _sec->loadUnlockedItems(_collection);
+    _model->reload();
     handleActionsState();
+    startScheduledKeyRotation();
 
     //Apply settings, at the moment idle interval as well as
     //_wantClose is set.
@@ -65,13 +90,11 @@ MainWindow::MainWindow(Security *sec, QWidget *parent) :
 }
 
 /* Deconstructor.
- * Release memory from all allocated items and delete ui.
+ * Stop searching and delete ui.
  */
 MainWindow::~MainWindow()
 {
-    for(int i = 0; i < ui->listWidget->count() - 1; i++)
-        delete ui->listWidget->takeItem(i);
-
+    _searchWorker->stop();
     delete ui;
     _timer->stop();
     delete _timer;
@@ -97,11 +120,13 @@ void MainWindow::changeEvent(QEvent *e)
             //This should also clear all the data (listview and backend collection)
             if(!_locked)
             {
-                if(_sec->encryptAll())
+                if(_sec->encryptAll(_collection))
                 {
                     _sec->clearMasterPassphraseHashFromMemory();
-                    ui->listWidget->clear();
+                    _searchTimer->stop();
+                    _searchWorker->cancel();
                     _collection.clearItems();
+                    _model->reload();
                     _locked = true;
                 }
                 else
@@ -125,10 +150,12 @@ void MainWindow::changeEvent(QEvent *e)
                 }
                 else
                 {
-                    //Upon successful decryption re-read items and populate the view
-                    _collection.loadItems();
-                    populateFromCollection(_collection);
+                    //Upon successful decryption load items and populate the view
+                    _sec->loadUnlockedItems(_collection);
+                    _model->reload();
+                    applySearch();
                     _locked = false;
+                    startScheduledKeyRotation();
                 }
 
                 delete _windowStateLoginDialog;
@@ -158,9 +185,10 @@ void MainWindow::closeEvent(QCloseEvent *event)
     {
         if(!_locked)
         {
-            if(_sec->encryptAll())
+            if(_sec->encryptAll(_collection))
             {
                 _sec->clearMasterPassphraseHashFromMemory();
+                _collection.clearItems();
                 _locked = true;
             }
             else
@@ -172,19 +200,25 @@ void MainWindow::closeEvent(QCloseEvent *event)
     }
 }
 
-/* Populate data from internal collection to
- * the view.
+/* Get the collection index of the item on a row of the view.
+ * If there is no such row -1 is returned.
  */
-void MainWindow::populateFromCollection(ItemCollection &collection)
+int MainWindow::getCollectionIndex(int row)
 {
-    ui->listWidget->clear();
+    return _model->collectionIndex(row);
+}
 
-    for(int i = 0; i < collection.itemCount(); i++)
-    {
-        Item it = collection.getItem(i);
-        ui->listWidget->addItem(getQListWidgetItem(it.getTitle(),
-                                                   it.getIsFavorite()));
-    }
+/* Select a row of the view and scroll to it.
+ */
+void MainWindow::selectRow(int row)
+{
+    QModelIndex index = _model->index(row);
+
+    if(!index.isValid())
+        return;
+
+    ui->listView->setCurrentIndex(index);
+    ui->listView->scrollTo(index);
 }
 
 /* This methods handles toolbar and menu buttons
@@ -193,13 +227,14 @@ void MainWindow::populateFromCollection(ItemCollection &collection)
  */
 void MainWindow::handleActionsState()
 {
-    if(ui->listWidget->selectedItems().count() == 0)
+    if(!ui->listView->selectionModel()->hasSelection())
     {
         ui->actionCopy->setEnabled(false);
         ui->actionRemove->setEnabled(false);
         ui->actionEdit->setEnabled(false);
         ui->actionOpen_url->setEnabled(false);
         ui->actionTag->setEnabled(false);
+        ui->actionExport_Selected_As_Plain_Text->setEnabled(false);
     }
     else
     {
@@ -207,8 +242,11 @@ void MainWindow::handleActionsState()
         ui->actionRemove->setEnabled(true);
         ui->actionEdit->setEnabled(true);
         ui->actionTag->setEnabled(true);
-        if(_collection.getItem(
-                    ui->listWidget->currentIndex().row()).getHasUrl())
+        ui->actionExport_Selected_As_Plain_Text->setEnabled(true);
+
+        int current = getCollectionIndex(ui->listView->currentIndex().row());
+
+        if(current >= 0 && _collection.getItemView(current).getHasUrl())
             ui->actionOpen_url->setEnabled(true);
         else
             ui->actionOpen_url->setEnabled(false);
@@ -231,49 +269,91 @@ void MainWindow::on_actionNew_triggered()
         item.setNotes(d.getNotes());
         item.setFavorite(d.getIsFavorite());
 
-        _collection.addItem(item);
+        int row = _model->addItem(item);
 
-        //ui->listWidget->addItem(getQListWidgetItem(item.getTitle(),item.getIsFavorite()));
-        //ui->listWidget->setCurrentRow(ui->listWidget->count() - 1,
-                                      //QItemSelectionModel::ClearAndSelect);
-
-        populateFromCollection(_collection);
-
-        //Scroll to the end of the list(where the new item is) if the item is not favorite.
-        //Favorites are always on top;
-        if(!item.getIsFavorite())
-            ui->listWidget->setCurrentRow(ui->listWidget->count() - 1,QItemSelectionModel::ClearAndSelect);
+        //Item is shown and selected if it matches an active search.
+        //Favorites are always on top, others at the end of the list
+        if(row < 0)
+            applySearch(item.getID());
+        else
+            selectRow(row);
     }
 }
 
 /* Called when user wants to remove
- * an item from the view.
+ * the selected items from the view.
  *
- * Item is also removed from the internal collection.
+ * Items are also removed from the internal collection.
+ * Several items are removed in one batch.
  */
 void MainWindow::on_actionRemove_triggered()
 {
-    int row = ui->listWidget->currentIndex().row();
-    int current = _collection.getItemIndexByName
-            (ui->listWidget->item(row)->text());
+    QStringList guids = getSelectedGuids();
 
-    QListWidgetItem *item = ui->listWidget->takeItem(row);
-    delete item;
+    if(guids.count() == 1)
+    {
+        _model->removeItem(ui->listView->selectionModel()->selectedRows().first().row());
+    }
+    else if(guids.count() > 1)
+    {
+        _collection.beginBatch();
+
+        foreach(QString guid, guids)
+            _collection.removeItem(_collection.getItemIndexByGuid(guid));
+
+        _collection.commitBatch();
+        applySearch();
+    }
 
-    _collection.removeItem(current);
     handleActionsState();
 }
 
+/* Get guids of the selected items in the order
+ * of the view.
+ */
+QStringList MainWindow::getSelectedGuids()
+{
+    QModelIndexList rows = ui->listView->selectionModel()->selectedRows();
+    QList<int> sorted;
+    QStringList guids;
+
+    foreach(QModelIndex index, rows)
+        sorted << index.row();
+
+    qSort(sorted);
+
+    foreach(int row, sorted)
+    {
+        int current = getCollectionIndex(row);
+
+        if(current >= 0)
+            guids << _collection.getItemView(current).getID();
+    }
+
+    return guids;
+}
+
 /* Copies selected plain passphrase of the item
  * to the clipboard.
  */
 void MainWindow::setSelectedItemPasswordToClipboard(int itemRow)
 {
-    int current = _collection.getItemIndexByName
-            (ui->listWidget->item(itemRow)->text());
+    int current = getCollectionIndex(itemRow);
+
+    if(current < 0)
+        return;
+
+    bool ok;
+    QString password = _collection.getItem(current).getPassword(&ok);
+
+    if(!ok)
+    {
+        ui->statusBar->showMessage(tr("Unable to decrypt the password"), 1500);
+        return;
+    }
 
     QClipboard *cb = QApplication::clipboard();
-    cb->setText(_collection.getItem(current).getPassword());
+    cb->setText(password);
 
     ui->statusBar->showMessage(tr("Password copied"),800);
 }
@@ -281,7 +361,7 @@ void MainWindow::setSelectedItemPasswordToClipboard(int itemRow)
 /* When item on the view is double clicked,
  * copy the plain password to the clipboard.
  */
-void MainWindow::on_listWidget_doubleClicked(const QModelIndex &index)
+void MainWindow::on_listView_doubleClicked(const QModelIndex &index)
 {
     setSelectedItemPasswordToClipboard(index.row());
 }
@@ -292,13 +372,13 @@ void MainWindow::on_listWidget_doubleClicked(const QModelIndex &index)
  */
 void MainWindow::on_actionCopy_triggered()
 {
-    setSelectedItemPasswordToClipboard(ui->listWidget->currentIndex().row());
+    setSelectedItemPasswordToClipboard(ui->listView->currentIndex().row());
 }
 
 /* Called when an item is selected in the view.
  * Handle button states.
  */
-void MainWindow::on_listWidget_itemSelectionChanged()
+void MainWindow::onListViewSelectionChanged()
 {
     handleActionsState();
 }
@@ -315,44 +395,21 @@ void MainWindow::on_actionLock_triggered()
  * show context menu with the same actions
  * found on the toolbar and in the item-menu.
  */
-void MainWindow::on_listWidget_customContextMenuRequested(const QPoint &pos)
+void MainWindow::on_listView_customContextMenuRequested(const QPoint &pos)
 {
-    QPoint p = ui->listWidget->mapToGlobal(pos);
+    QPoint p = ui->listView->mapToGlobal(pos);
 
     QMenu menu;
     menu.addAction(ui->actionNew);
     menu.addAction(ui->actionEdit);
     menu.addAction(ui->actionRemove);
+    menu.addAction(ui->actionTag);
     menu.addSeparator();
     menu.addAction(ui->actionCopy);
     menu.addAction(ui->actionOpen_url);
     menu.exec(p);
 }
 
-/* Get a pointer to the item in the view.
- * Set item status tip and an icon depending
- * if the item is tagged as a favorite or not.
- *
- * Allocated items are deleted in the class deconstructor.
- */
-QListWidgetItem* MainWindow::getQListWidgetItem(QString title,bool fav)
-{
-    QListWidgetItem *i = new QListWidgetItem(title);
-
-    QIcon icon(":/icons/Tag.png");
-
-    if(fav)
-        i->setIcon(icon);
-    else
-        i->setIcon(QIcon(":/icons/Tag2.png"));
-
-    i->setStatusTip(
-                _collection.getItem
-                (_collection.getItemIndexByName(title)).getUser());
-
-    return i;
-}
-
 /* Called from menu action show preferences dialog.
  * Applies settings in the runtime.
  */
@@ -367,6 +424,9 @@ void MainWindow::applySettings()
 
     int idleValue = _settingsParser.getIntIdleTime("idleinterval");
     _idleDetector.setWantedIdleTime(idleValue * 60000);
+
+    //Search titles, usernames and urls exactly instead of ranked fuzzy matching
+    _collection.setFuzzySearch(!_settingsParser.getBoolean("exactsearch"));
 }
 
 /* Edit action.
@@ -374,38 +434,48 @@ void MainWindow::applySettings()
  * Open add item dialog and fill it with data from
  * the selected item.
  *
- * If user edits the item data, old item is removed
- * and new one is added with the edited data.
+ * If user edits the item data, the item is changed
+ * in place keeping its guid.
  */
 void MainWindow::on_actionEdit_triggered()
 {
-    int row = ui->listWidget->currentIndex().row();
-    int current = _collection.getItemIndexByName
-            (ui->listWidget->item(row)->text());
+    int row = ui->listView->currentIndex().row();
+    int current = getCollectionIndex(row);
+
+    if(current < 0)
+        return;
+
+    Item selected = _collection.getItem(current);
+    bool passwordOk;
+    bool notesOk;
+    QString password = selected.getPassword(&passwordOk);
+    QString notes = selected.getNotes(&notesOk);
+
+    //Saving the dialog would replace the secrets with empty ones
+    if(!passwordOk || !notesOk)
+    {
+        QMessageBox::information(this,"Fort Password Manager",
+                                 "Unable to decrypt the password and notes of the item.");
+        return;
+    }
 
     ItemDialog d(this);
     d.setWindowTitle("Edit item");
-    d.setData(_collection.getItem(current).getTitle(),
-              _collection.getItem(current).getUser(),
-              _collection.getItem(current).getPassword(),
-              _collection.getItem(current).getUrl(),
-              _collection.getItem(current).getNotes(),
-              _collection.getItem(current).getIsFavorite());
+    d.setData(selected.getTitle(),
+              selected.getUser(),
+              password,
+              selected.getUrl(),
+              notes,
+              selected.getIsFavorite());
 
     if(d.exec() == QDialog::Accepted)
     {
-        QListWidgetItem *curritem = ui->listWidget->takeItem(row);
-        delete curritem;
-        _collection.removeItem(current);
-
-        Item item(d.getTitle(),d.getUser(),d.getPassword());
-        item.setUrl(d.getUrl());
-        item.setFavorite(d.getIsFavorite());
-        item.setNotes(d.getNotes());
+        Item changes(d.getTitle(),d.getUser(),d.getPassword());
+        changes.setUrl(d.getUrl());
+        changes.setFavorite(d.getIsFavorite());
+        changes.setNotes(d.getNotes());
 
-        _collection.addItem(item);
-
-        populateFromCollection(_collection);
+        _collection.updateItem(selected.getID(), changes);
     }
 }
 
@@ -414,80 +484,180 @@ void MainWindow::on_actionEdit_triggered()
  */
 void MainWindow::on_actionOpen_url_triggered()
 {
-    int row = ui->listWidget->currentIndex().row();
-    int current = _collection.getItemIndexByName
-            (ui->listWidget->item(row)->text());
+    int row = ui->listView->currentIndex().row();
+    int current = getCollectionIndex(row);
+
+    if(current < 0)
+        return;
 
-    QUrl url = _collection.getItem(current).getUrlAsQUrl();
+    QUrl url(_collection.getItemView(current).getUrl());
 
     if(url.isValid())
     {
-        setSelectedItemPasswordToClipboard(current);
+        setSelectedItemPasswordToClipboard(row);
         QDesktopServices::openUrl(url);
     }
 }
 
 /* Tag action.
  *
- * Tag selected item as a favorite. If the item
- * is already a favorite, favorite tag is removed
- * from the item.
+ * Tag selected items as favorites. If all of them
+ * are already favorites, favorite tag is removed
+ * from the items.
  *
- * This action also clears a search if it's active.
- * Clearing search is necessary as we need to populate
- * all items again to get the right order for them
- * tagged items.
+ * Items stay on their rows until the items are loaded
+ * again, favorites are then on top. Several items are
+ * changed in one batch.
  */
 void MainWindow::on_actionTag_triggered()
 {
-    int row = ui->listWidget->currentIndex().row();
-    int current = _collection.getItemIndexByName
-            (ui->listWidget->item(row)->text());
+    QStringList guids = getSelectedGuids();
+    bool favorite = false;
 
-    Item item = _collection.getItem(current);
+    if(guids.isEmpty())
+        return;
 
-    if(item.getIsFavorite())
-        item.setFavorite(false);
-    else
-        item.setFavorite(true);
+    foreach(QString guid, guids)
+    {
+        if(!_collection.getItemView(_collection.getItemIndexByGuid(guid)).getIsFavorite())
+            favorite = true;
+    }
 
-    _collection.removeItem(current);
-    _collection.addItem(item);
+    bool batch = guids.count() > 1;
 
-    if(!ui->lineEditSearch->text().isEmpty())
-        ui->lineEditSearch->setText("");
-    else
-        populateFromCollection(_collection);
+    if(batch)
+        _collection.beginBatch();
+
+    foreach(QString guid, guids)
+    {
+        Item item = _collection.getItemByGuid(guid);
+        item.setFavorite(favorite);
+        _collection.updateItem(guid, item);
+    }
+
+    if(batch)
+    {
+        _collection.commitBatch();
+        applySearch();
+    }
 }
 
 /* Called when users starts searching items.
  * Only items that match the search will be displayed
  * in the view.
  *
- * Copy is taken of the internal item collection
- * so we can easily restore the original view.
+ * Search starts once typing pauses, an empty search
+ * shows all items at once.
  */
 void MainWindow::on_lineEditSearch_textChanged(const QString &arg1)
 {
-    _collection.createSearchView(arg1);
-    populateFromCollection(_collection);
-     _collection._list = _collection._backupList;
+    _searchLatency.start();
+    _searchSelection.clear();
+
+    if(arg1.isEmpty())
+        applySearch();
+    else
+        _searchTimer->start();
+}
+
+/* Show the items matching the search text in the view,
+ * or all items if the search text is empty.
+ *
+ * Item with the given guid is selected once it is shown.
+ */
+void MainWindow::applySearch(const QString &guid)
+{
+    _searchSelection = guid;
+
+    if(!ui->lineEditSearch->text().isEmpty())
+    {
+        startSearch();
+        return;
+    }
+
+    _searchTimer->stop();
+    _searchWorker->cancel();
+    _model->clearSearchResult();
+
+    if(!guid.isEmpty())
+        selectRow(_model->rowOfCollectionIndex(_collection.getItemIndexByGuid(guid)));
+
+    _searchSelection.clear();
+}
+
+/* Queue the search text to the search worker. Results of
+ * the previous search are ignored from now on.
+ */
+void MainWindow::startSearch()
+{
+    _searchTimer->stop();
+    _searchGeneration = _searchWorker->search(ui->lineEditSearch->text());
+    _searchFirstChunk = true;
+}
+
+/* Called when the search worker has results. Results of an
+ * older search are dropped. If the collection has changed
+ * since the search, indexes are stale and search is done again.
+ *
+ * First chunk replaces the view, the rest are appended to it.
+ * Time from the keystroke to the first results is shown once
+ * the last chunk arrives.
+ */
+void MainWindow::onSearchResultsReady(int generation, int revision,
+                                      const QList<int> &indexes, bool last)
+{
+    if(generation != _searchGeneration)
+        return;
+
+    if(revision != _collection.searchRevision())
+    {
+        startSearch();
+        return;
+    }
+
+    if(_searchFirstChunk)
+    {
+        _model->setSearchResult(indexes);
+        _searchFirstChunk = false;
+        _lastSearchLatency = _searchLatency.elapsed();
+    }
+    else
+    {
+        _model->appendSearchResult(indexes);
+    }
+
+    if(!last)
+        return;
 
-    if(this->ui->lineEditSearch->text().isEmpty())
-        populateFromCollection(_collection);
+    if(!_searchSelection.isEmpty())
+    {
+        selectRow(_model->rowOfCollectionIndex(_collection.getItemIndexByGuid(_searchSelection)));
+        _searchSelection.clear();
+    }
 
+    ui->statusBar->showMessage(QString("%1 items found, first shown in %2 ms")
+                               .arg(_model->rowCount()).arg(_lastSearchLatency), 3000);
+}
+
+/* Called when the search was abandoned because the collection
+ * changed while searching. The search is done again, unless a
+ * newer one has already started.
+ */
+void MainWindow::onSearchStale(int generation)
+{
+    if(generation == _searchGeneration)
+        startSearch();
 }
 
 /* Change master passphrase action.
  * Displays a dialog that allows user to change the
- * master passphrase.
+ * master passphrase. Items are not encrypted again,
+ * see Security::changeMasterPassphrase()
  */
 void MainWindow::on_actionMaster_Passphrase_triggered()
 {
     changemasterpassphrase dialog(_sec, this);
-
-    if(dialog.exec() == QDialog::Accepted)
-        _sec->setMasterPassphraseHash(dialog.getNewPassphraseHash());
+    dialog.exec();
 }
 
 /* Called when File->Quit action is triggered.
@@ -509,6 +679,73 @@ void MainWindow::on_actionAbout_triggered()
     dialog.exec();
 }
 
+/* Start rotating the data key if it is older than the
+ * "keyrotationdays" property or an earlier rotation was
+ * interrupted. Otherwise records of older formats are
+ * upgraded. Both run in the background.
+ */
+void MainWindow::startScheduledKeyRotation()
+{
+    int maxAgeDays = _settingsParser.getInt("keyrotationdays", 0);
+
+    if(_sec->isKeyRotationDue(maxAgeDays))
+        _sec->startKeyRotation();
+    else if(_sec->isMigrationDue())
+        _sec->startMigration();
+}
+
+/* Show progress of a running key rotation or format
+ * migration on the status bar.
+ */
+void MainWindow::showKeyRotationProgress()
+{
+    if(_sec->updateMigration())
+    {
+        MigrationProgress migration = _sec->migrationProgress();
+
+        if(migration.running)
+            ui->statusBar->showMessage(QString("Upgrading items: %1/%2")
+                                       .arg(migration.processedRecords)
+                                       .arg(migration.totalRecords), 1500);
+    }
+
+    if(!_sec->updateKeyRotation())
+        return;
+
+    KeyRotationProgress progress = _sec->keyRotationProgress();
+
+    if(!progress.running)
+        return;
+
+    QString message = QString("Rotating encryption key: %1/%2 items, %3 items/s")
+            .arg(progress.processedRecords).arg(progress.totalRecords)
+            .arg(progress.recordsPerSecond, 0, 'f', 0);
+
+    if(progress.secondsRemaining >= 0)
+        message += QString(", %1 s left").arg(progress.secondsRemaining);
+
+    ui->statusBar->showMessage(message, 1500);
+}
+
+/* Queue the changes done since the last tick to be written in
+ * the background and show the state of the write queue on the
+ * status bar. Changes are not queued in the middle of a batch.
+ */
+void MainWindow::queueChanges()
+{
+    if(!_locked && _collection.isDirty() && !_collection.isBatching())
+        _sec->queueChanges(_collection);
+
+    WriteBehindStatus status = _sec->writeBehindStatus();
+
+    if(status.failed)
+        ui->statusBar->showMessage(tr("Saving changes failed, retrying on next change"), 1500);
+    else if(status.compactionFailed)
+        ui->statusBar->showMessage(tr("Changes are saved, compacting the vault failed"), 1500);
+    else if(status.queueDepth > 0)
+        ui->statusBar->showMessage(QString("Saving %1 changes...").arg(status.queueDepth), 1500);
+}
+
 /* This method is executed everytime when the timer ticks.
  * Timer is set to tick every second.
  *
@@ -521,10 +758,17 @@ void MainWindow::on_actionAbout_triggered()
  * By minimizing the window(which will also encrypt the data, see onChangeEvent)
  * we protect the user data.
  *
+ * Changes are written in the background while Fort is open,
+ * see MainWindow::queueChanges()
+ *
  * User has the option to disable this functionality via preferences.
  */
 void MainWindow::onTimerTick()
 {
+    SecretCache::expire();
+    showKeyRotationProgress();
+    queueChanges();
+
     int idle_value = _idleDetector.getWantedIdleValue();
     long currentIdleTime = _idleDetector.getIdleTime();
 
@@ -546,11 +790,15 @@ void MainWindow::onTimerTick()
  */
 void MainWindow::on_actionPreferences_triggered()
 {
-    PreferencesDialog dialog(&_settingsParser, this);
+    PreferencesDialog dialog(&_settingsParser, _sec, this);
 
     if(dialog.exec() == QDialog::Accepted)
        applySettings();
 
+    //Moving the data stops key rotation and migration
+    if(!_locked)
+        startScheduledKeyRotation();
+
 }
 
 /* Export all items as plain text including passwords.
@@ -565,6 +813,16 @@ void MainWindow::on_actionExport_As_Plain_Text_triggered()
 
       if (reply == QMessageBox::Yes) {
 
+          //Make sure the exported items are also on disk
+          queueChanges();
+
+          if(!_sec->flushWrites())
+          {
+              QMessageBox::information(this,"Fort Password Manager",
+                                       _sec->getLastErrorMessage());
+              return;
+          }
+
           DataExporter exporter(&_collection);
           QString fileName = QFileDialog::getSaveFileName(this, "Save File",
                                       "",
@@ -574,8 +832,48 @@ void MainWindow::on_actionExport_As_Plain_Text_triggered()
               if(!exporter.exportAll(fileName))
               {
                     QMessageBox::information(this,"Fort Password Manager",
-                                             "Failed to export items. File permission problem?");
+                                             "Failed to export items. File permission problem or corrupted data?");
               }
           }
       }
 }
+
+/* Export the selected items as plain text including
+ * passwords.
+ */
+void MainWindow::on_actionExport_Selected_As_Plain_Text_triggered()
+{
+    QStringList guids = getSelectedGuids();
+
+    if(guids.isEmpty())
+        return;
+
+    QMessageBox::StandardButton reply;
+    reply = QMessageBox::question(this, "Fort Password Manager",
+                                  "Are you sure? Exported data will be decrypted and available as plain text including your passwords.",
+                                  QMessageBox::Yes|QMessageBox::No);
+
+    if(reply != QMessageBox::Yes)
+        return;
+
+    //Make sure the exported items are also on disk
+    queueChanges();
+
+    if(!_sec->flushWrites())
+    {
+        QMessageBox::information(this,"Fort Password Manager",
+                                 _sec->getLastErrorMessage());
+        return;
+    }
+
+    DataExporter exporter(&_collection);
+    QString fileName = QFileDialog::getSaveFileName(this, "Save File",
+                                                    "",
+                                                    "Plain Text (*.txt)");
+
+    if(!fileName.isEmpty() && !exporter.exportByGuids(guids, fileName))
+    {
+        QMessageBox::information(this,"Fort Password Manager",
+                                 "Failed to export items. File permission problem or corrupted data?");
+    }
+}
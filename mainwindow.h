@@ -23,16 +23,19 @@
 
 #include <QMainWindow>
 #include <QModelIndex>
-#include <QListWidgetItem>
+#include <QStringList>
 #include <QCloseEvent>
 #include <QMouseEvent>
 #include <QKeyEvent>
 #include <QTimer>
+#include <QElapsedTimer>
 #include "itemcollection.h"
+#include "itemlistmodel.h"
 #include "security.h"
 #include "idledetector.h"
 #include "settingsparser.h"
 #include "logindialog.h"
+#include "searchworker.h"
 
 namespace Ui {
 class MainWindow;
@@ -53,11 +56,11 @@ protected:
 private slots:
     void on_actionNew_triggered();
     void on_actionRemove_triggered();
-    void on_listWidget_doubleClicked(const QModelIndex &index);
+    void on_listView_doubleClicked(const QModelIndex &index);
     void on_actionCopy_triggered();
-    void on_listWidget_itemSelectionChanged();
+    void onListViewSelectionChanged();
     void on_actionLock_triggered();
-    void on_listWidget_customContextMenuRequested(const QPoint &pos);
+    void on_listView_customContextMenuRequested(const QPoint &pos);
     void on_actionEdit_triggered();
     void on_actionOpen_url_triggered();
     void on_actionTag_triggered();
@@ -68,21 +71,38 @@ private slots:
     void onTimerTick();
     void on_actionPreferences_triggered();
     void on_actionExport_As_Plain_Text_triggered();
+    void on_actionExport_Selected_As_Plain_Text_triggered();
+    void startSearch();
+    void onSearchResultsReady(int generation, int revision, const QList<int> &indexes, bool last);
+    void onSearchStale(int generation);
 
 private:
     Ui::MainWindow *ui;
     ItemCollection _collection;
-    void populateFromCollection(ItemCollection &collection);
+    ItemListModel *_model;
     void setSelectedItemPasswordToClipboard(int itemRow);
     void handleActionsState();
-    QListWidgetItem *getQListWidgetItem(QString title,bool fav);
+    int getCollectionIndex(int row);
+    QStringList getSelectedGuids();
+    void selectRow(int row);
+    void applySearch(const QString &guid = QString());
     Security *_sec;
     bool _locked;
     bool _wantClose;
     QTimer *_timer;
+    QTimer *_searchTimer;
+    SearchWorker *_searchWorker;
+    int _searchGeneration;
+    bool _searchFirstChunk;
+    QString _searchSelection;
+    QElapsedTimer _searchLatency;
+    qint64 _lastSearchLatency;
     IdleDetector _idleDetector;
     SettingsParser _settingsParser;
     void applySettings();
+    void startScheduledKeyRotation();
+    void showKeyRotationProgress();
+    void queueChanges();
     LogInDialog *_windowStateLoginDialog;
 };
 
@@ -23,17 +23,20 @@
 #include <QFileDialog>
 #include <QMessageBox>
 #include <QFile>
+#include <QDir>
 #include "environment.h"
 
 /* Constructor. Read settings from the configuration file
  * and set widgets to match.
  */
-PreferencesDialog::PreferencesDialog(SettingsParser *settingsParser,QWidget *parent) :
+PreferencesDialog::PreferencesDialog(SettingsParser *settingsParser, Security *sec,
+                                     QWidget *parent) :
     QDialog(parent),
     ui(new Ui::PreferencesDialog)
 {
     ui->setupUi(this);
     _settingsParser = settingsParser;
+    _sec = sec;
     _settingsApplied = false;
     ui->checkBoxMinimizeOnClose->setChecked(_settingsParser->getBoolean("minimizeonclose"));
 
@@ -94,48 +97,26 @@ void PreferencesDialog::on_buttonBox_clicked(QAbstractButton *button)
 }
 
 /* Save settings from the dialog widgets to the configuration file.
- * Data is also moved from the old datapath to the new one.
- * If, for some reason, user selects the same path as the old one is
- * file moving will fail silently. (rename() function)
+ * If the datapath was changed, data is also moved from the old
+ * datapath to the new one, see Security::moveDataPath().
  */
 void PreferencesDialog::saveSettings()
 {
     bool minimizeOnClose = ui->checkBoxMinimizeOnClose->isChecked();
     QString dataPath = ui->lineEditDataLocation->text();
     int idleInterval = ui->spinBoxIdleInternal->value();
+    QString currentPath = Environment::ensurePath();
+    QString canonicalPath = QDir(dataPath).canonicalPath();
 
-    //Set the datapath
-    //ensurePath gives us the old path, either the default path
-    //or a value from the configuration file.
-    QString oldpath = Environment::ensurePath();
+    //Moving waits for the queued writes, skip it if nothing changed
+    bool samePath = QDir::cleanPath(dataPath) == QDir::cleanPath(currentPath) ||
+            (!canonicalPath.isEmpty() && canonicalPath == QDir(currentPath).canonicalPath());
 
-    if(!_settingsParser->setString("datapath", dataPath))
+    //Set the datapath
+    if(!samePath && !_sec->moveDataPath(_settingsParser, dataPath))
     {
          QMessageBox::information(this,"Fort Password Manager",
-                                  "Error writing configuration property.");
-    }
-    else
-    {
-        //move all files from old dir to the new path (except fortrc)
-        //loop files in the old datapath and use qfile::rename to move them
-        QDir dir(oldpath);
-        QStringList filters;
-
-        filters << "*.plain";
-        filters << "*.iv";
-        filters << "*.pph";
-
-        QFileInfoList entries = dir.entryInfoList(filters,
-                                                  QDir::Files | QDir::NoDotAndDotDot);
-
-        foreach(QFileInfo entryInfo, entries)
-        {
-            QString filePath = entryInfo.absoluteFilePath();
-            QFile file(filePath);
-
-            file.rename(dataPath + "/" + entryInfo.fileName());
-            file.close();
-        }
+                                  _sec->getLastErrorMessage());
     }
 
     //Set minimizeOnClose
@@ -24,6 +24,7 @@
 #include <QDialog>
 #include <QAbstractButton>
 #include "settingsparser.h"
+#include "security.h"
 
 namespace Ui {
 class PreferencesDialog;
@@ -34,7 +35,7 @@ class PreferencesDialog : public QDialog
     Q_OBJECT
 
 public:
-    explicit PreferencesDialog(SettingsParser *settingsParser, QWidget *parent = 0);
+    explicit PreferencesDialog(SettingsParser *settingsParser, Security *sec, QWidget *parent = 0);
     ~PreferencesDialog();
 
 private slots:
@@ -48,6 +49,7 @@ private slots:
 private:
     Ui::PreferencesDialog *ui;
     SettingsParser *_settingsParser;
+    Security *_sec;
     void saveSettings();
     bool _settingsApplied;
 };
@@ -0,0 +1,489 @@
+/*
+ * This file is part of Fort.
+ *
+ * Fort is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Fort is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Fort.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2015 Niko Rosvall <niko@ideabyte.net>
+ *
+ */
+
+#include "recordcipher.h"
+#include <botan/pipe.h>
+#include <botan/botan.h>
+#include <botan/base64.h>
+#include <botan/eax.h>
+#include <botan/aes.h>
+#include <QtEndian>
+#include <string.h>
+
+using namespace Botan;
+
+/* Record formats:
+ *
+ * 4: as format 3, metadata is in the binary item format, see ItemCodec.
+ *    Secrets reused from older records may still be in the text format.
+ * 3: quint8 format, quint32 (little endian) metadata blob length,
+ *    metadata blob, secrets blob. Blobs start with the quint32 (little
+ *    endian) generation of the data key they are encrypted with.
+ * 2: as format 3, but blobs have no key generation.
+ * 1: quint8 format, sealed blob of the whole item.
+ *
+ * Blob is a 16 byte nonce followed by the ciphertext and a 16 byte tag.
+ * Metadata and secrets blobs are authenticated with the item guid and a
+ * section name, so blobs can't be swapped between items or sections.
+ *
+ * Records written by older versions of Fort are base64 encoded
+ * AES-256/CBC/PKCS7 ciphertext. All of them share the initialization
+ * vector stored in fort.iv. Those and format 1 and 2 records can only be
+ * decrypted. Records without a key generation are encrypted with the
+ * key of generation zero.
+ */
+#define RECORD_FORMAT_LEGACY 0
+#define RECORD_FORMAT_EAX 1
+#define RECORD_FORMAT_SPLIT 2
+#define RECORD_FORMAT_ROTATABLE 3
+#define RECORD_FORMAT_CODEC 4
+#define RECORD_GENERATION_SIZE 4
+#define RECORD_NONCE_SIZE 16
+#define RECORD_TAG_SIZE 16
+#define RECORD_BLOB_OVERHEAD (RECORD_NONCE_SIZE + RECORD_TAG_SIZE)
+
+/* Associated data of a blob.
+ */
+static QByteArray blobHeader(const QString &id, const char *section)
+{
+    return id.toLatin1() + ':' + section;
+}
+
+/* Read the key generation in front of a blob.
+ */
+static quint32 readGeneration(const char *blob)
+{
+    return qFromLittleEndian<quint32>(reinterpret_cast<const uchar*>(blob));
+}
+
+/* Constructor. Cipher filters are created on first use.
+ * Records are sealed with the current key of the ring.
+ */
+RecordCipher::RecordCipher(const KeyRing &keys)
+    : _keys(keys), _decryptGeneration(0), _encryptor(0), _encryptPipe(0), _decryptor(0), _decryptPipe(0),
+      _legacyCipher(0), _legacyPipe(0), _hasLegacyIV(false)
+{
+}
+
+/* Deconstructor. Pipes own their filters.
+ */
+RecordCipher::~RecordCipher()
+{
+    reset();
+}
+
+/* Delete the pipes. An aborted message leaves a pipe in an unusable
+ * state, so pipes are recreated after a failure.
+ */
+void RecordCipher::reset()
+{
+    delete _encryptPipe;
+    delete _decryptPipe;
+    delete _legacyPipe;
+
+    _encryptPipe = 0;
+    _decryptPipe = 0;
+    _legacyPipe = 0;
+    _encryptor = 0;
+    _decryptor = 0;
+    _legacyCipher = 0;
+}
+
+/* Encrypt plain data with the current key and a new random nonce.
+ * Header is authenticated as associated data.
+ */
+bool RecordCipher::sealBlob(const QByteArray &header, const QByteArray &plain, QByteArray &blob)
+{
+    try
+    {
+        if(_encryptPipe == 0)
+        {
+            _encryptor = new EAX_Encryption(new AES_256, RECORD_TAG_SIZE);
+            _encryptor->set_key(_keys.currentKey());
+            _encryptPipe = new Pipe(_encryptor);
+        }
+
+        InitializationVector nonce(_rng, RECORD_NONCE_SIZE);
+
+        _encryptor->set_iv(nonce);
+        _encryptor->set_header(reinterpret_cast<const byte*>(header.constData()), header.length());
+        _encryptPipe->process_msg(reinterpret_cast<const byte*>(plain.constData()), plain.length());
+
+        SecureVector<byte> ciphertext = _encryptPipe->read_all(Pipe::LAST_MESSAGE);
+
+        uchar generation[RECORD_GENERATION_SIZE];
+        qToLittleEndian<quint32>(_keys.currentGeneration(), generation);
+
+        blob.resize(RECORD_GENERATION_SIZE + RECORD_NONCE_SIZE + ciphertext.size());
+        memcpy(blob.data(), generation, RECORD_GENERATION_SIZE);
+        memcpy(blob.data() + RECORD_GENERATION_SIZE, nonce.begin(), RECORD_NONCE_SIZE);
+        memcpy(blob.data() + RECORD_GENERATION_SIZE + RECORD_NONCE_SIZE,
+               ciphertext.begin(), ciphertext.size());
+    }
+    catch(...)
+    {
+        reset();
+        _lastErrorMessage = "Unable to encrypt the item.";
+        return false;
+    }
+
+    return true;
+}
+
+/* Decrypt a blob with the key of a generation and verify it
+ * together with the header. Blob starts with the nonce.
+ */
+bool RecordCipher::openBlob(const QByteArray &header, quint32 generation, const char *blob,
+                            int length, QByteArray &plain)
+{
+    if(length < RECORD_BLOB_OVERHEAD)
+    {
+        _lastErrorMessage = "Corrupted data.";
+        return false;
+    }
+
+    if(!_keys.hasKey(generation))
+    {
+        _lastErrorMessage = "Missing data key. Can't decrypt.";
+        return false;
+    }
+
+    try
+    {
+        if(_decryptPipe == 0)
+        {
+            _decryptor = new EAX_Decryption(new AES_256, RECORD_TAG_SIZE);
+            _decryptor->set_key(_keys.key(generation));
+            _decryptGeneration = generation;
+            _decryptPipe = new Pipe(_decryptor);
+        }
+        else if(_decryptGeneration != generation)
+        {
+            _decryptor->set_key(_keys.key(generation));
+            _decryptGeneration = generation;
+        }
+
+        const byte *data = reinterpret_cast<const byte*>(blob);
+
+        _decryptor->set_iv(InitializationVector(data, RECORD_NONCE_SIZE));
+        _decryptor->set_header(reinterpret_cast<const byte*>(header.constData()), header.length());
+        _decryptPipe->process_msg(data + RECORD_NONCE_SIZE, length - RECORD_NONCE_SIZE);
+
+        SecureVector<byte> plainData = _decryptPipe->read_all(Pipe::LAST_MESSAGE);
+        plain = QByteArray(reinterpret_cast<const char*>(plainData.begin()), plainData.size());
+    }
+    catch(...)
+    {
+        reset();
+        _lastErrorMessage = "Invalid passphrase or corrupted data.";
+        return false;
+    }
+
+    return true;
+}
+
+/* Encrypt metadata and secrets of an item into a record. Both are
+ * sealed with their own random nonce.
+ *
+ * Returns false on failure, the last error message is set.
+ */
+bool RecordCipher::seal(const QString &id, const QByteArray &meta, const QByteArray &secrets,
+                        QByteArray &record)
+{
+    QByteArray sealedSecrets;
+
+    if(!sealBlob(blobHeader(id, "secrets"), secrets, sealedSecrets))
+        return false;
+
+    return sealWithSecrets(id, meta, sealedSecrets, record);
+}
+
+/* Encrypt metadata of an item into a record reusing already sealed
+ * secrets of the same item, see openMeta(). Secrets are not decrypted.
+ *
+ * Returns false on failure, the last error message is set.
+ */
+bool RecordCipher::sealWithSecrets(const QString &id, const QByteArray &meta,
+                                   const QByteArray &sealedSecrets, QByteArray &record)
+{
+    QByteArray sealedMeta;
+
+    if(!sealBlob(blobHeader(id, "meta"), meta, sealedMeta))
+        return false;
+
+    uchar length[4];
+    qToLittleEndian<quint32>(sealedMeta.length(), length);
+
+    record.clear();
+    record.reserve(5 + sealedMeta.length() + sealedSecrets.length());
+    record.append(static_cast<char>(RECORD_FORMAT_CODEC));
+    record.append(reinterpret_cast<const char*>(length), 4);
+    record.append(sealedMeta);
+    record.append(sealedSecrets);
+
+    return true;
+}
+
+/* Decrypt only the metadata of a record. Secrets are returned still
+ * sealed, they are decrypted with openSecrets() when needed.
+ *
+ * Records of older formats have no separate secrets. Their whole plain
+ * data is returned as meta and sealedSecrets is left empty.
+ *
+ * Returns false on failure, the last error message is set.
+ */
+bool RecordCipher::openMeta(const QString &id, const QByteArray &record, QByteArray &meta,
+                            QByteArray &sealedSecrets)
+{
+    sealedSecrets.clear();
+
+    int format = recordFormat(record);
+
+    if(format != RECORD_FORMAT_SPLIT && format != RECORD_FORMAT_ROTATABLE &&
+       format != RECORD_FORMAT_CODEC)
+        return open(id, record, meta);
+
+    if(record.length() < 5)
+    {
+        _lastErrorMessage = "Corrupted data.";
+        return false;
+    }
+
+    qint64 metaLength = qFromLittleEndian<quint32>(reinterpret_cast<const uchar*>(record.constData() + 1));
+
+    if(metaLength > record.length() - 5)
+    {
+        _lastErrorMessage = "Corrupted data.";
+        return false;
+    }
+
+    const char *sealedMeta = record.constData() + 5;
+
+    if(format == RECORD_FORMAT_SPLIT)
+    {
+        if(!openBlob(blobHeader(id, "meta"), 0, sealedMeta, metaLength, meta))
+            return false;
+
+        //Secrets are handed out in the current blob layout
+        sealedSecrets = QByteArray(RECORD_GENERATION_SIZE, 0) + record.mid(5 + metaLength);
+
+        return true;
+    }
+
+    if(metaLength < RECORD_GENERATION_SIZE)
+    {
+        _lastErrorMessage = "Corrupted data.";
+        return false;
+    }
+
+    if(!openBlob(blobHeader(id, "meta"), readGeneration(sealedMeta),
+                 sealedMeta + RECORD_GENERATION_SIZE, metaLength - RECORD_GENERATION_SIZE, meta))
+        return false;
+
+    sealedSecrets = record.mid(5 + metaLength);
+
+    return true;
+}
+
+/* Decrypt secrets returned by openMeta().
+ *
+ * Returns false on failure, the last error message is set.
+ */
+bool RecordCipher::openSecrets(const QString &id, const QByteArray &sealedSecrets, QByteArray &secrets)
+{
+    if(sealedSecrets.length() < RECORD_GENERATION_SIZE)
+    {
+        _lastErrorMessage = "Corrupted data.";
+        return false;
+    }
+
+    return openBlob(blobHeader(id, "secrets"), readGeneration(sealedSecrets.constData()),
+                    sealedSecrets.constData() + RECORD_GENERATION_SIZE,
+                    sealedSecrets.length() - RECORD_GENERATION_SIZE, secrets);
+}
+
+/* Decrypt a whole record of an older format and verify it has not been
+ * modified or moved from another item. Records of the oldest format
+ * are decrypted with the initialization vector set by setLegacyIV()
+ *
+ * Returns false on failure, the last error message is set.
+ */
+bool RecordCipher::open(const QString &id, const QByteArray &record, QByteArray &plain)
+{
+    switch(recordFormat(record))
+    {
+    case RECORD_FORMAT_LEGACY:
+        return openLegacy(record, plain);
+    case RECORD_FORMAT_EAX:
+        return openBlob(id.toLatin1(), 0, record.constData() + 1, record.length() - 1, plain);
+    default:
+        _lastErrorMessage = "Unsupported record format.";
+        return false;
+    }
+}
+
+/* Decrypt a base64 encoded AES-256/CBC/PKCS7 record written by
+ * an older version of Fort.
+ */
+bool RecordCipher::openLegacy(const QByteArray &record, QByteArray &plain)
+{
+    if(!_hasLegacyIV)
+    {
+        _lastErrorMessage = "Missing initialization vector. Can't decrypt.";
+        return false;
+    }
+
+    if(!_keys.hasKey(0))
+    {
+        _lastErrorMessage = "Missing data key. Can't decrypt.";
+        return false;
+    }
+
+    try
+    {
+        if(_legacyPipe == 0)
+        {
+            _legacyCipher = get_cipher("AES-256/CBC/PKCS7", _keys.key(0), _legacyIV, DECRYPTION);
+            _legacyPipe = new Pipe(new Base64_Decoder, _legacyCipher);
+        }
+
+        _legacyCipher->set_iv(_legacyIV);
+        _legacyPipe->process_msg(record.trimmed().toStdString());
+
+        std::string plainData = _legacyPipe->read_all_as_string(Pipe::LAST_MESSAGE);
+        plain = QString::fromStdString(plainData).toUtf8();
+    }
+    catch(...)
+    {
+        reset();
+        _lastErrorMessage = "Invalid passphrase or corrupted data.";
+        return false;
+    }
+
+    return true;
+}
+
+/* Set the shared initialization vector of records written by
+ * older versions of Fort.
+ */
+void RecordCipher::setLegacyIV(const InitializationVector &iv)
+{
+    _legacyIV = iv;
+    _hasLegacyIV = true;
+
+    delete _legacyPipe;
+    _legacyPipe = 0;
+    _legacyCipher = 0;
+}
+
+/* Static method.
+ *
+ * Returns the format of a record. Records written by older versions of
+ * Fort are base64 text, so they never start with a format byte.
+ */
+int RecordCipher::recordFormat(const QByteArray &record)
+{
+    if(record.isEmpty())
+        return RECORD_FORMAT_LEGACY;
+
+    quint8 format = static_cast<quint8>(record.at(0));
+
+    if(format == RECORD_FORMAT_EAX || format == RECORD_FORMAT_SPLIT ||
+       format == RECORD_FORMAT_ROTATABLE || format == RECORD_FORMAT_CODEC)
+        return format;
+
+    return RECORD_FORMAT_LEGACY;
+}
+
+/* Static method.
+ *
+ * Returns true if the record is in the format written by seal().
+ */
+bool RecordCipher::isCurrentFormat(const QByteArray &record)
+{
+    return recordFormat(record) == RECORD_FORMAT_CODEC;
+}
+
+/* Static method.
+ *
+ * Returns the format written by seal().
+ */
+int RecordCipher::currentFormat()
+{
+    return RECORD_FORMAT_CODEC;
+}
+
+/* Static method.
+ *
+ * Returns the format of records that need the
+ * initialization vector of fort.iv.
+ */
+int RecordCipher::legacyFormat()
+{
+    return RECORD_FORMAT_LEGACY;
+}
+
+/* Static method.
+ *
+ * Returns true if the record is in the current format and all of
+ * it is encrypted with the data key of the given generation.
+ */
+bool RecordCipher::isSealedWith(const QByteArray &record, quint32 generation)
+{
+    if(!isCurrentFormat(record) || record.length() < 5)
+        return false;
+
+    qint64 metaLength = qFromLittleEndian<quint32>(reinterpret_cast<const uchar*>(record.constData() + 1));
+
+    if(metaLength < RECORD_GENERATION_SIZE ||
+       metaLength + RECORD_GENERATION_SIZE > record.length() - 5)
+        return false;
+
+    return readGeneration(record.constData() + 5) == generation &&
+           readGeneration(record.constData() + 5 + metaLength) == generation;
+}
+
+/* Static method.
+ *
+ * Returns the data key generation of sealed secrets,
+ * see openMeta()
+ */
+quint32 RecordCipher::blobGeneration(const QByteArray &blob)
+{
+    if(blob.length() < RECORD_GENERATION_SIZE)
+        return 0;
+
+    return readGeneration(blob.constData());
+}
+
+/* Returns the generation of the key records are sealed with.
+ */
+quint32 RecordCipher::currentGeneration()
+{
+    return _keys.currentGeneration();
+}
+
+/* RecordCipher methods set _lastErrorMessage on failure.
+ * This method is used to access that message.
+ */
+QString RecordCipher::getLastErrorMessage()
+{
+    return _lastErrorMessage;
+}
@@ -0,0 +1,98 @@
+/*
+ * This file is part of Fort.
+ *
+ * Fort is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Fort is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Fort.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2015 Niko Rosvall <niko@ideabyte.net>
+ *
+ */
+
+#ifndef RECORDCIPHER_H
+#define RECORDCIPHER_H
+
+#include <QString>
+#include <QByteArray>
+#include <botan/symkey.h>
+#include <botan/auto_rng.h>
+#include "keyring.h"
+
+namespace Botan {
+class Pipe;
+class Keyed_Filter;
+class EAX_Base;
+}
+
+/* Encrypts and decrypts single item records.
+ *
+ * Each record is encrypted with AES-256/EAX under its own random nonce
+ * and authenticated together with the item guid, so a record can be
+ * replaced without touching any other record and tampering is detected
+ * when the record is decrypted.
+ *
+ * Item metadata and secrets (password and notes) are sealed separately,
+ * so the metadata can be decrypted while the secrets stay encrypted
+ * until they are needed.
+ *
+ * Every sealed blob carries the generation of the data key it is
+ * encrypted with, so records stay readable while keys are rotated.
+ *
+ * Cipher filters are created once and reused for every record. An
+ * instance must not be shared between threads.
+ */
+class RecordCipher
+{
+public:
+    RecordCipher(const KeyRing &keys);
+    ~RecordCipher();
+    bool seal(const QString &id, const QByteArray &meta, const QByteArray &secrets,
+              QByteArray &record);
+    bool sealWithSecrets(const QString &id, const QByteArray &meta,
+                         const QByteArray &sealedSecrets, QByteArray &record);
+    bool openMeta(const QString &id, const QByteArray &record, QByteArray &meta,
+                  QByteArray &sealedSecrets);
+    bool openSecrets(const QString &id, const QByteArray &sealedSecrets, QByteArray &secrets);
+    bool open(const QString &id, const QByteArray &record, QByteArray &plain);
+    void setLegacyIV(const Botan::InitializationVector &iv);
+    static int recordFormat(const QByteArray &record);
+    static bool isCurrentFormat(const QByteArray &record);
+    static int currentFormat();
+    static int legacyFormat();
+    static bool isSealedWith(const QByteArray &record, quint32 generation);
+    static quint32 blobGeneration(const QByteArray &blob);
+    quint32 currentGeneration();
+    QString getLastErrorMessage();
+
+private:
+    KeyRing _keys;
+    quint32 _decryptGeneration;
+    Botan::AutoSeeded_RNG _rng;
+    Botan::EAX_Base *_encryptor;
+    Botan::Pipe *_encryptPipe;
+    Botan::EAX_Base *_decryptor;
+    Botan::Pipe *_decryptPipe;
+    Botan::Keyed_Filter *_legacyCipher;
+    Botan::Pipe *_legacyPipe;
+    Botan::InitializationVector _legacyIV;
+    bool _hasLegacyIV;
+    QString _lastErrorMessage;
+    bool openLegacy(const QByteArray &record, QByteArray &plain);
+    bool sealBlob(const QByteArray &header, const QByteArray &plain, QByteArray &blob);
+    bool openBlob(const QByteArray &header, quint32 generation, const char *blob, int length,
+                  QByteArray &plain);
+    void reset();
+
+    Q_DISABLE_COPY(RecordCipher)
+};
+
+#endif // RECORDCIPHER_H
@@ -0,0 +1,514 @@
+/*
+ * This file is part of Fort.
+ *
+ * Fort is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Fort is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Fort.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2015 Niko Rosvall <niko@ideabyte.net>
+ *
+ */
+
+#include "searchengine.h"
+#include "fuzzymatcher.h"
+#include <QPair>
+#include <QVector>
+#include <QSet>
+#include <QMutexLocker>
+#include <QtAlgorithms>
+#include <algorithm>
+#include <iterator>
+
+/* Constructor.
+ */
+SearchEngine::SearchEngine() :
+    _nextDoc(0),
+    _slotsDirty(false),
+    _fuzzy(true),
+    _cancel(0),
+    _generation(0),
+    _searchRevision(0),
+    _sink(0),
+    _delivered(0)
+{
+}
+
+/* Returns collection indexes of the items whose text matches
+ * the query, case insensitively.
+ *
+ * Cached results which the query does not extend are dropped
+ * from the stack. If a result for the same query is left on top,
+ * it is returned as is. Otherwise the top result is filtered, or
+ * the index is used if the stack is empty, and the new result
+ * is pushed.
+ *
+ * Revision of the texts searched is set to revision. If a sink is
+ * given, it receives every match once, in the order of indexes,
+ * some of them possibly before the search is done.
+ * Returns false if the search was cancelled or the texts changed
+ * while searching, see SearchEngine::isCancelled()
+ */
+bool SearchEngine::search(const QString &query, QList<int> &indexes, int &revision,
+                          QAtomicInt *cancel, int generation, SearchSink *sink)
+{
+    QMutexLocker locker(&_lock);
+    QString folded = query.toCaseFolded();
+
+    _cancel = cancel;
+    _generation = generation;
+    _sink = sink;
+    _delivered = 0;
+    _searchRevision = _revision.fetchAndAddRelaxed(0);
+    revision = _searchRevision;
+    indexes.clear();
+
+    while(!_results.isEmpty() && !folded.contains(_results.last().query))
+        _results.removeLast();
+
+    if(!_results.isEmpty())
+    {
+        const Result &previous = _results.last();
+
+        if(previous.query == folded)
+        {
+            indexes = previous.indexes;
+            deliver(indexes, true);
+            return true;
+        }
+
+        if(_fuzzy)
+            indexes = rank(folded, previous.indexes);
+        else
+            indexes = scan(folded, previous.indexes);
+    }
+    else
+    {
+        indexes = lookup(folded);
+    }
+
+    if(isCancelled())
+    {
+        indexes.clear();
+        return false;
+    }
+
+    //Oldest results are the least likely to be needed again
+    if(_results.count() >= _maxResults)
+        _results.removeFirst();
+
+    Result result;
+    result.query = folded;
+    result.indexes = indexes;
+    _results << result;
+
+    deliver(indexes, true);
+
+    return true;
+}
+
+/* Revision of the texts. Changes once the texts change,
+ * so results of an older revision refer to stale indexes.
+ */
+int SearchEngine::revision()
+{
+    return _revision.fetchAndAddRelaxed(0);
+}
+
+/* Insert the text of an item added to the collection at index.
+ */
+void SearchEngine::insertText(int index, const QString &text)
+{
+    beginChange();
+    QMutexLocker locker(&_lock);
+    int doc = _nextDoc++;
+    QString folded = text.toCaseFolded();
+
+    _docs.insert(index, doc);
+    _masks.insert(index, charMask(folded));
+    _texts.insert(doc, folded);
+    addPostings(doc, folded);
+    invalidate();
+}
+
+/* Remove the text of an item removed from the collection.
+ */
+void SearchEngine::removeText(int index)
+{
+    beginChange();
+    QMutexLocker locker(&_lock);
+    int doc = _docs.takeAt(index);
+    _masks.removeAt(index);
+
+    removePostings(doc, _texts.take(doc));
+    invalidate();
+}
+
+/* Replace the text of an item changed in place. Text gets
+ * a new document id, so postings stay sorted.
+ */
+void SearchEngine::replaceText(int index, const QString &text)
+{
+    beginChange();
+    QMutexLocker locker(&_lock);
+    int oldDoc = _docs.at(index);
+    int doc = _nextDoc++;
+    QString folded = text.toCaseFolded();
+
+    removePostings(oldDoc, _texts.take(oldDoc));
+    _docs[index] = doc;
+    _masks[index] = charMask(folded);
+    _texts.insert(doc, folded);
+    addPostings(doc, folded);
+    invalidate();
+}
+
+/* Move a text when an item is moved in the collection.
+ * Postings refer to document ids, so they do not change.
+ */
+void SearchEngine::moveText(int from, int to)
+{
+    beginChange();
+    QMutexLocker locker(&_lock);
+    _docs.move(from, to);
+    _masks.move(from, to);
+    invalidate();
+}
+
+/* Remove all texts, postings and cached results.
+ */
+void SearchEngine::clear()
+{
+    beginChange();
+    QMutexLocker locker(&_lock);
+    _docs.clear();
+    _masks.clear();
+    _texts.clear();
+    _postings.clear();
+    _slots.clear();
+    _nextDoc = 0;
+    invalidate();
+}
+
+/* Use fuzzy, ranked matching or exact substring matching.
+ */
+void SearchEngine::setFuzzy(bool fuzzy)
+{
+    QMutexLocker locker(&_lock);
+
+    if(_fuzzy == fuzzy)
+        return;
+
+    _fuzzy = fuzzy;
+    _results.clear();
+}
+
+/* Returns the collection indexes, out of the given ones,
+ * whose text contains the folded query.
+ */
+QList<int> SearchEngine::scan(const QString &query, const QList<int> &indexes)
+{
+    QList<int> matches;
+
+    for(int i = 0; i < indexes.count(); i++)
+    {
+        if((i & 1023) == 0 && isCancelled())
+            break;
+
+        int index = indexes.at(i);
+
+        if(_texts.value(_docs.at(index)).contains(query))
+        {
+            matches << index;
+            deliver(matches, false);
+        }
+    }
+
+    return matches;
+}
+
+/* Returns the collection indexes, out of the given ones, whose
+ * text matches the folded query as a subsequence. Indexes are
+ * sorted by score, best first, then by index.
+ */
+QList<int> SearchEngine::rank(const QString &query, const QList<int> &indexes)
+{
+    QVector<QPair<int, int> > scored;
+    quint64 mask = charMask(query);
+
+    for(int i = 0; i < indexes.count(); i++)
+    {
+        if((i & 1023) == 0 && isCancelled())
+            return QList<int>();
+
+        int index = indexes.at(i);
+        int score;
+
+        //Text lacks a character of the query
+        if((_masks.at(index) & mask) != mask)
+            continue;
+
+        if(FuzzyMatcher::score(query, _texts.value(_docs.at(index)), score))
+            scored << qMakePair(-score, index);
+    }
+
+    qSort(scored);
+
+    QList<int> matches;
+    matches.reserve(scored.count());
+
+    for(int i = 0; i < scored.count(); i++)
+        matches << scored.at(i).second;
+
+    return matches;
+}
+
+/* Answer a folded query without a previous result.
+ *
+ * In fuzzy mode trigrams of the query need not be in the text.
+ * Texts having every character of the query, by their bitmask,
+ * are ranked, see SearchEngine::rank()
+ *
+ * Postings of the trigrams of the query are intersected, starting
+ * from the shortest list. Candidates are verified against the text,
+ * since having all trigrams does not mean they are adjacent.
+ */
+QList<int> SearchEngine::lookup(const QString &query)
+{
+    if(_fuzzy || query.length() < 3)
+    {
+        quint64 mask = charMask(query);
+        QList<int> candidates;
+
+        for(int i = 0; i < _masks.count(); i++)
+        {
+            if((_masks.at(i) & mask) == mask)
+                candidates << i;
+        }
+
+        if(query.isEmpty())
+            return candidates;
+
+        return _fuzzy ? rank(query, candidates) : scan(query, candidates);
+    }
+
+    QList<const QVector<int> *> lists;
+
+    for(int i = 0; i + 3 <= query.length(); i++)
+    {
+        QHash<quint64, QVector<int> >::const_iterator it = _postings.constFind(trigram(query, i));
+
+        if(it == _postings.constEnd())
+            return QList<int>();
+
+        lists << &it.value();
+    }
+
+    const QVector<int> *shortest = lists.first();
+
+    foreach(const QVector<int> *list, lists)
+    {
+        if(list->count() < shortest->count())
+            shortest = list;
+    }
+
+    QVector<int> candidates = *shortest;
+
+    foreach(const QVector<int> *list, lists)
+    {
+        if(list == shortest)
+            continue;
+
+        QVector<int> common;
+        std::set_intersection(candidates.constBegin(), candidates.constEnd(),
+                              list->constBegin(), list->constEnd(),
+                              std::back_inserter(common));
+        candidates = common;
+
+        if(candidates.isEmpty())
+            return QList<int>();
+    }
+
+    updateSlots();
+
+    //Verified in the order of the collection, so matches can
+    //be handed to the sink as they are found
+    QVector<int> positions;
+    positions.reserve(candidates.count());
+
+    foreach(int doc, candidates)
+        positions << _slots.value(doc);
+
+    qSort(positions);
+
+    QList<int> indexes;
+
+    for(int i = 0; i < positions.count(); i++)
+    {
+        if((i & 1023) == 0 && isCancelled())
+            return QList<int>();
+
+        int index = positions.at(i);
+
+        if(_texts.value(_docs.at(index)).contains(query))
+        {
+            indexes << index;
+            deliver(indexes, false);
+        }
+    }
+
+    return indexes;
+}
+
+/* Add a document to the postings of every trigram of its text.
+ * Document ids grow, so appending keeps the postings sorted.
+ */
+void SearchEngine::addPostings(int doc, const QString &text)
+{
+    QSet<quint64> seen;
+
+    for(int i = 0; i + 3 <= text.length(); i++)
+    {
+        quint64 key = trigram(text, i);
+
+        if(seen.contains(key))
+            continue;
+
+        seen << key;
+        _postings[key].append(doc);
+    }
+}
+
+/* Remove a document from the postings of its text. Empty
+ * posting lists are dropped.
+ */
+void SearchEngine::removePostings(int doc, const QString &text)
+{
+    for(int i = 0; i + 3 <= text.length(); i++)
+    {
+        QHash<quint64, QVector<int> >::iterator it = _postings.find(trigram(text, i));
+
+        if(it == _postings.end())
+            continue;
+
+        QVector<int> &list = it.value();
+        QVector<int>::iterator pos = qBinaryFind(list.begin(), list.end(), doc);
+
+        if(pos != list.end())
+            list.erase(pos);
+
+        if(list.isEmpty())
+            _postings.erase(it);
+    }
+}
+
+/* Rebuild the collection indexes of the documents if the
+ * collection has changed since the last lookup.
+ */
+void SearchEngine::updateSlots()
+{
+    if(!_slotsDirty)
+        return;
+
+    _slots.clear();
+    _slots.reserve(_docs.count());
+
+    for(int i = 0; i < _docs.count(); i++)
+        _slots.insert(_docs.at(i), i);
+
+    _slotsDirty = false;
+}
+
+/* Drop the cached results, collection indexes in them
+ * are no longer valid. Revision is bumped again once the
+ * change is done, results of a search which ran before it
+ * and held the lock are stale too.
+ */
+void SearchEngine::invalidate()
+{
+    _revision.fetchAndAddRelaxed(1);
+    _results.clear();
+    _slotsDirty = true;
+}
+
+/* Returns true if the running search should be abandoned,
+ * because a newer search took the generation or the texts
+ * are about to change.
+ */
+bool SearchEngine::isCancelled()
+{
+    if(_revision.fetchAndAddRelaxed(0) != _searchRevision)
+        return true;
+
+    return _cancel != 0 && _cancel->fetchAndAddRelaxed(0) != _generation;
+}
+
+/* Hand the matches found since the last call to the sink of the
+ * running search. Unless all is set, they are handed over only
+ * once there are enough of them for a chunk.
+ */
+void SearchEngine::deliver(const QList<int> &matches, bool all)
+{
+    int count = matches.count() - _delivered;
+
+    if(_sink == 0 || count <= 0 || (!all && count < _sinkChunk))
+        return;
+
+    _sink->matchesFound(_searchRevision, matches.mid(_delivered));
+    _delivered = matches.count();
+}
+
+/* Announce a change before waiting for the lock, so
+ * a running search releases it early.
+ */
+void SearchEngine::beginChange()
+{
+    _revision.fetchAndAddRelaxed(1);
+}
+
+/* Bitmask of the characters of a folded text. Letters and
+ * digits have a bit each, other characters share the rest, so
+ * a text may have a bit set for a character it lacks but never
+ * the other way around.
+ */
+quint64 SearchEngine::charMask(const QString &text)
+{
+    quint64 mask = 0;
+    const ushort *p = text.utf16();
+    const ushort *end = p + text.length();
+
+    for(; p < end; p++)
+    {
+        ushort c = *p;
+        int bit;
+
+        if(c >= 'a' && c <= 'z')
+            bit = c - 'a';
+        else if(c >= '0' && c <= '9')
+            bit = 26 + c - '0';
+        else
+            bit = 36 + c % 28;
+
+        mask |= Q_UINT64_C(1) << bit;
+    }
+
+    return mask;
+}
+
+/* Pack the three characters of text starting at pos
+ * into a key.
+ */
+quint64 SearchEngine::trigram(const QString &text, int pos)
+{
+    return (quint64(text.at(pos).unicode()) << 32) |
+           (quint64(text.at(pos + 1).unicode()) << 16) |
+           quint64(text.at(pos + 2).unicode());
+}
@@ -0,0 +1,140 @@
+/*
+ * This file is part of Fort.
+ *
+ * Fort is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Fort is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Fort.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2015 Niko Rosvall <niko@ideabyte.net>
+ *
+ */
+
+#ifndef SEARCHENGINE_H
+#define SEARCHENGINE_H
+
+#include <QString>
+#include <QList>
+#include <QVector>
+#include <QHash>
+#include <QMutex>
+#include <QAtomicInt>
+
+/* Receives the matches of a running search as they are found,
+ * see SearchEngine::search()
+ */
+class SearchSink
+{
+public:
+    virtual ~SearchSink() {}
+    virtual void matchesFound(int revision, const QList<int> &indexes) = 0;
+};
+
+/* Incremental search over the items of a collection.
+ *
+ * By default the query is matched as a subsequence and results
+ * are ranked by FuzzyMatcher, best first, ties in the order of
+ * the collection. Each text has a bitmask of the characters in it,
+ * texts missing a character of the query are skipped without
+ * scoring them.
+ *
+ * In exact mode the query is matched as a substring. Searchable
+ * text of each item is kept case folded in a trigram index. Posting
+ * lists hold document ids, which do not change when items are moved
+ * in the collection. Queries of three or more characters intersect
+ * the postings of their trigrams and verify the candidates, shorter
+ * ones scan the texts. Results are in the order of the collection.
+ *
+ * When a query contains the previous query, only the previous
+ * matches are filtered again. Results of the recent queries are
+ * kept on a stack, so erasing characters is served from it.
+ *
+ * Any change to the texts drops the cached results.
+ *
+ * Exact matches are handed to a sink while they are found, in the
+ * order of the collection. Fuzzy matches are handed over once they
+ * are ranked, since ranking needs the score of every match.
+ *
+ * Search may run on another thread than the changes. Changes bump
+ * the revision before taking the lock, so a running search notices
+ * them, gives up and releases the lock. Search is also abandoned
+ * when a cancellation token no longer holds its generation.
+ */
+class SearchEngine
+{
+public:
+    SearchEngine();
+    bool search(const QString &query, QList<int> &indexes, int &revision,
+                QAtomicInt *cancel = 0, int generation = 0, SearchSink *sink = 0);
+    int revision();
+    void insertText(int index, const QString &text);
+    void removeText(int index);
+    void replaceText(int index, const QString &text);
+    void moveText(int from, int to);
+    void clear();
+    void setFuzzy(bool fuzzy);
+
+private:
+    struct Result
+    {
+        QString query;
+        QList<int> indexes;
+    };
+
+    //Document ids in collection order and texts by document id
+    QList<int> _docs;
+
+    //Characters of the texts in collection order, see charMask()
+    QList<quint64> _masks;
+    QHash<int, QString> _texts;
+    int _nextDoc;
+
+    //Trigram to sorted document ids
+    QHash<quint64, QVector<int> > _postings;
+
+    //Collection index by document id, rebuilt after changes
+    QHash<int, int> _slots;
+    bool _slotsDirty;
+
+    bool _fuzzy;
+    QList<Result> _results;
+    static const int _maxResults = 32;
+
+    //Guards everything above
+    QMutex _lock;
+    QAtomicInt _revision;
+
+    //Cancellation of the running search
+    QAtomicInt *_cancel;
+    int _generation;
+    int _searchRevision;
+
+    //Receiver of the matches of the running search
+    SearchSink *_sink;
+    int _delivered;
+    static const int _sinkChunk = 256;
+
+    bool isCancelled();
+    void deliver(const QList<int> &matches, bool all);
+    void beginChange();
+
+    QList<int> scan(const QString &query, const QList<int> &indexes);
+    QList<int> rank(const QString &query, const QList<int> &indexes);
+    QList<int> lookup(const QString &query);
+    void addPostings(int doc, const QString &text);
+    void removePostings(int doc, const QString &text);
+    void updateSlots();
+    void invalidate();
+    static quint64 trigram(const QString &text, int pos);
+    static quint64 charMask(const QString &text);
+};
+
+#endif // SEARCHENGINE_H
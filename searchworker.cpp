@@ -0,0 +1,143 @@
+/*
+ * This file is part of Fort.
+ *
+ * Fort is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Fort is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Fort.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2015 Niko Rosvall <niko@ideabyte.net>
+ *
+ */
+
+#include "searchworker.h"
+#include <QMutexLocker>
+#include <QMetaType>
+
+/* Constructor. Thread is started by the caller.
+ */
+SearchWorker::SearchWorker(ItemCollection *collection, QObject *parent) :
+    QThread(parent),
+    _collection(collection),
+    _pending(false),
+    _stopping(false),
+    _generation(0),
+    _running(0)
+{
+    qRegisterMetaType<QList<int> >("QList<int>");
+}
+
+/* Deconstructor. Thread is stopped before the
+ * worker goes away.
+ */
+SearchWorker::~SearchWorker()
+{
+    stop();
+}
+
+/* Queue a query, replacing any query not yet started and
+ * cancelling the running one. Returns the generation the
+ * results of the query are emitted with.
+ */
+int SearchWorker::search(const QString &query)
+{
+    QMutexLocker locker(&_mutex);
+
+    _query = query;
+    _pending = true;
+    int generation = _generation.fetchAndAddRelaxed(1) + 1;
+    _wake.wakeOne();
+
+    return generation;
+}
+
+/* Abandon the running and the queued query.
+ */
+void SearchWorker::cancel()
+{
+    QMutexLocker locker(&_mutex);
+
+    _pending = false;
+    _generation.fetchAndAddRelaxed(1);
+}
+
+/* Stop the thread and wait for it to finish.
+ */
+void SearchWorker::stop()
+{
+    {
+        QMutexLocker locker(&_mutex);
+        _stopping = true;
+        _generation.fetchAndAddRelaxed(1);
+        _wake.wakeOne();
+    }
+
+    wait();
+}
+
+/* Wait for queries and evaluate them. Results are emitted in
+ * chunks while the search runs, see SearchWorker::matchesFound(),
+ * and an empty last chunk ends them. If the collection changed
+ * while searching, searchStale() is emitted in place of the last
+ * chunk. Nothing is emitted once a newer query arrives.
+ */
+void SearchWorker::run()
+{
+    forever
+    {
+        QString query;
+        int generation;
+
+        {
+            QMutexLocker locker(&_mutex);
+
+            while(!_pending && !_stopping)
+                _wake.wait(&_mutex);
+
+            if(_stopping)
+                return;
+
+            query = _query;
+            generation = _generation.fetchAndAddRelaxed(0);
+            _pending = false;
+        }
+
+        QList<int> indexes;
+        int revision;
+
+        _running = generation;
+
+        bool success = _collection->createSearchView(query, indexes, revision,
+                                                     &_generation, generation, this);
+
+        if(_generation.fetchAndAddRelaxed(0) != generation)
+            continue;
+
+        if(success)
+            emit resultsReady(generation, revision, QList<int>(), true);
+        else
+            emit searchStale(generation);
+    }
+}
+
+/* Emit matches of the running search in chunks, unless
+ * a newer query has arrived.
+ */
+void SearchWorker::matchesFound(int revision, const QList<int> &indexes)
+{
+    for(int offset = 0; offset < indexes.count(); offset += _chunkSize)
+    {
+        if(_generation.fetchAndAddRelaxed(0) != _running)
+            return;
+
+        emit resultsReady(_running, revision, indexes.mid(offset, _chunkSize), false);
+    }
+}
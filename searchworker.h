@@ -0,0 +1,74 @@
+/*
+ * This file is part of Fort.
+ *
+ * Fort is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Fort is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Fort.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2015 Niko Rosvall <niko@ideabyte.net>
+ *
+ */
+
+#ifndef SEARCHWORKER_H
+#define SEARCHWORKER_H
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QAtomicInt>
+#include <QString>
+#include <QList>
+#include "itemcollection.h"
+
+/* Evaluates search queries on a thread of its own, so typing
+ * never waits for the search.
+ *
+ * Each query gets a generation. A newer query or cancel() takes
+ * the generation, which abandons the running search as soon as
+ * it notices. Results are emitted in chunks while they are found,
+ * together with the generation and the revision of the collection
+ * searched, the receiver drops results which are no longer current.
+ * A search abandoned because the collection changed emits
+ * searchStale(), so the receiver can search again.
+ */
+class SearchWorker : public QThread, public SearchSink
+{
+    Q_OBJECT
+
+public:
+    explicit SearchWorker(ItemCollection *collection, QObject *parent = 0);
+    ~SearchWorker();
+    int search(const QString &query);
+    void cancel();
+    void stop();
+
+signals:
+    void resultsReady(int generation, int revision, const QList<int> &indexes, bool last);
+    void searchStale(int generation);
+
+protected:
+    void run();
+    void matchesFound(int revision, const QList<int> &indexes);
+
+private:
+    ItemCollection *_collection;
+    QMutex _mutex;
+    QWaitCondition _wake;
+    QString _query;
+    bool _pending;
+    bool _stopping;
+    QAtomicInt _generation;
+    int _running;
+    static const int _chunkSize = 256;
+};
+
+#endif // SEARCHWORKER_H
@@ -0,0 +1,190 @@
+/*
+ * This file is part of Fort.
+ *
+ * Fort is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Fort is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Fort.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2015 Niko Rosvall <niko@ideabyte.net>
+ *
+ */
+
+#include "secretcache.h"
+#include <QCache>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QDateTime>
+#include <QStringList>
+#include "recordcipher.h"
+#include "item.h"
+#include "itemcodec.h"
+
+/* Decrypted secrets of one item. Zeroed when evicted.
+ */
+struct Secrets
+{
+    QString password;
+    QString notes;
+    QByteArray sealedSecrets;
+    qint64 revealedAt;
+
+    ~Secrets()
+    {
+        Item::wipeString(password);
+        Item::wipeString(notes);
+    }
+};
+
+/* Shared state of the cache.
+ */
+struct SecretCacheState
+{
+    SecretCacheState() : cipher(0), maxAge(30000)
+    {
+        cache.setMaxCost(16);
+    }
+
+    QMutex mutex;
+    RecordCipher *cipher;
+    QCache<QString, Secrets> cache;
+    qint64 maxAge;
+};
+
+static SecretCacheState *state()
+{
+    static SecretCacheState cacheState;
+    return &cacheState;
+}
+
+/* Copy string data to a new buffer, so wiping the cached string
+ * never touches strings handed out to the caller.
+ */
+static QString deepCopy(const QString &str)
+{
+    return QString(str.unicode(), str.size());
+}
+
+/* Static method.
+ *
+ * Set the data keys used to decrypt sealed secrets. Cache is cleared.
+ */
+void SecretCache::setKeys(const KeyRing &keys)
+{
+    SecretCacheState *s = state();
+    QMutexLocker locker(&s->mutex);
+
+    s->cache.clear();
+    delete s->cipher;
+    s->cipher = new RecordCipher(keys);
+}
+
+/* Static method.
+ *
+ * Set the maximum number of entries in the cache and the time in
+ * seconds an entry is kept after the secrets were decrypted.
+ */
+void SecretCache::setLimits(int maxEntries, int maxAgeSeconds)
+{
+    SecretCacheState *s = state();
+    QMutexLocker locker(&s->mutex);
+
+    s->cache.setMaxCost(qMax(1, maxEntries));
+    s->maxAge = qMax(0, maxAgeSeconds) * 1000;
+}
+
+/* Static method.
+ *
+ * Get password and notes of an item. Secrets are returned from the
+ * cache or decrypted and added to the cache.
+ *
+ * Returns false if the secrets can't be decrypted, in that case
+ * password and notes are left empty.
+ */
+bool SecretCache::reveal(const QString &id, const QByteArray &sealedSecrets,
+                         QString &password, QString &notes)
+{
+    SecretCacheState *s = state();
+    QMutexLocker locker(&s->mutex);
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+
+    Secrets *secrets = s->cache.object(id);
+
+    if(secrets != 0 && (secrets->sealedSecrets != sealedSecrets ||
+                        now - secrets->revealedAt > s->maxAge))
+    {
+        s->cache.remove(id);
+        secrets = 0;
+    }
+
+    if(secrets == 0)
+    {
+        QByteArray plain;
+
+        if(s->cipher == 0 || !s->cipher->openSecrets(id, sealedSecrets, plain))
+            return false;
+
+        secrets = new Secrets;
+
+        if(!ItemCodec::decodeSecrets(plain, secrets->password, secrets->notes))
+        {
+            plain.fill(0);
+            delete secrets;
+            return false;
+        }
+
+        secrets->sealedSecrets = sealedSecrets;
+        secrets->revealedAt = now;
+
+        plain.fill(0);
+
+        s->cache.insert(id, secrets, 1);
+    }
+
+    password = deepCopy(secrets->password);
+    notes = deepCopy(secrets->notes);
+
+    return true;
+}
+
+/* Static method.
+ *
+ * Remove entries older than the maximum age. Called periodically
+ * so secrets do not stay in memory while Fort is idle.
+ */
+void SecretCache::expire()
+{
+    SecretCacheState *s = state();
+    QMutexLocker locker(&s->mutex);
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+
+    foreach(QString id, s->cache.keys())
+    {
+        Secrets *secrets = s->cache.object(id);
+
+        if(secrets != 0 && now - secrets->revealedAt > s->maxAge)
+            s->cache.remove(id);
+    }
+}
+
+/* Static method.
+ *
+ * Remove all entries and forget the key. Called on lock.
+ */
+void SecretCache::clear()
+{
+    SecretCacheState *s = state();
+    QMutexLocker locker(&s->mutex);
+
+    s->cache.clear();
+    delete s->cipher;
+    s->cipher = 0;
+}
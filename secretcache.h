@@ -0,0 +1,51 @@
+/*
+ * This file is part of Fort.
+ *
+ * Fort is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Fort is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Fort.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2015 Niko Rosvall <niko@ideabyte.net>
+ *
+ */
+
+#ifndef SECRETCACHE_H
+#define SECRETCACHE_H
+
+#include <QString>
+#include <QByteArray>
+#include "keyring.h"
+
+/* Decrypts sealed item secrets (password and notes) on demand.
+ *
+ * Recently used secrets are kept in a small least recently used cache.
+ * The cache is bounded both by the number of entries and by their age,
+ * so plain secrets in memory scale with what is actually used instead
+ * of the size of the vault. Evicted entries are zeroed.
+ *
+ * All methods are static and thread safe.
+ */
+class SecretCache
+{
+public:
+    static void setKeys(const KeyRing &keys);
+    static void setLimits(int maxEntries, int maxAgeSeconds);
+    static bool reveal(const QString &id, const QByteArray &sealedSecrets,
+                       QString &password, QString &notes);
+    static void expire();
+    static void clear();
+
+private:
+    SecretCache() {}
+};
+
+#endif // SECRETCACHE_H
@@ -23,181 +23,712 @@
 #include <botan/sha2_32.h>
 #include <botan/pipe.h>
 #include <botan/botan.h>
-#include <botan/base64.h>
 #include <botan/bcrypt.h>
+#include <botan/hex.h>
+#include <botan/hmac.h>
+#include <botan/pbkdf2.h>
+#include <botan/rfc3394.h>
+#include <botan/libstate.h>
 #include <QFile>
 #include <QTextStream>
 #include <QDir>
+#include <QFileInfo>
+#include <QRunnable>
+#include <QThread>
+#include <QDateTime>
+#include <QMutexLocker>
+#include <stdio.h>
+#include <unistd.h>
 #include "environment.h"
-#include <iostream>
+#include "vaultstorage.h"
+#include "recordcipher.h"
+#include "secretcache.h"
+#include "keyrotator.h"
+#include "vaultprefetcher.h"
+#include "itemcodec.h"
 
 using namespace Botan;
 
-Security::Security()
+/* Data keys are wrapped with AES key wrap (RFC 3394) using a key
+ * derived from the passphrase hash with PBKDF2-HMAC-SHA256. Version 1
+ * wraps a single key, version 2 a serialized KeyRing.
+ */
+#define DATA_KEY_VERSION_SINGLE "1"
+#define DATA_KEY_VERSION "2"
+#define DATA_KEY_SIZE 32
+#define DATA_KEY_SALT_SIZE 16
+#define DATA_KEY_ITERATIONS 100000
+
+/* Derive the key that wraps the data keys from a passphrase hash.
+ */
+static SymmetricKey deriveWrappingKey(const QString &hash, const MemoryRegion<byte> &salt,
+                                      size_t iterations)
+{
+    PKCS5_PBKDF2 pbkdf2(new HMAC(new SHA_256));
+
+    return pbkdf2.derive_key(DATA_KEY_SIZE, hash.toStdString(), salt.begin(),
+                             salt.size(), iterations);
+}
+
+/* Move a file or a directory tree from one path to another.
+ * When renaming fails, e.g. across filesystems, the entry is
+ * copied and the original removed afterwards.
+ */
+static bool moveEntry(const QString &from, const QString &to)
+{
+    QFileInfo info(from);
+
+    if(info.isDir())
+    {
+        if(QDir().rename(from, to))
+            return true;
+
+        if(!QDir().mkpath(to))
+            return false;
+
+        QFileInfoList entries = QDir(from).entryInfoList(QDir::Files | QDir::Dirs |
+                                                         QDir::NoDotAndDotDot);
+
+        foreach(QFileInfo entry, entries)
+        {
+            if(!moveEntry(entry.absoluteFilePath(), to + "/" + entry.fileName()))
+                return false;
+        }
+
+        return QDir().rmdir(from);
+    }
+
+    if(QFile::rename(from, to))
+        return true;
+
+    if(!QFile::copy(from, to))
+        return false;
+
+    if(!QFile::remove(from))
+    {
+        QFile::remove(to);
+        return false;
+    }
+
+    return true;
+}
+
+/* Base class for workers processing a slice of items on the thread pool.
+ *
+ * Each worker has its own RecordCipher, so cipher filters are created
+ * once per slice instead of once per item. Failures are collected per
+ * item into errors.
+ */
+class CryptoTask : public QRunnable
+{
+public:
+    CryptoTask(const KeyRing &keys) : cipher(keys)
+    {
+        setAutoDelete(false);
+    }
+
+    virtual ~CryptoTask() {}
+
+    RecordCipher cipher;
+    QList<ItemError> errors;
+
+protected:
+    void addError(const QString &id, const QString &message);
+};
+
+void CryptoTask::addError(const QString &id, const QString &message)
+{
+    ItemError error;
+    error.itemId = id;
+    error.message = message;
+    errors << error;
+}
+
+/* Decrypts a slice of encrypted records into memory.
+ * Nothing is written to the filesystem.
+ */
+class DecryptTask : public CryptoTask
+{
+public:
+    DecryptTask(const KeyRing &keys, VaultStorage *storage, QAtomicInt *progress)
+        : CryptoTask(keys), _storage(storage), _progress(progress) {}
+
+    void run();
+
+    QStringList ids;
+    QList<Item> items;
+    QSet<QString> staleIds;
+
+private:
+    VaultStorage *_storage;
+    QAtomicInt *_progress;
+};
+
+void DecryptTask::run()
+{
+    foreach(QString id, ids)
+    {
+        QByteArray record = _storage->readRecord(id);
+        QByteArray plainData;
+        QByteArray sealedSecrets;
+
+        if(record.isEmpty())
+            addError(id, "Unable to read the item.");
+        else if(!cipher.openMeta(id, record, plainData, sealedSecrets))
+            addError(id, cipher.getLastErrorMessage());
+        else
+        {
+            bool decoded;
+
+            //Password and notes stay encrypted until they are needed
+            if(sealedSecrets.isEmpty())
+                items << ItemCodec::decodeItem(plainData, &decoded);
+            else
+            {
+                items << ItemCodec::decodeMeta(plainData, &decoded);
+                items.last().setSealedSecrets(sealedSecrets);
+            }
+
+            if(!decoded)
+            {
+                items.removeLast();
+                addError(id, "Unable to decode the item. Corrupted data or written by a newer version of Fort?");
+                plainData.fill(0);
+                _progress->fetchAndAddRelaxed(1);
+                continue;
+            }
+
+            //Records encrypted with the shared initialization vector are
+            //rewritten on the next lock, the vector is removed after that.
+            //Other older formats are upgraded in the background, see VaultMigrator
+            if(RecordCipher::recordFormat(record) == RecordCipher::legacyFormat())
+                staleIds << items.last().getID();
+        }
+
+        plainData.fill(0);
+        _progress->fetchAndAddRelaxed(1);
+    }
+}
+
+/* Encrypts a slice of items from memory into records.
+ */
+class EncryptTask : public CryptoTask
+{
+public:
+    EncryptTask(const KeyRing &keys) : CryptoTask(keys) {}
+
+    void run();
+
+    QList<Item> items;
+    QHash<QString, QByteArray> records;
+};
+
+void EncryptTask::run()
+{
+    for(int i = 0; i < items.count(); i++)
+    {
+        Item item = items.at(i);
+        QByteArray meta = ItemCodec::encodeMeta(item);
+        QByteArray record;
+        bool sealed;
+
+        //Secrets that were never decrypted are stored as they are,
+        //unless they are sealed with a key that is being rotated out
+        if(item.hasSealedSecrets() &&
+           RecordCipher::blobGeneration(item.getSealedSecrets()) == cipher.currentGeneration())
+            sealed = cipher.sealWithSecrets(item.getID(), meta, item.getSealedSecrets(), record);
+        else
+        {
+            QByteArray secrets;
+
+            //Secrets that can't be revealed are never replaced with empty ones
+            if(!ItemCodec::encodeSecrets(item, secrets))
+            {
+                addError(item.getID(), "Unable to decrypt the password and notes of the item.");
+                continue;
+            }
+
+            sealed = cipher.seal(item.getID(), meta, secrets, record);
+            secrets.fill(0);
+        }
+
+        if(sealed)
+            records.insert(item.getID(), record);
+        else
+            addError(item.getID(), cipher.getLastErrorMessage());
+    }
+}
+
+Security::Security() : _needsConversion(false), _prefetcher(0), _rotator(0), _migrator(0),
+    _writer(&_storageMutex), _rotationBatchSize(500), _rotationBatchDelay(100)
+{
+    _pool.setMaxThreadCount(QThread::idealThreadCount());
+    _writer.start();
+}
+
+/* Deconstructor. Stops a running key rotation and migration,
+ * waits for a running prefetch and for the queued writes.
+ */
+Security::~Security()
+{
+    stopKeyRotation();
+    stopMigration();
+    _writer.flush();
+    _writer.stop();
+
+    if(_prefetcher != 0)
+    {
+        _prefetcher->wait();
+        delete _prefetcher;
+    }
+}
+
+/* Set how many worker threads encryptAll and decryptAll
+ * may use. Values smaller than one mean a single thread.
+ */
+void Security::setThreadCount(int count)
 {
+    _pool.setMaxThreadCount(qMax(1, count));
+}
 
+/* Return the maximum number of worker threads used for
+ * encryption and decryption.
+ */
+int Security::threadCount()
+{
+    return _pool.maxThreadCount();
 }
 
-/* Encrypt each item file using AES with 128 bit initialization vector and 256 bit key.
+/* Start the tasks on the thread pool and block until all of them
+ * are done. Per item failures of the tasks are collected to _itemErrors.
  *
- * Encrypted data is encoded with base64.
+ * Returns true if every item was processed successfully.
+ */
+bool Security::runTasks(const QList<CryptoTask*> &tasks)
+{
+    foreach(CryptoTask *task, tasks)
+        _pool.start(task);
+
+    _pool.waitForDone();
+
+    foreach(CryptoTask *task, tasks)
+        _itemErrors << task->errors;
+
+    return _itemErrors.isEmpty();
+}
+
+/* Number of slices the work of count items is split into.
+ */
+int Security::sliceCount(int count)
+{
+    return qMax(1, qMin(_pool.maxThreadCount(), count));
+}
+
+/* Encrypt the items of the collection that were added or changed since
+ * unlock using AES-256/EAX. Every item is encrypted with its own random
+ * nonce and stored as a binary record, see RecordCipher. Items are
+ * encrypted from memory, plain data is never written to the filesystem.
+ * If the collection has no changes, nothing is encrypted or written.
+ *
+ * Records are stored with VaultStorage, either one file per item or
+ * packed to a single vault file. Records of the items removed from the
+ * collection are deleted, as are plain files and the shared initialization
+ * vector left behind by older versions of Fort. Items are processed in
+ * parallel on the thread pool, see Security::setThreadCount()
  *
- * Initialization vector is preserved to a file for decryption.
  * Function returns true on success and false on failure.
  * On failure _lastErrorMessage is set. It can be accessed via
- * Security::getLastErrorMessage()
+ * Security::getLastErrorMessage(). Failed items are listed by
+ * Security::getItemErrors()
  */
-bool Security::encryptAll()
+bool Security::encryptAll(ItemCollection &collection)
 {
-    AutoSeeded_RNG rng;
-    InitializationVector iv(rng,16); //128bits
-    SymmetricKey key = this->getSymmetricKeyFromHash(this->_currentPassphraseHash);
+    if(!queueChanges(collection) || !flushWrites())
+        return false;
 
+    //Plain files and the shared initialization vector are written by
+    //older versions of Fort. Their items were marked dirty on unlock and
+    //are now stored in the new format, so they can be removed.
     QString path = Environment::ensurePath();
     QDir dir(path);
     QStringList filters;
     filters << "*.plain";
 
-    QFileInfoList entries = dir.entryInfoList(filters,QDir::Files | QDir::NoDotAndDotDot);
+    foreach(QFileInfo entryInfo, dir.entryInfoList(filters, QDir::Files | QDir::NoDotAndDotDot))
+        QFile::remove(entryInfo.absoluteFilePath());
 
-    try
+    if(Environment::hasIV())
+        QFile::remove(path + FORT_IV_FILE);
+
+    return true;
+}
+
+/* Encrypt the items changed since the last call and queue
+ * them, and the guids of the removed items, to be written on
+ * the write behind thread. Returns without waiting for the
+ * writes, see Security::flushWrites()
+ *
+ * Items are encrypted in parallel on the thread pool. Collection
+ * is clean after the call. Function returns true on success and
+ * false on failure, the collection is then left dirty.
+ */
+bool Security::queueChanges(ItemCollection &collection)
+{
+    _itemErrors.clear();
+
+    if(!collection.isDirty())
+        return true;
+
+    if(!loadDataKeys())
+        return false;
+
+    QSet<QString> dirtyIds = collection.dirtyIds();
+    int slices = sliceCount(dirtyIds.count());
+    int next = 0;
+    QList<CryptoTask*> tasks;
+    QHash<QString, QByteArray> records;
+
+    for(int i = 0; i < slices; i++)
+        tasks << new EncryptTask(_keyRing);
+
+    //Only dirty items are materialized from the collection
+    foreach(QString id, dirtyIds)
     {
-        foreach(QFileInfo entryInfo,entries)
-        {
-            QString filePath = entryInfo.absoluteFilePath();
-            QFile file(filePath);
+        Item item = collection.getItemByGuid(id);
 
-            if(file.open(QIODevice::ReadOnly | QIODevice::Text))
-            {
-                //Read all data from the file and encrypt it
-                QTextStream in(&file);
-                QString plainData = in.readAll();
-
-                file.close();
-
-                Pipe pipe(get_cipher("AES-256/CBC/PKCS7",key,iv,ENCRYPTION), new Base64_Encoder);
-                pipe.process_msg(plainData.toStdString().c_str());
-                QString encryptedData = QString::fromStdString(pipe.read_all_as_string(0));
-
-                //Remove the file containing plain data and create a new one with the encrypted data.
-                QFile::remove(filePath);
-                filePath = filePath + ".enc";
-                QFile fileOut(filePath);
-
-                if(fileOut.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text))
-                {
-                    QTextStream out(&fileOut);
-                    out << encryptedData;
-                    fileOut.close();
-                }
-            }
-        }
+        if(!item.isEmpty())
+            static_cast<EncryptTask*>(tasks[next++ % slices])->items << item;
+    }
 
-        //Write initialization vector to a file
-        //If an old one exists, it will be overwritten
-        QString ivPath = path + FORT_IV_FILE;
-        QFile ivFile(ivPath);
+    bool success = runTasks(tasks);
 
-        if(ivFile.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text))
-        {
-            QTextStream out(&ivFile);
-            out << QString::fromStdString(iv.as_string());
-            ivFile.close();
-        }
+    foreach(CryptoTask *task, tasks)
+        records.unite(static_cast<EncryptTask*>(task)->records);
+
+    qDeleteAll(tasks);
+
+    if(!success)
+    {
+        _lastErrorMessage = QString("Something went wrong. Failed to encrypt %1 item(s). "
+                                    "Corrupted data or permission error.").arg(_itemErrors.count());
+        return false;
     }
-    catch(...)
+
+    _writer.enqueue(records, collection.removedIds());
+    collection.clearDirtyState();
+
+    return true;
+}
+
+/* Wait until the queued changes are written. Returns false
+ * if writing failed, _lastErrorMessage is then set.
+ */
+bool Security::flushWrites()
+{
+    if(_writer.flush())
+        return true;
+
+    _lastErrorMessage = _writer.getLastErrorMessage();
+    return false;
+}
+
+/* Move the data files to dataPath and store it as the "datapath"
+ * property. Queued writes are flushed and key rotation and
+ * migration are stopped first. The storage mutex is held for the
+ * whole move, so the write behind thread can't write records to
+ * either path until the move is done. If a file can't be moved
+ * the files moved so far are moved back and the old datapath is
+ * restored. Returns false on failure, _lastErrorMessage is then set.
+ */
+bool Security::moveDataPath(SettingsParser *parser, const QString &dataPath)
+{
+    if(!flushWrites())
+        return false;
+
+    stopKeyRotation();
+    stopMigration();
+
+    QMutexLocker locker(&_storageMutex);
+
+    //ensurePath gives us the old path, either the default path
+    //or a value from the configuration file.
+    QString oldPath = Environment::ensurePath();
+    QString oldSetting = parser->getString("datapath");
+
+    if(!parser->setString("datapath", dataPath))
     {
-        _lastErrorMessage = "Something went wrong. Corrupted data or permission error.";
+        _lastErrorMessage = "Error writing configuration property.";
         return false;
     }
 
+    QString newPath = Environment::ensurePath();
+
+    if(QDir(oldPath).canonicalPath() == QDir(newPath).canonicalPath())
+        return true;
+
+    //Move all files from the old dir to the new path (except fortrc)
+    QStringList filters;
+
+    filters << "*.plain";
+    filters << "*.enc";
+    filters << "*.iv";
+    filters << "*.vault";
+    filters << "*.journal";
+    filters << "*.pph";
+    filters << "*.dek";
+    filters << "*.rotation";
+    filters << "*.format";
+
+    QStringList names;
+
+    foreach(QFileInfo entryInfo, QDir(oldPath).entryInfoList(filters,
+                                                          QDir::Files | QDir::NoDotAndDotDot))
+        names << entryInfo.fileName();
+
+    //Sharded item files are moved with their directory tree
+    if(QDir(oldPath + FORT_SHARD_DIR).exists())
+        names << FORT_SHARD_DIR;
+
+    QStringList moved;
+
+    foreach(QString name, names)
+    {
+        //A directory may be moved partially, so it is always moved back
+        if(QFileInfo(oldPath + name).isDir())
+            moved << name;
+
+        if(!moveEntry(oldPath + name, newPath + name))
+        {
+            _lastErrorMessage = "Unable to move " + name + " to the new data location.";
+
+            foreach(QString movedName, moved)
+                moveEntry(newPath + movedName, oldPath + movedName);
+
+            parser->setString("datapath", oldSetting);
+            return false;
+        }
+
+        if(!moved.contains(name))
+            moved << name;
+    }
+
     return true;
 }
 
-/* Decrypt each encrypted (*.enc) item file.
- * Uses preserved initialization vector from a file.
- *
- * After successful decryption preserved IV is removed. On failure
- * an exception is thrown and function returns false.
+/* Get the state of the write behind queue.
  */
-bool Security::decryptAll()
+WriteBehindStatus Security::writeBehindStatus()
 {
+    return _writer.status();
+}
 
+/* Decrypt each encrypted item record into memory. Records are read with
+ * VaultStorage, so both the item file and the packed vault layouts are
+ * supported. Decrypted items are not written to the filesystem, they are
+ * loaded to a collection with Security::loadUnlockedItems()
+ *
+ * Records written by older versions of Fort are decrypted with the
+ * initialization vector preserved in fort.iv, and plain files left behind
+ * by them are read as well. These items are marked dirty so they get stored
+ * in the current format on the next lock. Records are processed in parallel on the thread pool, see
+ * Security::setThreadCount()
+ *
+ * If any of the items fails to decrypt function returns false and
+ * failed items are listed by Security::getItemErrors()
+ *
+ * Unless createKeys is true, fort.dek is never created or replaced, see
+ * Security::loadDataKeys(). Used while the passphrase is not yet verified.
+ */
+bool Security::decryptAll(bool createKeys)
+{
     QString path = Environment::ensurePath();
-    QString ivPath = path + FORT_IV_FILE;
-    QFile ivFile(ivPath);
+    QFile ivFile(path + FORT_IV_FILE);
+    QDir dir(path);
+    QStringList filters;
+    VaultStorage localStorage;
+    VaultStorage *storage = &localStorage;
+    QString legacyIV;
+    bool hasLegacyIV = false;
 
-    try
+    _itemErrors.clear();
+    _unlockedItems.clear();
+    _staleIds.clear();
+
+    filters << "*.plain";
+
+    foreach(QFileInfo entryInfo, dir.entryInfoList(filters, QDir::Files | QDir::NoDotAndDotDot))
     {
-        if(ivFile.open(QIODevice::ReadOnly | QIODevice::Text))
+        QFile file(entryInfo.absoluteFilePath());
+
+        if(file.open(QIODevice::ReadOnly | QIODevice::Text))
         {
-              QTextStream in(&ivFile);
-              QString plainIV = in.readAll();
-              OctetString iv(plainIV.toStdString());
+            bool decoded;
+            Item item = ItemCodec::decodeItem(file.readAll(), &decoded);
 
-              ivFile.close();
+            file.close();
 
-              QDir dir(path);
-              QStringList filters;
-              filters << "*.enc";
-              QFileInfoList entries = dir.entryInfoList(filters,QDir::Files | QDir::NoDotAndDotDot);
+            if(!decoded)
+            {
+                ItemError error;
+                error.itemId = entryInfo.completeBaseName();
+                error.message = "Unable to decode the item. Corrupted data or written by a newer version of Fort?";
+                _itemErrors << error;
+                continue;
+            }
 
-              SymmetricKey key = this->getSymmetricKeyFromHash(this->_currentPassphraseHash);
+            _unlockedItems << item;
+            _staleIds << item.getID();
+        }
+    }
 
-              //Loop through encrypted files and decrypt them
-              foreach(QFileInfo entryInfo,entries)
-              {
-                  QString filePath = entryInfo.absoluteFilePath();
-                  QFile file(filePath);
+    //Records read while the login dialog was shown
+    if(_prefetcher != 0)
+        _prefetcher->wait();
 
-                  if(file.open(QIODevice::ReadOnly | QIODevice::Text))
-                  {
-                      QTextStream in(&file);
-                      QString encryptedData;
+    if(_prefetcher != 0 && _prefetcher->isReady())
+    {
+        storage = _prefetcher->storage();
+        legacyIV = _prefetcher->legacyIV();
+        hasLegacyIV = _prefetcher->hasLegacyIV();
+    }
+    else
+    {
+        if(!localStorage.open())
+        {
+            _lastErrorMessage = localStorage.getLastErrorMessage();
+            return false;
+        }
 
-                      in >> encryptedData;
+        if(ivFile.open(QIODevice::ReadOnly | QIODevice::Text))
+        {
+            QTextStream in(&ivFile);
+            legacyIV = in.readAll();
+            hasLegacyIV = true;
+            ivFile.close();
+        }
+    }
 
-                      file.close();
+    QStringList ids = storage->recordIds();
+    QList<CryptoTask*> tasks;
+    bool success = false;
 
-                      Pipe base64dec(new Base64_Decoder);
-                      base64dec.process_msg(encryptedData.toStdString());
+    //Converted in the background once the login is accepted
+    _needsConversion = storage->needsConversion();
 
-                      Pipe pipe(get_cipher("AES-256/CBC/PKCS7",key,iv,DECRYPTION));
-                      pipe.process_msg(base64dec.read_all_as_string(0));
+    _decryptedRecords.fetchAndStoreRelaxed(0);
+    _recordsToDecrypt.fetchAndStoreRelaxed(ids.count());
 
-                      QString plainData = QString::fromStdString(pipe.read_all_as_string());
+    if(!loadDataKeys(createKeys))
+        return false;
 
-                      QFile::remove(filePath);
-                      filePath = path + entryInfo.completeBaseName(); //Remove ".enc" extension from the file name
-                      QFile fileOut(filePath);
+    try
+    {
+        int slices = sliceCount(ids.count());
 
-                      if(fileOut.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text))
-                      {
-                          QTextStream out(&fileOut);
-                          out << plainData;
-                          fileOut.close();
-                      }
-                  }
-              }
-        }
-        else
+        for(int i = 0; i < slices; i++)
+            tasks << new DecryptTask(_keyRing, storage, &_decryptedRecords);
+
+        if(hasLegacyIV)
         {
-            std::cout << "Missing initialization vector. Can't decrypt." << std::endl;
+            OctetString iv(legacyIV.toStdString());
+
+            foreach(CryptoTask *task, tasks)
+                task->cipher.setLegacyIV(iv);
         }
+
+        for(int i = 0; i < ids.count(); i++)
+            static_cast<DecryptTask*>(tasks[i % slices])->ids << ids.at(i);
+
+        success = runTasks(tasks);
     }
     catch(...)
     {
-        _lastErrorMessage = "Something went wrong. Invalid passphrase or corrupted data.";
+        success = false;
+    }
+
+    foreach(CryptoTask *task, tasks)
+    {
+        _unlockedItems << static_cast<DecryptTask*>(task)->items;
+        _staleIds.unite(static_cast<DecryptTask*>(task)->staleIds);
+    }
+
+    qDeleteAll(tasks);
+
+    if(!success)
+    {
+        discardUnlockedItems();
+
+        if(_itemErrors.isEmpty())
+            _lastErrorMessage = "Something went wrong. Invalid passphrase or corrupted data.";
+        else
+            _lastErrorMessage = QString("Something went wrong. Failed to decrypt %1 item(s). "
+                                        "Invalid passphrase or corrupted data.").arg(_itemErrors.count());
         return false;
     }
 
-    //Remove the preserved initialization vector.
-    if(Environment::hasIV())
-        QFile::remove(ivPath);
+    SecretCache::setKeys(_keyRing);
+
+    //Prefetched records are not needed anymore
+    delete _prefetcher;
+    _prefetcher = 0;
 
     return true;
 }
 
+/* Start reading the encrypted records into memory on a background
+ * thread, see VaultPrefetcher. decryptAll() uses the records once
+ * they are read. Called when the login dialog is shown.
+ */
+void Security::startPrefetch()
+{
+    if(_prefetcher != 0)
+        return;
+
+    _prefetcher = new VaultPrefetcher;
+    _prefetcher->start(QThread::LowPriority);
+}
+
+/* Get the number of records decrypted so far and the number of
+ * records to decrypt. Safe to call while decryptAll() is running
+ * on another thread.
+ */
+void Security::decryptProgress(int &done, int &total)
+{
+    done = _decryptedRecords.fetchAndAddRelaxed(0);
+    total = _recordsToDecrypt.fetchAndAddRelaxed(0);
+}
+
+/* Wipe the items decrypted by Security::decryptAll() without
+ * loading them. Used when the login is not accepted after all.
+ */
+void Security::discardUnlockedItems()
+{
+    for(int i = 0; i < _unlockedItems.count(); i++)
+        _unlockedItems[i].wipe();
+
+    _unlockedItems.clear();
+    _staleIds.clear();
+}
+
+/* Load the items decrypted by Security::decryptAll() to a collection.
+ * Items that need to be stored in the current format are marked dirty
+ * and records found outside the wanted layout are moved to it in the
+ * background. Security does not keep a copy of them after the call.
+ */
+void Security::loadUnlockedItems(ItemCollection &collection)
+{
+    collection.loadItems(_unlockedItems);
+    collection.markDirty(_staleIds);
+
+    if(_needsConversion)
+        _writer.compactLater();
+
+    _needsConversion = false;
+
+    _unlockedItems.clear();
+    _staleIds.clear();
+}
+
 /* Set passphrase hash to use in encryption / decryption.
  * Hash algorithm is SHA256.
  */
@@ -213,7 +744,11 @@ void Security::setMasterPassphraseHash(QString hash)
 void Security::clearMasterPassphraseHashFromMemory()
 {
     //Fix this, not safe.
+    stopKeyRotation();
+    stopMigration();
     _currentPassphraseHash = "";
+    _keyRing.clear();
+    SecretCache::clear();
 }
 
 /* Static method.
@@ -236,6 +771,9 @@ QString Security::createHashFromString(QString str)
 
 /* Get symmetric key from the hash.
  * Returned key is 256bits.
+ *
+ * Older versions of Fort encrypted items directly with this key.
+ * It is only used as the data key of such vaults, see loadDataKeys()
  */
 SymmetricKey Security::getSymmetricKeyFromHash(QString hash)
 {
@@ -252,6 +790,14 @@ QString Security::getLastErrorMessage()
     return _lastErrorMessage;
 }
 
+/* Return the per item failures of the last encryptAll
+ * or decryptAll call.
+ */
+QList<ItemError> Security::getItemErrors()
+{
+    return _itemErrors;
+}
+
 /* Compare two QString instances. Returns true if they are equal.
  */
 bool Security::comparePassphraseHash(QString hash)
@@ -296,10 +842,25 @@ bool Security::preservePassphraseBcrypt(QString plain)
  * the preserved bcrypted one in order to check if the passphrase
  * is valid.
  *
- * Method is called from the login dialog as well as in the change
- * master password dialog.
+ * Method is called from the change master password dialog.
  */
 bool Security::validateLogin(QString plain)
+{
+    _lastErrorMessage = checkPassphrase(plain);
+
+    return _lastErrorMessage.isEmpty();
+}
+
+/* Static method.
+ *
+ * Compare a passphrase with the preserved bcrypted one. Does not touch
+ * any state, so the login dialog runs it on a worker thread while the
+ * items are decrypted.
+ *
+ * Returns an empty string if the passphrase is valid,
+ * otherwise the error message.
+ */
+QString Security::checkPassphrase(QString plain)
 {
     QString path = Environment::ensurePath();
 
@@ -314,23 +875,493 @@ bool Security::validateLogin(QString plain)
         file.close();
 
         if(hash.length() != 60)
-        {
-            _lastErrorMessage = "Invalid hash length.";
-            return false;
-        }
+            return "Invalid hash length.";
 
         bool valid = check_bcrypt(plain.toStdString(), hash.toStdString());
 
         if(!valid)
+            return "Invalid passphrase or corrupted data.";
+
+        return QString();
+    }
+
+    return "Unable to validate passphrase.";
+}
+
+/* Change the master passphrase. Items are encrypted with random data
+ * keys that are only wrapped with the passphrase, so changing it rewraps
+ * the keys in fort.dek and no item is encrypted again.
+ *
+ * The keys are first stored wrapped with both passphrases. Whichever
+ * passphrase the bcrypt file accepts still unlocks the keys if Fort
+ * is interrupted during the change.
+ *
+ * Function returns true on success and false on failure.
+ * On failure _lastErrorMessage is set.
+ */
+bool Security::changeMasterPassphrase(QString plain)
+{
+    QString hash = createHashFromString(plain);
+    QStringList hashes;
+
+    if(!loadDataKeys())
+        return false;
+
+    hashes << hash << _currentPassphraseHash;
+
+    if(!writeDataKeys(_keyRing, hashes) || !preservePassphraseBcrypt(plain))
+        return false;
+
+    _currentPassphraseHash = hash;
+
+    return writeDataKeys(_keyRing, QStringList(hash));
+}
+
+/* Static method.
+ *
+ * Returns true if the data keys are stored in fort.dek. Only then
+ * decryptAll() has no side effects on the filesystem and can run
+ * before the passphrase has been validated.
+ */
+bool Security::hasDataKeys()
+{
+    return QFile::exists(Environment::ensurePath() + FORT_DATA_KEY_FILE);
+}
+
+/* Static method.
+ *
+ * Checks if there are encrypted items stored in the data path.
+ *
+ * If the stored records can't be read at all, true is returned
+ * so decryption gets attempted and the error reported.
+ */
+bool Security::hasStoredData()
+{
+    VaultStorage storage;
+
+    if(!storage.open())
+        return true;
+
+    return storage.hasRecords() || Environment::hasIV();
+}
+
+/* Set how many records key rotation encrypts in one batch and
+ * how many milliseconds it sleeps between the batches.
+ */
+void Security::setKeyRotationThrottle(int batchSize, int batchDelay)
+{
+    _rotationBatchSize = batchSize;
+    _rotationBatchDelay = batchDelay;
+}
+
+/* Returns true if an interrupted key rotation should be continued or
+ * the current data key is older than maxAgeDays. Zero maxAgeDays
+ * disables scheduled rotation.
+ */
+bool Security::isKeyRotationDue(int maxAgeDays)
+{
+    quint32 generation;
+    QString lastId;
+
+    if(!loadDataKeys())
+        return false;
+
+    if(KeyRotator::readProgress(generation, lastId) &&
+       generation == _keyRing.currentGeneration() && _keyRing.keyCount() > 1)
+        return true;
+
+    if(maxAgeDays <= 0)
+        return false;
+
+    QDateTime created = QDateTime::fromTime_t(_keyRing.currentKeyCreated());
+
+    return created.daysTo(QDateTime::currentDateTime()) >= maxAgeDays;
+}
+
+/* Start encrypting all stored items with a new data key on a
+ * background thread, see KeyRotator. An interrupted rotation is
+ * continued instead. Records stay readable during the rotation,
+ * as the previous keys are kept until every record is rotated.
+ *
+ * Function returns true on success and false on failure.
+ * On failure _lastErrorMessage is set.
+ */
+bool Security::startKeyRotation()
+{
+    quint32 generation;
+    QString lastId;
+
+    if(_rotator != 0 && _rotator->isRunning())
+        return true;
+
+    if(!loadDataKeys())
+        return false;
+
+    //Rotation upgrades the records it encrypts again, a migration
+    //running with the previous key must not write after it
+    stopMigration();
+
+    //Queued records are encrypted with the current key, they must be
+    //stored before the rotation decides which records to encrypt again
+    if(!flushWrites())
+        return false;
+
+    //The shared initialization vector is removed once the
+    //items of older versions of Fort are converted on lock
+    if(Environment::hasIV())
+    {
+        _lastErrorMessage = "Key rotation starts once the items have been converted to the current format.";
+        return false;
+    }
+
+    bool resume = KeyRotator::readProgress(generation, lastId) &&
+                  generation == _keyRing.currentGeneration() && _keyRing.keyCount() > 1;
+
+    if(!resume)
+    {
+        KeyRing keys = _keyRing;
+        AutoSeeded_RNG rng;
+
+        generation = _keyRing.currentGeneration() + 1;
+        keys.addKey(generation, SymmetricKey(rng, DATA_KEY_SIZE),
+                    QDateTime::currentDateTime().toTime_t());
+
+        //Progress is written first, a new key without it is never used
+        if(!KeyRotator::writeProgress(generation, QString()))
         {
-            _lastErrorMessage = "Invalid passphrase or corrupted data.";
+            _lastErrorMessage = "Unable to store key rotation progress.";
             return false;
         }
 
+        if(!writeDataKeys(keys, QStringList(_currentPassphraseHash)))
+            return false;
+
+        _keyRing = keys;
+        SecretCache::setKeys(_keyRing);
+    }
+
+    delete _rotator;
+    _rotator = new KeyRotator(_keyRing, &_storageMutex);
+    _rotator->setBatchSize(_rotationBatchSize);
+    _rotator->setBatchDelay(_rotationBatchDelay);
+    _rotator->start(QThread::LowPriority);
+
+    return true;
+}
+
+/* Finish a key rotation that has encrypted every record with the
+ * new data key. Previous keys are removed from fort.dek. Called
+ * periodically from the main window.
+ *
+ * Returns true while the rotation is running.
+ */
+bool Security::updateKeyRotation()
+{
+    if(_rotator == 0)
+        return false;
+
+    if(_rotator->isRunning())
         return true;
+
+    if(_rotator->isComplete())
+    {
+        KeyRing keys = _keyRing;
+        keys.retireOldKeys();
+
+        //Items in memory may still hold secrets sealed with the previous
+        //keys, SecretCache keeps them until the vault is locked.
+        if(writeDataKeys(keys, QStringList(_currentPassphraseHash)))
+        {
+            _keyRing = keys;
+            KeyRotator::clearProgress();
+        }
     }
+    else
+        _lastErrorMessage = _rotator->getLastErrorMessage();
 
-    _lastErrorMessage = "Unable to validate passphrase.";
+    delete _rotator;
+    _rotator = 0;
 
     return false;
 }
+
+/* Stop a running key rotation and wait for the current batch to
+ * finish. Progress is kept, so the rotation continues on the next
+ * startKeyRotation() call.
+ */
+void Security::stopKeyRotation()
+{
+    if(_rotator == 0)
+        return;
+
+    _rotator->stop();
+    _rotator->wait();
+
+    updateKeyRotation();
+}
+
+/* Get the progress counters of the running key rotation.
+ */
+KeyRotationProgress Security::keyRotationProgress()
+{
+    if(_rotator != 0)
+        return _rotator->progress();
+
+    KeyRotationProgress progress;
+    progress.running = false;
+    progress.totalRecords = 0;
+    progress.processedRecords = 0;
+    progress.rotatedRecords = 0;
+    progress.recordsPerSecond = 0;
+    progress.secondsRemaining = -1;
+
+    return progress;
+}
+
+/* Returns true if stored records may be in an older format and
+ * should be upgraded, see VaultMigrator. Records are not read.
+ */
+bool Security::isMigrationDue()
+{
+    return VaultMigrator::isDue();
+}
+
+/* Start upgrading stored records of older formats to the current
+ * one on a background thread at low priority. An interrupted
+ * migration is continued. Not started while keys are rotated.
+ *
+ * Function returns true on success and false on failure.
+ * On failure _lastErrorMessage is set.
+ */
+bool Security::startMigration()
+{
+    if(_migrator != 0 && _migrator->isRunning())
+        return true;
+
+    if(_rotator != 0 && _rotator->isRunning())
+    {
+        _lastErrorMessage = "Items are upgraded once the key rotation is finished.";
+        return false;
+    }
+
+    if(!loadDataKeys())
+        return false;
+
+    //Records encrypted with the shared initialization vector
+    //are converted on lock
+    if(Environment::hasIV())
+    {
+        _lastErrorMessage = "Items are upgraded once they have been converted to the current format.";
+        return false;
+    }
+
+    delete _migrator;
+    _migrator = new VaultMigrator(_keyRing, &_storageMutex);
+    _migrator->setBatchSize(_rotationBatchSize);
+    _migrator->setBatchDelay(_rotationBatchDelay);
+    _migrator->start(QThread::LowPriority);
+
+    return true;
+}
+
+/* Collect a finished migration. Called periodically from
+ * the main window.
+ *
+ * Returns true while the migration is running.
+ */
+bool Security::updateMigration()
+{
+    if(_migrator == 0)
+        return false;
+
+    if(_migrator->isRunning())
+        return true;
+
+    if(!_migrator->isComplete())
+        _lastErrorMessage = _migrator->getLastErrorMessage();
+
+    delete _migrator;
+    _migrator = 0;
+
+    return false;
+}
+
+/* Stop a running migration and wait for the current batch to
+ * finish. Progress is kept, so the migration continues on the
+ * next startMigration() call.
+ */
+void Security::stopMigration()
+{
+    if(_migrator == 0)
+        return;
+
+    _migrator->stop();
+    _migrator->wait();
+
+    updateMigration();
+}
+
+/* Get the progress counters of the running migration.
+ */
+MigrationProgress Security::migrationProgress()
+{
+    if(_migrator != 0)
+        return _migrator->progress();
+
+    MigrationProgress progress;
+    progress.running = false;
+    progress.totalRecords = 0;
+    progress.processedRecords = 0;
+    progress.upgradedRecords = 0;
+
+    return progress;
+}
+
+/* Unwrap the data keys from fort.dek with the current passphrase hash.
+ *
+ * If there is no fort.dek, a new one is created. Items stored by older
+ * versions of Fort are encrypted with a key taken directly from the
+ * passphrase hash, so that key becomes the data key of generation zero.
+ * Otherwise a random data key is generated.
+ *
+ * If createKeys is false, no data key is created and fort.dek is left
+ * untouched. It must be false until the passphrase is verified, so a
+ * mistyped passphrase never replaces the keys.
+ *
+ * Function returns true on success and false on failure.
+ * On failure _lastErrorMessage is set.
+ */
+bool Security::loadDataKeys(bool createKeys)
+{
+    if(!_keyRing.isEmpty())
+        return true;
+
+    QFile file(Environment::ensurePath() + FORT_DATA_KEY_FILE);
+
+    if(file.open(QIODevice::ReadOnly | QIODevice::Text))
+    {
+        QTextStream in(&file);
+        QStringList lines = in.readAll().split('\n', QString::SkipEmptyParts);
+
+        file.close();
+
+        foreach(QString line, lines)
+        {
+            //version$iterations$salt$wrapped keys, hex encoded
+            QStringList fields = line.trimmed().split('$');
+
+            if(fields.count() != 4)
+                continue;
+
+            try
+            {
+                SecureVector<byte> salt = hex_decode(fields.at(2).toStdString());
+                SecureVector<byte> wrapped = hex_decode(fields.at(3).toStdString());
+                SymmetricKey wrappingKey = deriveWrappingKey(_currentPassphraseHash, salt,
+                                                             fields.at(1).toUInt());
+                SecureVector<byte> keys = rfc3394_keyunwrap(wrapped, wrappingKey,
+                                                            global_state().algorithm_factory());
+                KeyRing ring;
+
+                //Version 1 holds a single key of unknown age
+                if(fields.at(0) == DATA_KEY_VERSION_SINGLE)
+                    ring.addKey(0, SymmetricKey(keys), 0);
+                else if(fields.at(0) != DATA_KEY_VERSION || !KeyRing::deserialize(keys, ring))
+                    continue;
+
+                _keyRing = ring;
+
+                return true;
+            }
+            catch(...)
+            {
+                //Wrapped with another passphrase or corrupted
+            }
+        }
+
+        //Data keys that protect no items can be replaced
+        if(hasStoredData())
+        {
+            _lastErrorMessage = "Unable to unlock the data key. Invalid passphrase or corrupted data.";
+            return false;
+        }
+    }
+
+    if(!createKeys)
+    {
+        _lastErrorMessage = "Unable to unlock the data key. Invalid passphrase or corrupted data.";
+        return false;
+    }
+
+    KeyRing ring;
+
+    if(hasStoredData())
+        ring.addKey(0, getSymmetricKeyFromHash(_currentPassphraseHash), 0);
+    else
+    {
+        AutoSeeded_RNG rng;
+        ring.addKey(0, SymmetricKey(rng, DATA_KEY_SIZE), QDateTime::currentDateTime().toTime_t());
+    }
+
+    if(!writeDataKeys(ring, QStringList(_currentPassphraseHash)))
+        return false;
+
+    _keyRing = ring;
+
+    return true;
+}
+
+/* Store the data keys to fort.dek wrapped with each of the passphrase
+ * hashes. Every wrapping has its own random salt. File is replaced
+ * atomically, so a failed write leaves the previous one in place.
+ *
+ * Function returns true on success and false on failure.
+ * On failure _lastErrorMessage is set.
+ */
+bool Security::writeDataKeys(const KeyRing &keys, const QStringList &hashes)
+{
+    QString path = Environment::ensurePath() + FORT_DATA_KEY_FILE;
+    QString tmpPath = path + ".tmp";
+    QString data;
+
+    try
+    {
+        AutoSeeded_RNG rng;
+
+        foreach(QString hash, hashes)
+        {
+            SecureVector<byte> salt(DATA_KEY_SALT_SIZE);
+            rng.randomize(salt.begin(), salt.size());
+
+            SymmetricKey wrappingKey = deriveWrappingKey(hash, salt, DATA_KEY_ITERATIONS);
+            SecureVector<byte> wrapped = rfc3394_keywrap(keys.serialize(), wrappingKey,
+                                                         global_state().algorithm_factory());
+
+            data += QString("%1$%2$%3$%4\n").arg(DATA_KEY_VERSION).arg(DATA_KEY_ITERATIONS)
+                    .arg(QString::fromStdString(hex_encode(salt)))
+                    .arg(QString::fromStdString(hex_encode(wrapped)));
+        }
+    }
+    catch(...)
+    {
+        _lastErrorMessage = "Unable to wrap the data key.";
+        return false;
+    }
+
+    QFile file(tmpPath);
+    bool success = file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text);
+
+    success = success && file.write(data.toLatin1()) == data.length();
+    success = success && file.flush() && fsync(file.handle()) == 0;
+    file.close();
+
+    if(!success || ::rename(QFile::encodeName(tmpPath).constData(),
+                            QFile::encodeName(path).constData()) != 0)
+    {
+        QFile::remove(tmpPath);
+        _lastErrorMessage = "Unable to store the data key.";
+        return false;
+    }
+
+    return true;
+}
@@ -22,14 +22,49 @@
 #define SECURITY_H
 
 #include <QString>
+#include <QList>
+#include <QStringList>
+#include <QThreadPool>
 #include <botan/symkey.h>
+#include <QMutex>
+#include <QAtomicInt>
+#include "itemcollection.h"
+#include "keyring.h"
+#include "keyrotator.h"
+#include "vaultmigrator.h"
+#include "writebehind.h"
+#include "settingsparser.h"
+
+class CryptoTask;
+class VaultPrefetcher;
+
+/* Describes a failure of a single item during
+ * encryption or decryption.
+ */
+struct ItemError
+{
+    QString itemId;
+    QString message;
+};
 
 class Security
 {
 public:
     Security();
-    bool encryptAll();
-    bool decryptAll();
+    ~Security();
+    bool encryptAll(ItemCollection &collection);
+    bool queueChanges(ItemCollection &collection);
+    bool flushWrites();
+    WriteBehindStatus writeBehindStatus();
+    bool moveDataPath(SettingsParser *parser, const QString &dataPath);
+    bool decryptAll(bool createKeys = true);
+    void loadUnlockedItems(ItemCollection &collection);
+    void discardUnlockedItems();
+    void startPrefetch();
+    void decryptProgress(int &done, int &total);
+    void setThreadCount(int count);
+    int threadCount();
+    QList<ItemError> getItemErrors();
     void setMasterPassphraseHash(QString hash);
     void clearMasterPassphraseHashFromMemory();
     static QString createHashFromString(QString str);
@@ -38,10 +73,44 @@ public:
     bool comparePassphraseHash(QString hash);
     bool preservePassphraseBcrypt(QString plain);
     bool validateLogin(QString plain);
+    static QString checkPassphrase(QString plain);
+    static bool hasDataKeys();
+    bool changeMasterPassphrase(QString plain);
+    static bool hasStoredData();
+    void setKeyRotationThrottle(int batchSize, int batchDelay);
+    bool isKeyRotationDue(int maxAgeDays);
+    bool startKeyRotation();
+    bool updateKeyRotation();
+    void stopKeyRotation();
+    KeyRotationProgress keyRotationProgress();
+    bool isMigrationDue();
+    bool startMigration();
+    bool updateMigration();
+    void stopMigration();
+    MigrationProgress migrationProgress();
 
 private:
     QString _currentPassphraseHash;
+    KeyRing _keyRing;
     QString _lastErrorMessage;
+    QList<ItemError> _itemErrors;
+    QList<Item> _unlockedItems;
+    QSet<QString> _staleIds;
+    bool _needsConversion;
+    QThreadPool _pool;
+    QAtomicInt _decryptedRecords;
+    QAtomicInt _recordsToDecrypt;
+    QMutex _storageMutex;
+    VaultPrefetcher *_prefetcher;
+    KeyRotator *_rotator;
+    VaultMigrator *_migrator;
+    WriteBehind _writer;
+    int _rotationBatchSize;
+    int _rotationBatchDelay;
+    bool runTasks(const QList<CryptoTask*> &tasks);
+    int sliceCount(int count);
+    bool loadDataKeys(bool createKeys = true);
+    bool writeDataKeys(const KeyRing &keys, const QStringList &hashes);
 };
 
 #endif // SECURITY_H
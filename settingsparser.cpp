@@ -277,6 +277,24 @@ int SettingsParser::getIntIdleTime(QString property)
     return foundValue;
 }
 
+/* Methods reads an integer value from the Fort's configuration file
+ * for the wanted property.
+ *
+ * Returns the value, or defaultValue if the property does not exist
+ * or is not a valid number.
+ */
+int SettingsParser::getInt(QString property, int defaultValue)
+{
+    QString value = getString(property);
+    bool ok = false;
+    int foundValue = value.toInt(&ok);
+
+    if(!ok)
+        return defaultValue;
+
+    return foundValue;
+}
+
 /* Set idle time value in minutes.
  * Returns true on success, false on failure.
  */
@@ -36,6 +36,7 @@ public:
     QString getSettingsPath();
     int getIntIdleTime(QString property);
     bool setIntIdleTime(QString property, int value);
+    int getInt(QString property, int defaultValue);
 private:
     QString _settingsPath;
     QList<QString> *readAllConfigurationLines();
@@ -0,0 +1,185 @@
+/*
+ * This file is part of Fort.
+ *
+ * Fort is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Fort is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Fort.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2015 Niko Rosvall <niko@ideabyte.net>
+ *
+ */
+
+#include "stringpool.h"
+#include <string.h>
+
+/* Constructor. Entry 0 is the empty string.
+ */
+StringPool::StringPool() :
+    _garbage(0)
+{
+    Entry empty = { 0, 0, 0 };
+    _entries << empty;
+}
+
+/* Add a reference to a string and return its id.
+ * The string is stored if it is not in the pool yet.
+ */
+quint32 StringPool::intern(const QString &str)
+{
+    if(str.isEmpty())
+        return 0;
+
+    QByteArray utf8 = str.toUtf8();
+    uint hash = qHash(utf8);
+    quint32 id;
+
+    if(find(utf8, hash, id))
+    {
+        _entries[id].refs++;
+        return id;
+    }
+
+    Entry entry = { quint32(_arena.size()), quint32(utf8.size()), 1 };
+    _arena.append(utf8);
+
+    if(!_freeIds.isEmpty())
+    {
+        id = _freeIds.last();
+        _freeIds.removeLast();
+        _entries[id] = entry;
+    }
+    else
+    {
+        id = _entries.count();
+        _entries << entry;
+    }
+
+    _lookup.insert(hash, id);
+
+    return id;
+}
+
+/* Drop a reference to a string. Once there are no references,
+ * the id may be reused and the string is garbage. Arena is
+ * compacted when more than half of it is garbage.
+ */
+void StringPool::release(quint32 id)
+{
+    if(id == 0 || --_entries[id].refs > 0)
+        return;
+
+    Entry &entry = _entries[id];
+    QByteArray utf8 = QByteArray::fromRawData(_arena.constData() + entry.offset, entry.length);
+
+    _lookup.remove(qHash(utf8), id);
+    memset(_arena.data() + entry.offset, 0, entry.length);
+
+    _garbage += entry.length;
+    _freeIds << id;
+
+    if(_garbage > 4096 && _garbage > _arena.size() / 2)
+        compact();
+}
+
+/* Find the id of a string without adding a reference.
+ * Returns false if the string is not in the pool.
+ */
+bool StringPool::find(const QString &str, quint32 &id) const
+{
+    if(str.isEmpty())
+    {
+        id = 0;
+        return true;
+    }
+
+    QByteArray utf8 = str.toUtf8();
+    return find(utf8, qHash(utf8), id);
+}
+
+/* Get a string by id.
+ */
+QString StringPool::string(quint32 id) const
+{
+    const Entry &entry = _entries.at(id);
+    return QString::fromUtf8(_arena.constData() + entry.offset, entry.length);
+}
+
+/* Size of the arena in bytes.
+ */
+int StringPool::size() const
+{
+    return _arena.size();
+}
+
+/* Remove all strings. Arena is zeroed before it is released.
+ */
+void StringPool::clear()
+{
+    if(!_arena.isEmpty())
+        memset(_arena.data(), 0, _arena.size());
+
+    _arena.clear();
+    _entries.resize(1);
+    _freeIds.clear();
+    _lookup.clear();
+    _garbage = 0;
+}
+
+/* Find the id of UTF-8 data with a hash.
+ */
+bool StringPool::find(const QByteArray &utf8, uint hash, quint32 &id) const
+{
+    QMultiHash<uint, quint32>::const_iterator it = _lookup.constFind(hash);
+
+    for(; it != _lookup.constEnd() && it.key() == hash; ++it)
+    {
+        const Entry &entry = _entries.at(it.value());
+
+        if(int(entry.length) == utf8.size() &&
+           memcmp(_arena.constData() + entry.offset, utf8.constData(), entry.length) == 0)
+        {
+            id = it.value();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* Move the strings still referenced to a new arena, dropping
+ * the garbage. Old arena is zeroed.
+ */
+void StringPool::compact()
+{
+    QByteArray arena;
+    arena.reserve(_arena.size() - _garbage);
+
+    for(int id = 1; id < _entries.count(); id++)
+    {
+        Entry &entry = _entries[id];
+
+        if(entry.refs == 0)
+        {
+            entry.offset = 0;
+            entry.length = 0;
+            continue;
+        }
+
+        quint32 offset = arena.size();
+        arena.append(_arena.constData() + entry.offset, entry.length);
+        entry.offset = offset;
+    }
+
+    memset(_arena.data(), 0, _arena.size());
+    _arena = arena;
+    _garbage = 0;
+}
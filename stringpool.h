@@ -0,0 +1,65 @@
+/*
+ * This file is part of Fort.
+ *
+ * Fort is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Fort is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Fort.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2015 Niko Rosvall <niko@ideabyte.net>
+ *
+ */
+
+#ifndef STRINGPOOL_H
+#define STRINGPOOL_H
+
+#include <QString>
+#include <QByteArray>
+#include <QVector>
+#include <QMultiHash>
+
+/* Interned strings stored as UTF-8 in a single arena.
+ *
+ * Equal strings are stored once and share an id. Ids are reference
+ * counted, the space of released strings is reclaimed by compacting
+ * the arena once it is mostly garbage. Ids do not change when the
+ * arena is compacted. Id 0 is the empty string.
+ */
+class StringPool
+{
+public:
+    StringPool();
+    quint32 intern(const QString &str);
+    void release(quint32 id);
+    bool find(const QString &str, quint32 &id) const;
+    QString string(quint32 id) const;
+    int size() const;
+    void clear();
+
+private:
+    struct Entry
+    {
+        quint32 offset;
+        quint32 length;
+        quint32 refs;
+    };
+
+    QByteArray _arena;
+    QVector<Entry> _entries;
+    QVector<quint32> _freeIds;
+    QMultiHash<uint, quint32> _lookup;
+    int _garbage;
+
+    bool find(const QByteArray &utf8, uint hash, quint32 &id) const;
+    void compact();
+};
+
+#endif // STRINGPOOL_H
@@ -0,0 +1,6 @@
+# Botan as linked by Fort.pro
+
+unix:!macx: LIBS += -lbotan-1.10
+
+INCLUDEPATH += /usr/include/botan-1.10
+DEPENDPATH += /usr/include/botan-1.10
@@ -0,0 +1,33 @@
+#-------------------------------------------------
+#
+# Tests and loader benchmarks of the binary item format.
+# Build and run with: qmake && make && ./codectest
+#
+#-------------------------------------------------
+
+QT       += core gui testlib
+
+greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
+
+TARGET = codectest
+CONFIG += console
+CONFIG -= app_bundle
+TEMPLATE = app
+
+INCLUDEPATH += ../..
+DEPENDPATH += ../..
+
+SOURCES += tst_codec.cpp \
+    ../../itemcodec.cpp \
+    ../../item.cpp \
+    ../../secretcache.cpp \
+    ../../recordcipher.cpp \
+    ../../keyring.cpp
+
+HEADERS += ../../itemcodec.h \
+    ../../item.h \
+    ../../secretcache.h \
+    ../../recordcipher.h \
+    ../../keyring.h
+
+include(../botan.pri)
@@ -0,0 +1,219 @@
+/*
+ * This file is part of Fort.
+ *
+ * Fort is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Fort is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Fort.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2015 Niko Rosvall <niko@ideabyte.net>
+ *
+ */
+
+#include <QtTest>
+#include <QElapsedTimer>
+#include <QList>
+#include "itemcodec.h"
+#include "item.h"
+
+/* Tests of the binary item format and a comparison of its loader
+ * with the legacy line based text loader.
+ *
+ * Benchmarks print records/s for a corpus of RECORD_COUNT items,
+ * each record is decoded REPEAT times.
+ */
+#define RECORD_COUNT 10000
+#define REPEAT 10
+
+class CodecTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void roundTrip();
+    void unknownVersion();
+    void truncated();
+    void legacyText();
+    void benchmarkLegacyLoader();
+    void benchmarkBinaryLoader();
+    void benchmarkBinaryEncoder();
+
+private:
+    QList<Item> _items;
+    static void report(const char *what, qint64 nsecs);
+};
+
+/* Create the corpus.
+ */
+void CodecTest::initTestCase()
+{
+    for(int i = 0; i < RECORD_COUNT; i++)
+    {
+        Item item(QString("Account number %1").arg(i), QString("user%1@example.com").arg(i),
+                  QString("p4ssw0rd-%1").arg(i));
+
+        item.setUrl(QString("https://www.example%1.com/login").arg(i % 97));
+        item.setNotes(QString("Security question: pet %1\nAnswer: fish").arg(i));
+        item.setFavorite(i % 10 == 0);
+
+        _items << item;
+    }
+}
+
+/* Every field survives encoding and decoding.
+ */
+void CodecTest::roundTrip()
+{
+    const Item &item = _items.at(1);
+    QByteArray secrets;
+    QString password;
+    QString notes;
+    bool ok;
+
+    QVERIFY(ItemCodec::encodeSecrets(item, secrets));
+
+    Item meta = ItemCodec::decodeMeta(ItemCodec::encodeMeta(item), &ok);
+
+    QVERIFY(ok);
+    QCOMPARE(meta.getTitle(), item.getTitle());
+    QCOMPARE(meta.getUser(), item.getUser());
+    QCOMPARE(meta.getUrl(), item.getUrl());
+    QCOMPARE(meta.getID(), item.getID());
+    QCOMPARE(meta.getIsFavorite(), item.getIsFavorite());
+
+    QVERIFY(ItemCodec::decodeSecrets(secrets, password, notes));
+    QCOMPARE(password, item.getPassword());
+    QCOMPARE(notes, item.getNotes());
+}
+
+/* Data of a newer version is binary but fails to decode,
+ * it is never parsed as legacy text.
+ */
+void CodecTest::unknownVersion()
+{
+    QByteArray data = ItemCodec::encodeMeta(_items.at(2));
+    data[3] = char(data.at(3) + 1);
+    bool ok;
+
+    QVERIFY(ItemCodec::isBinary(data));
+
+    Item item = ItemCodec::decodeMeta(data, &ok);
+
+    QVERIFY(!ok);
+    QVERIFY(item.isEmpty());
+}
+
+/* Truncated data fails to decode.
+ */
+void CodecTest::truncated()
+{
+    QByteArray data = ItemCodec::encodeMeta(_items.at(3));
+    QString password;
+    QString notes;
+    bool ok;
+
+    ItemCodec::decodeItem(data.left(data.length() - 1), &ok);
+    QVERIFY(!ok);
+
+    ItemCodec::decodeMeta(data.left(3), &ok);
+    QVERIFY(!ok);
+
+    QVERIFY(!ItemCodec::decodeSecrets(data.left(data.length() - 1), password, notes));
+}
+
+/* Legacy text is still read.
+ */
+void CodecTest::legacyText()
+{
+    const Item &item = _items.at(4);
+    bool ok;
+
+    Item decoded = ItemCodec::decodeItem(item.toPlainText().toUtf8(), &ok);
+
+    QVERIFY(ok);
+    QCOMPARE(decoded.getTitle(), item.getTitle());
+    QCOMPARE(decoded.getPassword(), item.getPassword());
+    QCOMPARE(decoded.getNotes(), item.getNotes());
+}
+
+/* Records/s of the legacy text loader, whole items.
+ */
+void CodecTest::benchmarkLegacyLoader()
+{
+    QList<QByteArray> records;
+
+    foreach(Item item, _items)
+        records << item.toPlainText().toUtf8();
+
+    QElapsedTimer timer;
+    timer.start();
+
+    for(int r = 0; r < REPEAT; r++)
+        foreach(QByteArray record, records)
+            ItemCodec::decodeItem(record);
+
+    report("legacy text loader", timer.nsecsElapsed());
+}
+
+/* Records/s of the binary loader, whole items.
+ */
+void CodecTest::benchmarkBinaryLoader()
+{
+    QList<QByteArray> records;
+
+    foreach(Item item, _items)
+    {
+        QByteArray secrets;
+        ItemCodec::encodeSecrets(item, secrets);
+        records << ItemCodec::encodeMeta(item) + secrets.mid(4);
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    for(int r = 0; r < REPEAT; r++)
+        foreach(QByteArray record, records)
+            ItemCodec::decodeItem(record);
+
+    report("binary loader", timer.nsecsElapsed());
+}
+
+/* Records/s of the binary encoder, metadata and secrets.
+ */
+void CodecTest::benchmarkBinaryEncoder()
+{
+    QByteArray secrets;
+    QElapsedTimer timer;
+    timer.start();
+
+    for(int r = 0; r < REPEAT; r++)
+        foreach(Item item, _items)
+        {
+            ItemCodec::encodeMeta(item);
+            ItemCodec::encodeSecrets(item, secrets);
+        }
+
+    report("binary encoder", timer.nsecsElapsed());
+}
+
+/* Print the rate of a benchmark.
+ */
+void CodecTest::report(const char *what, qint64 nsecs)
+{
+    double records = double(RECORD_COUNT) * REPEAT;
+
+    qDebug("%s: %.0f records/s", what, records * 1e9 / qMax<qint64>(nsecs, 1));
+}
+
+QTEST_APPLESS_MAIN(CodecTest)
+
+#include "tst_codec.moc"
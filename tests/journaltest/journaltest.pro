@@ -0,0 +1,27 @@
+#-------------------------------------------------
+#
+# Crash injection tests of the vault journal.
+# Build and run with: qmake && make && ./journaltest
+#
+#-------------------------------------------------
+
+QT       += core gui testlib
+
+greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
+
+TARGET = journaltest
+CONFIG += console
+CONFIG -= app_bundle
+TEMPLATE = app
+
+INCLUDEPATH += ../..
+DEPENDPATH += ../..
+
+SOURCES += tst_journal.cpp \
+    ../../vaultstorage.cpp \
+    ../../environment.cpp \
+    ../../settingsparser.cpp
+
+HEADERS += ../../vaultstorage.h \
+    ../../environment.h \
+    ../../settingsparser.h
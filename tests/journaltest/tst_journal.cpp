@@ -0,0 +1,409 @@
+/*
+ * This file is part of Fort.
+ *
+ * Fort is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Fort is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Fort.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2015 Niko Rosvall <niko@ideabyte.net>
+ *
+ */
+
+#include <QtTest>
+#include <QElapsedTimer>
+#include <QDir>
+#include <QFile>
+#include <QHash>
+#include <QSet>
+#include "vaultstorage.h"
+#include "environment.h"
+
+/* Crash injection tests of the VaultStorage journal.
+ *
+ * A crash is simulated by leaving the files as they would be at the
+ * moment of the crash: the journal cut at every offset of its last
+ * commit, a corrupted tail, and the journal or temporary files left
+ * behind by an interrupted compaction. Opening the storage must then
+ * show exactly the committed records. Damage to a commit followed by
+ * a later one is not a crash and opening the storage must fail.
+ *
+ * Benchmarks print commits/s of APPEND_COUNT commits of one record
+ * of RECORD_SIZE bytes, each opening the storage like WriteBehind.
+ *
+ * HOME points to a directory of the test, so the default data path
+ * is used and no configuration file is needed.
+ */
+#define APPEND_COUNT 500
+#define RECORD_SIZE 512
+
+class JournalTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void init();
+    void cleanupTestCase();
+    void tornTail();
+    void corruptedTail();
+    void corruptedCommit();
+    void appendAfterTornTail();
+    void crashBeforeCompaction();
+    void crashBeforeRenames();
+    void crashBeforeJournalRemoval();
+    void benchmarkJournalAppends();
+    void benchmarkItemFileWrites();
+
+private:
+    QString _home;
+    QString dataPath();
+    QHash<QString, QByteArray> records(const QString &id, const QByteArray &data);
+    bool commitJournaled(const QHash<QString, QByteArray> &records,
+                         const QSet<QString> &removed = QSet<QString>());
+    bool compact();
+    QHash<QString, QByteArray> readAll();
+    QByteArray readFile(const QString &path);
+    void writeFile(const QString &path, const QByteArray &data);
+    static void removeTree(const QString &path);
+    void benchmarkCommits(const char *what, bool journaled);
+};
+
+/* Point HOME to an empty directory of the test.
+ */
+void JournalTest::initTestCase()
+{
+    _home = QDir::tempPath() + QString("/fort-journaltest-%1").arg(QCoreApplication::applicationPid());
+    removeTree(_home);
+    QVERIFY(QDir().mkpath(_home));
+    qputenv("HOME", QFile::encodeName(_home));
+}
+
+/* Start every test with an empty data path.
+ */
+void JournalTest::init()
+{
+    removeTree(_home + "/.fort");
+    QVERIFY(QDir().mkpath(dataPath()));
+}
+
+/* Remove the directory of the test.
+ */
+void JournalTest::cleanupTestCase()
+{
+    removeTree(_home);
+}
+
+/* Cutting the journal anywhere inside the last commit loses
+ * that commit and nothing else, the header included.
+ */
+void JournalTest::tornTail()
+{
+    QString journalPath = dataPath() + FORT_JOURNAL_FILE;
+
+    QVERIFY(commitJournaled(records("a", "first")));
+    int firstSize = readFile(journalPath).size();
+
+    QVERIFY(commitJournaled(records("b", "second")));
+    QByteArray journal = readFile(journalPath);
+
+    for(int cut = 0; cut < journal.size(); cut++)
+    {
+        writeFile(journalPath, journal.left(cut));
+
+        QHash<QString, QByteArray> expected;
+
+        if(cut >= firstSize)
+            expected = records("a", "first");
+
+        QCOMPARE(readAll(), expected);
+    }
+
+    writeFile(journalPath, journal);
+
+    QHash<QString, QByteArray> expected = records("a", "first");
+    expected.unite(records("b", "second"));
+
+    QCOMPARE(readAll(), expected);
+}
+
+/* A tail which fails its checksum is ignored like a torn one.
+ */
+void JournalTest::corruptedTail()
+{
+    QString journalPath = dataPath() + FORT_JOURNAL_FILE;
+
+    QVERIFY(commitJournaled(records("a", "first")));
+    int firstSize = readFile(journalPath).size();
+
+    QVERIFY(commitJournaled(records("b", "second")));
+    QByteArray journal = readFile(journalPath);
+
+    for(int i = firstSize; i < journal.size(); i++)
+    {
+        QByteArray corrupted = journal;
+        corrupted[i] = char(corrupted.at(i) ^ 0x5a);
+        writeFile(journalPath, corrupted);
+
+        QCOMPARE(readAll(), records("a", "first"));
+    }
+}
+
+/* Damage anywhere in a commit followed by a complete one fails
+ * the open and leaves the journal as it is.
+ */
+void JournalTest::corruptedCommit()
+{
+    QString journalPath = dataPath() + FORT_JOURNAL_FILE;
+
+    QVERIFY(commitJournaled(records("a", "first")));
+    int firstSize = readFile(journalPath).size();
+
+    QVERIFY(commitJournaled(records("b", "second")));
+    int secondSize = readFile(journalPath).size();
+
+    QVERIFY(commitJournaled(records("c", "third")));
+    QByteArray journal = readFile(journalPath);
+
+    for(int i = firstSize; i < secondSize; i++)
+    {
+        QByteArray corrupted = journal;
+        corrupted[i] = char(corrupted.at(i) ^ 0x5a);
+        writeFile(journalPath, corrupted);
+
+        VaultStorage storage;
+
+        QVERIFY(!storage.open());
+        QVERIFY(!storage.getLastErrorMessage().isEmpty());
+        QCOMPARE(readFile(journalPath), corrupted);
+    }
+}
+
+/* A commit after a crash replaces the torn tail, so the
+ * commit is not hidden behind it.
+ */
+void JournalTest::appendAfterTornTail()
+{
+    QString journalPath = dataPath() + FORT_JOURNAL_FILE;
+
+    QVERIFY(commitJournaled(records("a", "first")));
+    int firstSize = readFile(journalPath).size();
+
+    QVERIFY(commitJournaled(records("b", "second")));
+    writeFile(journalPath, readFile(journalPath).left(firstSize + 5));
+
+    QVERIFY(commitJournaled(records("c", "third")));
+
+    QHash<QString, QByteArray> expected = records("a", "first");
+    expected.unite(records("c", "third"));
+
+    QCOMPARE(readAll(), expected);
+}
+
+/* Crash after the append but before compaction. Records and
+ * removals are served from the journal on top of the item
+ * files, and compaction folds them in later.
+ */
+void JournalTest::crashBeforeCompaction()
+{
+    QVERIFY(commitJournaled(records("a", "first")));
+    QVERIFY(commitJournaled(records("b", "second")));
+    QVERIFY(compact());
+
+    QVERIFY(!QFile::exists(dataPath() + FORT_JOURNAL_FILE));
+
+    QVERIFY(commitJournaled(records("b", "changed"), QSet<QString>() << "a"));
+
+    QCOMPARE(readAll(), records("b", "changed"));
+
+    QVERIFY(compact());
+
+    QVERIFY(!QFile::exists(dataPath() + FORT_JOURNAL_FILE));
+    QCOMPARE(readAll(), records("b", "changed"));
+}
+
+/* Crash during compaction before the temporary files are renamed.
+ * They are ignored and replaced by the next compaction.
+ */
+void JournalTest::crashBeforeRenames()
+{
+    QVERIFY(commitJournaled(records("a", "first")));
+
+    writeFile(dataPath() + "a.plain.enc.tmp", "torn");
+    writeFile(dataPath() + QString(FORT_VAULT_FILE) + ".tmp", "torn");
+
+    QCOMPARE(readAll(), records("a", "first"));
+
+    QVERIFY(compact());
+
+    QVERIFY(!QFile::exists(dataPath() + "a.plain.enc.tmp"));
+    QCOMPARE(readAll(), records("a", "first"));
+}
+
+/* Crash during compaction after the records are renamed in
+ * place but before the journal is removed. Replaying the
+ * journal again gives the same records.
+ */
+void JournalTest::crashBeforeJournalRemoval()
+{
+    QString journalPath = dataPath() + FORT_JOURNAL_FILE;
+
+    QVERIFY(commitJournaled(records("a", "first")));
+    QVERIFY(commitJournaled(records("b", "second"), QSet<QString>() << "a"));
+
+    QByteArray journal = readFile(journalPath);
+
+    QVERIFY(compact());
+    writeFile(journalPath, journal);
+
+    QCOMPARE(readAll(), records("b", "second"));
+
+    QVERIFY(compact());
+
+    QVERIFY(!QFile::exists(journalPath));
+    QCOMPARE(readAll(), records("b", "second"));
+}
+
+/* Commits appended to the journal.
+ */
+void JournalTest::benchmarkJournalAppends()
+{
+    benchmarkCommits("journal appends", true);
+}
+
+/* Commits written as item files, for comparison.
+ */
+void JournalTest::benchmarkItemFileWrites()
+{
+    benchmarkCommits("item file writes", false);
+}
+
+/* Commit APPEND_COUNT records one at a time and print commits/s.
+ */
+void JournalTest::benchmarkCommits(const char *what, bool journaled)
+{
+    QByteArray data(RECORD_SIZE, 'x');
+    QElapsedTimer timer;
+
+    timer.start();
+
+    for(int i = 0; i < APPEND_COUNT; i++)
+    {
+        VaultStorage storage;
+        storage.setJournaled(journaled);
+
+        QVERIFY(storage.open());
+        QVERIFY(storage.commit(records(QString("item%1").arg(i), data), QSet<QString>()));
+    }
+
+    qint64 nsecs = timer.nsecsElapsed();
+
+    QCOMPARE(readAll().count(), APPEND_COUNT);
+    qDebug("%s: %.0f commits/s", what, APPEND_COUNT * 1e9 / qMax<qint64>(nsecs, 1));
+}
+
+/* Data path used by VaultStorage.
+ */
+QString JournalTest::dataPath()
+{
+    return Environment::ensurePath();
+}
+
+/* A single record.
+ */
+QHash<QString, QByteArray> JournalTest::records(const QString &id, const QByteArray &data)
+{
+    QHash<QString, QByteArray> result;
+    result.insert(id, data);
+
+    return result;
+}
+
+/* Append a commit to the journal.
+ */
+bool JournalTest::commitJournaled(const QHash<QString, QByteArray> &records,
+                                  const QSet<QString> &removed)
+{
+    VaultStorage storage;
+    storage.setJournaled(true);
+
+    return storage.open() && storage.commit(records, removed);
+}
+
+/* Fold the journal into the item files.
+ */
+bool JournalTest::compact()
+{
+    VaultStorage storage;
+
+    return storage.compact();
+}
+
+/* Open the storage like after a restart and read every record.
+ */
+QHash<QString, QByteArray> JournalTest::readAll()
+{
+    VaultStorage storage;
+    QHash<QString, QByteArray> result;
+
+    if(!storage.open())
+        return result;
+
+    foreach(QString id, storage.recordIds())
+        result.insert(id, storage.readRecord(id));
+
+    return result;
+}
+
+/* Read a whole file.
+ */
+QByteArray JournalTest::readFile(const QString &path)
+{
+    QFile file(path);
+
+    if(!file.open(QIODevice::ReadOnly))
+        return QByteArray();
+
+    return file.readAll();
+}
+
+/* Replace a file with data, as a crash would have left it.
+ */
+void JournalTest::writeFile(const QString &path, const QByteArray &data)
+{
+    QFile file(path);
+
+    QVERIFY(file.open(QIODevice::WriteOnly | QIODevice::Truncate));
+    QCOMPARE(file.write(data), qint64(data.size()));
+    file.close();
+}
+
+/* Remove a directory and everything in it.
+ */
+void JournalTest::removeTree(const QString &path)
+{
+    QDir dir(path);
+
+    foreach(QFileInfo entry, dir.entryInfoList(QDir::Files | QDir::Dirs | QDir::Hidden |
+                                               QDir::NoDotAndDotDot))
+    {
+        if(entry.isDir())
+            removeTree(entry.absoluteFilePath());
+        else
+            QFile::remove(entry.absoluteFilePath());
+    }
+
+    dir.rmdir(path);
+}
+
+QTEST_APPLESS_MAIN(JournalTest)
+
+#include "tst_journal.moc"
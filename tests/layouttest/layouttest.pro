@@ -0,0 +1,27 @@
+#-------------------------------------------------
+#
+# Directory operation benchmarks of the item file layouts.
+# Build and run with: qmake && make && ./layouttest
+#
+#-------------------------------------------------
+
+QT       += core gui testlib
+
+greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
+
+TARGET = layouttest
+CONFIG += console
+CONFIG -= app_bundle
+TEMPLATE = app
+
+INCLUDEPATH += ../..
+DEPENDPATH += ../..
+
+SOURCES += tst_layout.cpp \
+    ../../vaultstorage.cpp \
+    ../../environment.cpp \
+    ../../settingsparser.cpp
+
+HEADERS += ../../vaultstorage.h \
+    ../../environment.h \
+    ../../settingsparser.h
@@ -0,0 +1,236 @@
+/*
+ * This file is part of Fort.
+ *
+ * Fort is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Fort is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Fort.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2015 Niko Rosvall <niko@ideabyte.net>
+ *
+ */
+
+#include <QtTest>
+#include <QElapsedTimer>
+#include <QDir>
+#include <QFile>
+#include <QHash>
+#include <QSet>
+#include <QUuid>
+#include "vaultstorage.h"
+#include "environment.h"
+#include "settingsparser.h"
+
+/* Tests and directory operation benchmarks of the flat and the
+ * sharded item file layouts of VaultStorage.
+ *
+ * Benchmarks create, list, read and remove item files of vaults of
+ * 10k, 100k and 1M items and print files/s for every operation.
+ * Items are written in commits of COMMIT_SIZE records of RECORD_SIZE
+ * bytes, a hundredth of them is removed in a single commit.
+ * Run a single size with: ./layouttest benchmarkLayout:"sharded 100k"
+ *
+ * HOME points to a directory of the test, so the default data path
+ * is used and the layout is selected in its configuration file.
+ */
+#define COMMIT_SIZE 10000
+#define RECORD_SIZE 256
+
+class LayoutTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void init();
+    void cleanupTestCase();
+    void roundTrip_data();
+    void roundTrip();
+    void benchmarkLayout_data();
+    void benchmarkLayout();
+
+private:
+    QString _home;
+    void setSharded(bool sharded);
+    static double rate(int count, qint64 nsecs);
+    static void removeTree(const QString &path);
+};
+
+/* Point HOME to an empty directory of the test.
+ */
+void LayoutTest::initTestCase()
+{
+    _home = QDir::tempPath() + QString("/fort-layouttest-%1").arg(QCoreApplication::applicationPid());
+    removeTree(_home);
+    QVERIFY(QDir().mkpath(_home));
+    qputenv("HOME", QFile::encodeName(_home));
+}
+
+/* Start every test with an empty data path.
+ */
+void LayoutTest::init()
+{
+    removeTree(_home + "/.fort");
+    QVERIFY(QDir().mkpath(Environment::ensurePath()));
+}
+
+/* Remove the directory of the test.
+ */
+void LayoutTest::cleanupTestCase()
+{
+    removeTree(_home);
+}
+
+void LayoutTest::roundTrip_data()
+{
+    QTest::addColumn<bool>("sharded");
+
+    QTest::newRow("flat") << false;
+    QTest::newRow("sharded") << true;
+}
+
+/* Records written in a layout are listed and read back,
+ * removed ones are gone.
+ */
+void LayoutTest::roundTrip()
+{
+    QFETCH(bool, sharded);
+
+    setSharded(sharded);
+
+    QHash<QString, QByteArray> records;
+
+    for(int i = 0; i < 100; i++)
+        records.insert(QUuid::createUuid().toString(), QByteArray::number(i));
+
+    QString removed = records.keys().first();
+
+    QVERIFY(VaultStorage().commit(records, QSet<QString>()));
+    QVERIFY(VaultStorage().commit(QHash<QString, QByteArray>(), QSet<QString>() << removed));
+
+    records.remove(removed);
+
+    VaultStorage storage;
+
+    QVERIFY(storage.open());
+    QCOMPARE(storage.recordIds().count(), records.count());
+
+    foreach(QString id, storage.recordIds())
+        QCOMPARE(storage.readRecord(id), records.value(id));
+}
+
+void LayoutTest::benchmarkLayout_data()
+{
+    QTest::addColumn<bool>("sharded");
+    QTest::addColumn<int>("count");
+
+    QTest::newRow("flat 10k") << false << 10000;
+    QTest::newRow("sharded 10k") << true << 10000;
+    QTest::newRow("flat 100k") << false << 100000;
+    QTest::newRow("sharded 100k") << true << 100000;
+    QTest::newRow("flat 1M") << false << 1000000;
+    QTest::newRow("sharded 1M") << true << 1000000;
+}
+
+/* Create, list, read and remove the item files of a vault.
+ */
+void LayoutTest::benchmarkLayout()
+{
+    QFETCH(bool, sharded);
+    QFETCH(int, count);
+
+    setSharded(sharded);
+
+    QByteArray data(RECORD_SIZE, 'x');
+    QElapsedTimer timer;
+    qint64 createNsecs = 0;
+
+    for(int done = 0; done < count; done += COMMIT_SIZE)
+    {
+        QHash<QString, QByteArray> records;
+
+        for(int i = done; i < qMin(count, done + COMMIT_SIZE); i++)
+            records.insert(QUuid::createUuid().toString(), data);
+
+        timer.start();
+        QVERIFY(VaultStorage().commit(records, QSet<QString>()));
+        createNsecs += timer.nsecsElapsed();
+    }
+
+    VaultStorage storage;
+
+    timer.start();
+    QVERIFY(storage.open());
+    qint64 listNsecs = timer.nsecsElapsed();
+
+    QStringList ids = storage.recordIds();
+    QCOMPARE(ids.count(), count);
+
+    timer.start();
+
+    foreach(QString id, ids)
+        QCOMPARE(storage.readRecord(id).length(), RECORD_SIZE);
+
+    qint64 readNsecs = timer.nsecsElapsed();
+
+    storage.close();
+
+    QSet<QString> removed;
+
+    for(int i = 0; i < count / 100; i++)
+        removed << ids.at(i * 100);
+
+    timer.start();
+    QVERIFY(VaultStorage().commit(QHash<QString, QByteArray>(), removed));
+    qint64 removeNsecs = timer.nsecsElapsed();
+
+    qDebug("%s: create %.0f files/s, list %.0f files/s, read %.0f files/s, remove %.0f files/s",
+           QTest::currentDataTag(), rate(count, createNsecs), rate(count, listNsecs),
+           rate(count, readNsecs), rate(removed.count(), removeNsecs));
+}
+
+/* Select the layout in the configuration file.
+ */
+void LayoutTest::setSharded(bool sharded)
+{
+    SettingsParser parser;
+
+    QVERIFY(parser.setBoolean("shardedvault", sharded));
+}
+
+/* Operations per second.
+ */
+double LayoutTest::rate(int count, qint64 nsecs)
+{
+    return count * 1e9 / qMax<qint64>(nsecs, 1);
+}
+
+/* Remove a directory and everything in it.
+ */
+void LayoutTest::removeTree(const QString &path)
+{
+    QDir dir(path);
+
+    foreach(QFileInfo entry, dir.entryInfoList(QDir::Files | QDir::Dirs | QDir::Hidden |
+                                               QDir::NoDotAndDotDot))
+    {
+        if(entry.isDir())
+            removeTree(entry.absoluteFilePath());
+        else
+            QFile::remove(entry.absoluteFilePath());
+    }
+
+    dir.rmdir(path);
+}
+
+QTEST_APPLESS_MAIN(LayoutTest)
+
+#include "tst_layout.moc"
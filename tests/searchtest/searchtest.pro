@@ -0,0 +1,23 @@
+#-------------------------------------------------
+#
+# Tests and matching benchmarks of the fuzzy search.
+# Build and run with: qmake && make && ./searchtest
+#
+#-------------------------------------------------
+
+QT       += core testlib
+
+TARGET = searchtest
+CONFIG += console
+CONFIG -= app_bundle
+TEMPLATE = app
+
+INCLUDEPATH += ../..
+DEPENDPATH += ../..
+
+SOURCES += tst_search.cpp \
+    ../../fuzzymatcher.cpp \
+    ../../searchengine.cpp
+
+HEADERS += ../../fuzzymatcher.h \
+    ../../searchengine.h
@@ -0,0 +1,207 @@
+/*
+ * This file is part of Fort.
+ *
+ * Fort is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Fort is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Fort.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2015 Niko Rosvall <niko@ideabyte.net>
+ *
+ */
+
+#include <QtTest>
+#include <QElapsedTimer>
+#include <QStringList>
+#include "fuzzymatcher.h"
+#include "searchengine.h"
+
+/* Tests of the fuzzy matcher and benchmarks of matching a corpus
+ * of TITLE_COUNT search texts, title, user and url separated by
+ * '\n' like ItemCollection builds them.
+ *
+ * Benchmarks print matches/s, a match being one text scored
+ * against one pattern, whether it matched or not.
+ */
+#define TITLE_COUNT 100000
+#define REPEAT 5
+
+class SearchTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void subsequence();
+    void wordStart();
+    void fieldBoundary();
+    void bestField();
+    void longText();
+    void benchmarkMatcher();
+    void benchmarkEngine();
+
+private:
+    QStringList _texts;
+    static void report(const char *what, double matches, qint64 nsecs);
+};
+
+/* Create the corpus, case folded like the search engine does.
+ */
+void SearchTest::initTestCase()
+{
+    const char *words[] = { "mail", "bank", "forum", "shop", "cloud", "work", "home", "game" };
+
+    for(int i = 0; i < TITLE_COUNT; i++)
+    {
+        QString title = QString("%1 %2 account %3").arg(words[i % 8]).arg(words[(i / 8) % 8]).arg(i);
+        QString user = QString("user%1@example.com").arg(i);
+        QString url = QString("https://www.example%1.com/login").arg(i % 97);
+
+        _texts << (title + '\n' + user + '\n' + url).toCaseFolded();
+    }
+}
+
+/* Pattern matches as a subsequence and only then.
+ */
+void SearchTest::subsequence()
+{
+    int result;
+
+    QVERIFY(FuzzyMatcher::score("", "anything", result));
+    QCOMPARE(result, 0);
+    QVERIFY(FuzzyMatcher::score("gml", "gmail", result));
+    QVERIFY(FuzzyMatcher::score("gmail", "gmail", result));
+    QVERIFY(!FuzzyMatcher::score("lmg", "gmail", result));
+    QVERIFY(!FuzzyMatcher::score("gmails", "gmail", result));
+}
+
+/* Matches at word starts score higher.
+ */
+void SearchTest::wordStart()
+{
+    int compact;
+    int spread;
+
+    QVERIFY(FuzzyMatcher::score("gml", "gmail", compact));
+    QVERIFY(FuzzyMatcher::score("gml", "google mail", spread));
+    QVERIFY(compact > spread);
+}
+
+/* A match does not span the fields of the text.
+ */
+void SearchTest::fieldBoundary()
+{
+    int result;
+
+    QVERIFY(!FuzzyMatcher::score("bankuser", "bank\nuser\nhttps://example.com", result));
+    QVERIFY(!FuzzyMatcher::score("ku", "bank\nuser", result));
+    QVERIFY(FuzzyMatcher::score("user", "bank\nuser\nhttps://example.com", result));
+    QVERIFY(FuzzyMatcher::score("exa", "bank\n\nhttps://example.com", result));
+}
+
+/* The best scoring field gives the score.
+ */
+void SearchTest::bestField()
+{
+    int single;
+    int fields;
+
+    QVERIFY(FuzzyMatcher::score("mail", "mail", single));
+    QVERIFY(FuzzyMatcher::score("mail", "my m a i l\nmail", fields));
+    QCOMPARE(fields, single);
+}
+
+/* Texts longer than a vector register are searched correctly.
+ */
+void SearchTest::longText()
+{
+    QString text = QString(40, 'a') + 'x' + QString(40, 'b') + 'y';
+    int result;
+
+    QVERIFY(FuzzyMatcher::score("xy", text, result));
+    QVERIFY(FuzzyMatcher::score("ay", text, result));
+    QVERIFY(!FuzzyMatcher::score("yx", text, result));
+}
+
+/* Score every text of the corpus against a few patterns.
+ */
+void SearchTest::benchmarkMatcher()
+{
+    QStringList patterns;
+    patterns << "mb" << "bnkacc" << "user99" << "exmpl42" << "zzz";
+
+    QElapsedTimer timer;
+    int matched = 0;
+    int result;
+
+    timer.start();
+
+    for(int r = 0; r < REPEAT; r++)
+    {
+        foreach(const QString &pattern, patterns)
+        {
+            for(int i = 0; i < _texts.size(); i++)
+            {
+                if(FuzzyMatcher::score(pattern, _texts.at(i), result))
+                    matched++;
+            }
+        }
+    }
+
+    qint64 nsecs = timer.nsecsElapsed();
+
+    QVERIFY(matched > 0);
+    report("fuzzy matcher", double(TITLE_COUNT) * patterns.size() * REPEAT, nsecs);
+}
+
+/* Fuzzy search through the engine, prefilter and ranking included.
+ * No query contains the one before it, so cached results are not
+ * reused.
+ */
+void SearchTest::benchmarkEngine()
+{
+    SearchEngine engine;
+    engine.setFuzzy(true);
+
+    for(int i = 0; i < _texts.size(); i++)
+        engine.insertText(i, _texts.at(i));
+
+    QStringList queries;
+    queries << "mb" << "bnkacc" << "user99" << "exmpl42" << "zzz";
+
+    QElapsedTimer timer;
+    int searches = 0;
+
+    timer.start();
+
+    for(int r = 0; r < REPEAT; r++)
+    {
+        foreach(const QString &query, queries)
+        {
+            QList<int> indexes;
+            int revision;
+
+            QVERIFY(engine.search(query, indexes, revision));
+            searches++;
+        }
+    }
+
+    report("search engine", double(TITLE_COUNT) * searches, timer.nsecsElapsed());
+}
+
+void SearchTest::report(const char *what, double matches, qint64 nsecs)
+{
+    qDebug("%s: %.0f matches/s", what, matches * 1e9 / qMax<qint64>(nsecs, 1));
+}
+
+QTEST_APPLESS_MAIN(SearchTest)
+
+#include "tst_search.moc"
@@ -0,0 +1,61 @@
+#-------------------------------------------------
+#
+# Thread scaling benchmarks of item encryption and decryption.
+# Build and run with: qmake && make && ./securitytest
+#
+#-------------------------------------------------
+
+QT       += core gui testlib
+
+greaterThan(QT_MAJOR_VERSION, 4): QT += widgets concurrent
+
+TARGET = securitytest
+CONFIG += console
+CONFIG -= app_bundle
+TEMPLATE = app
+
+INCLUDEPATH += ../..
+DEPENDPATH += ../..
+
+SOURCES += tst_security.cpp \
+    ../../security.cpp \
+    ../../item.cpp \
+    ../../itemcollection.cpp \
+    ../../itemcodec.cpp \
+    ../../itemstore.cpp \
+    ../../stringpool.cpp \
+    ../../searchengine.cpp \
+    ../../fuzzymatcher.cpp \
+    ../../searchworker.cpp \
+    ../../environment.cpp \
+    ../../settingsparser.cpp \
+    ../../vaultstorage.cpp \
+    ../../recordcipher.cpp \
+    ../../secretcache.cpp \
+    ../../keyring.cpp \
+    ../../keyrotator.cpp \
+    ../../vaultmigrator.cpp \
+    ../../writebehind.cpp \
+    ../../vaultprefetcher.cpp
+
+HEADERS += ../../security.h \
+    ../../item.h \
+    ../../itemcollection.h \
+    ../../itemcodec.h \
+    ../../itemstore.h \
+    ../../stringpool.h \
+    ../../searchengine.h \
+    ../../fuzzymatcher.h \
+    ../../searchworker.h \
+    ../../environment.h \
+    ../../settingsparser.h \
+    ../../vaultstorage.h \
+    ../../recordcipher.h \
+    ../../secretcache.h \
+    ../../keyring.h \
+    ../../keyrotator.h \
+    ../../vaultmigrator.h \
+    ../../writebehind.h \
+    ../../vaultprefetcher.h
+
+include(../botan.pri)
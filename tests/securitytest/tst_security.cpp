@@ -0,0 +1,220 @@
+/*
+ * This file is part of Fort.
+ *
+ * Fort is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Fort is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Fort.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2015 Niko Rosvall <niko@ideabyte.net>
+ *
+ */
+
+#include <QtTest>
+#include <QElapsedTimer>
+#include <QDir>
+#include <QFile>
+#include <QThread>
+#include <botan/botan.h>
+#include "security.h"
+#include "itemcollection.h"
+#include "item.h"
+
+/* Thread scaling benchmarks of Security::encryptAll() and
+ * Security::decryptAll().
+ *
+ * A vault of ITEM_COUNT items is encrypted and decrypted with one
+ * thread, then with twice as many up to QThread::idealThreadCount().
+ * Benchmarks print items/s for every thread count. Encryption
+ * includes writing the item files, decryption includes reading them.
+ *
+ * HOME points to a directory of the test, so the default data path
+ * is used and no configuration file is needed.
+ */
+#define ITEM_COUNT 2000
+
+class SecurityTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void init();
+    void cleanupTestCase();
+    void roundTrip();
+    void benchmarkThreadScaling();
+
+private:
+    QString _home;
+    QString _hash;
+    Botan::LibraryInitializer *_botan;
+    void fillCollection(ItemCollection &collection, int count);
+    bool encrypt(int threads, int count, qint64 &nsecs);
+    bool decrypt(int threads, ItemCollection &collection, qint64 &nsecs);
+    static void removeTree(const QString &path);
+};
+
+/* Point HOME to an empty directory of the test.
+ */
+void SecurityTest::initTestCase()
+{
+    //Items are encrypted and decrypted on multiple threads.
+    _botan = new Botan::LibraryInitializer("thread_safe=true");
+    _hash = Security::createHashFromString("correct horse battery staple");
+
+    _home = QDir::tempPath() + QString("/fort-securitytest-%1").arg(QCoreApplication::applicationPid());
+    removeTree(_home);
+    QVERIFY(QDir().mkpath(_home));
+    qputenv("HOME", QFile::encodeName(_home));
+}
+
+/* Start every test with an empty data path.
+ */
+void SecurityTest::init()
+{
+    removeTree(_home + "/.fort");
+}
+
+/* Remove the directory of the test.
+ */
+void SecurityTest::cleanupTestCase()
+{
+    removeTree(_home);
+    delete _botan;
+}
+
+/* Items decrypted on several threads are the ones encrypted.
+ */
+void SecurityTest::roundTrip()
+{
+    qint64 nsecs;
+    ItemCollection collection;
+
+    QVERIFY(encrypt(4, 100, nsecs));
+    QVERIFY(decrypt(4, collection, nsecs));
+    QCOMPARE(collection.itemCount(), 100);
+
+    for(int i = 0; i < 100; i++)
+    {
+        Item item = collection.getItem(i);
+        QString number = item.getTitle().mid(QString("Account number ").length());
+
+        QCOMPARE(item.getTitle(), "Account number " + number);
+        QCOMPARE(item.getUser(), "user" + number + "@example.com");
+    }
+}
+
+/* Encrypt and decrypt the vault with 1, 2, 4... threads.
+ */
+void SecurityTest::benchmarkThreadScaling()
+{
+    QList<int> counts;
+    int ideal = qMax(1, QThread::idealThreadCount());
+
+    for(int threads = 1; threads < ideal; threads *= 2)
+        counts << threads;
+
+    counts << ideal;
+
+    foreach(int threads, counts)
+    {
+        qint64 encryptNsecs;
+        qint64 decryptNsecs;
+        ItemCollection collection;
+
+        removeTree(_home + "/.fort");
+
+        QVERIFY(encrypt(threads, ITEM_COUNT, encryptNsecs));
+        QVERIFY(decrypt(threads, collection, decryptNsecs));
+        QCOMPARE(collection.itemCount(), ITEM_COUNT);
+
+        qDebug("%d thread(s): encrypt %.0f items/s, decrypt %.0f items/s", threads,
+               ITEM_COUNT * 1e9 / qMax<qint64>(encryptNsecs, 1),
+               ITEM_COUNT * 1e9 / qMax<qint64>(decryptNsecs, 1));
+    }
+}
+
+/* Add count items to the collection.
+ */
+void SecurityTest::fillCollection(ItemCollection &collection, int count)
+{
+    for(int i = 0; i < count; i++)
+    {
+        Item item(QString("Account number %1").arg(i), QString("user%1@example.com").arg(i),
+                  QString("p4ssw0rd-%1").arg(i));
+
+        item.setUrl(QString("https://www.example%1.com/login").arg(i % 97));
+        item.setNotes(QString("Security question: pet %1\nAnswer: fish").arg(i));
+
+        collection.addItem(item);
+    }
+}
+
+/* Encrypt a vault of count items with the given number of threads.
+ */
+bool SecurityTest::encrypt(int threads, int count, qint64 &nsecs)
+{
+    Security security;
+    ItemCollection collection;
+    QElapsedTimer timer;
+
+    security.setMasterPassphraseHash(_hash);
+    security.setThreadCount(threads);
+    fillCollection(collection, count);
+
+    timer.start();
+    bool success = security.encryptAll(collection);
+    nsecs = timer.nsecsElapsed();
+
+    return success;
+}
+
+/* Decrypt the vault to a collection with the given number of threads.
+ */
+bool SecurityTest::decrypt(int threads, ItemCollection &collection, qint64 &nsecs)
+{
+    Security security;
+    QElapsedTimer timer;
+
+    security.setMasterPassphraseHash(_hash);
+    security.setThreadCount(threads);
+
+    timer.start();
+    bool success = security.decryptAll();
+    nsecs = timer.nsecsElapsed();
+
+    if(success)
+        security.loadUnlockedItems(collection);
+
+    return success;
+}
+
+/* Remove a directory and everything in it.
+ */
+void SecurityTest::removeTree(const QString &path)
+{
+    QDir dir(path);
+
+    foreach(QFileInfo entry, dir.entryInfoList(QDir::Files | QDir::Dirs | QDir::Hidden |
+                                               QDir::NoDotAndDotDot))
+    {
+        if(entry.isDir())
+            removeTree(entry.absoluteFilePath());
+        else
+            QFile::remove(entry.absoluteFilePath());
+    }
+
+    dir.rmdir(path);
+}
+
+QTEST_APPLESS_MAIN(SecurityTest)
+
+#include "tst_security.moc"
@@ -0,0 +1,43 @@
+#-------------------------------------------------
+#
+# Tests and memory benchmarks of the columnar item store.
+# Build and run with: qmake && make && ./storetest
+#
+#-------------------------------------------------
+
+QT       += core gui testlib
+
+greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
+
+TARGET = storetest
+CONFIG += console
+CONFIG -= app_bundle
+TEMPLATE = app
+
+INCLUDEPATH += ../..
+DEPENDPATH += ../..
+
+SOURCES += tst_store.cpp \
+    ../../itemstore.cpp \
+    ../../stringpool.cpp \
+    ../../itemcollection.cpp \
+    ../../searchengine.cpp \
+    ../../fuzzymatcher.cpp \
+    ../../item.cpp \
+    ../../itemcodec.cpp \
+    ../../secretcache.cpp \
+    ../../recordcipher.cpp \
+    ../../keyring.cpp
+
+HEADERS += ../../itemstore.h \
+    ../../stringpool.h \
+    ../../itemcollection.h \
+    ../../searchengine.h \
+    ../../fuzzymatcher.h \
+    ../../item.h \
+    ../../itemcodec.h \
+    ../../secretcache.h \
+    ../../recordcipher.h \
+    ../../keyring.h
+
+include(../botan.pri)
@@ -0,0 +1,185 @@
+/*
+ * This file is part of Fort.
+ *
+ * Fort is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Fort is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Fort.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2015 Niko Rosvall <niko@ideabyte.net>
+ *
+ */
+
+#include <QtTest>
+#include <QList>
+#include "itemstore.h"
+#include "itemcollection.h"
+#include "item.h"
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+/* Tests of ItemStore and a comparison of its memory use with
+ * the QList<Item> the collection used to keep.
+ *
+ * Benchmarks print heap bytes per item for ITEM_COUNT items.
+ * Users and url hosts repeat like in a real vault. The heap is
+ * measured with mallinfo(), so figures are printed with glibc only.
+ */
+#define ITEM_COUNT 100000
+
+class StoreTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void roundTrip();
+    void sharedStrings();
+    void benchmarkItemList();
+    void benchmarkItemStore();
+    void benchmarkItemCollection();
+
+private:
+    static QList<Item> createItems(int count);
+    static qint64 allocatedBytes();
+    static void report(const char *what, qint64 bytes);
+};
+
+/* Every field of an item survives the store.
+ */
+void StoreTest::roundTrip()
+{
+    QList<Item> items = createItems(3);
+    ItemStore store;
+
+    for(int i = 0; i < items.count(); i++)
+        store.insert(i, items.at(i));
+
+    QCOMPARE(store.count(), 3);
+
+    for(int i = 0; i < items.count(); i++)
+    {
+        Item item = store.item(i);
+
+        QCOMPARE(item.getTitle(), items.at(i).getTitle());
+        QCOMPARE(item.getUser(), items.at(i).getUser());
+        QCOMPARE(item.getUrl(), items.at(i).getUrl());
+        QCOMPARE(item.getID(), items.at(i).getID());
+        QCOMPARE(item.getIsFavorite(), items.at(i).getIsFavorite());
+        QCOMPARE(store.view(i).getTitle(), items.at(i).getTitle());
+    }
+}
+
+/* Equal users share one interned string.
+ */
+void StoreTest::sharedStrings()
+{
+    QList<Item> items = createItems(100);
+    ItemStore store;
+
+    for(int i = 0; i < items.count(); i++)
+        store.insert(i, items.at(i));
+
+    store.remove(0);
+
+    QCOMPARE(store.count(), 99);
+    QCOMPARE(store.user(49), items.at(50).getUser());
+    QCOMPARE(store.url(98), items.at(99).getUrl());
+}
+
+/* Items kept in a list, as the collection did before.
+ */
+void StoreTest::benchmarkItemList()
+{
+    qint64 before = allocatedBytes();
+    QList<Item> items = createItems(ITEM_COUNT);
+
+    report("QList<Item>", allocatedBytes() - before);
+}
+
+/* Items kept in the columns of a store.
+ */
+void StoreTest::benchmarkItemStore()
+{
+    qint64 before = allocatedBytes();
+    ItemStore store;
+
+    {
+        QList<Item> items = createItems(ITEM_COUNT);
+
+        for(int i = 0; i < items.count(); i++)
+            store.insert(i, items.at(i));
+    }
+
+    QCOMPARE(store.count(), ITEM_COUNT);
+    report("ItemStore", allocatedBytes() - before);
+}
+
+/* Items loaded to a collection, its indexes and search included.
+ */
+void StoreTest::benchmarkItemCollection()
+{
+    qint64 before = allocatedBytes();
+    ItemCollection collection;
+
+    collection.loadItems(createItems(ITEM_COUNT));
+
+    QCOMPARE(collection.itemCount(), ITEM_COUNT);
+    report("ItemCollection", allocatedBytes() - before);
+}
+
+/* Create count items. Users repeat every 50 items and
+ * url hosts every 97, titles are unique.
+ */
+QList<Item> StoreTest::createItems(int count)
+{
+    QList<Item> items;
+
+    for(int i = 0; i < count; i++)
+    {
+        Item item(QString("Account number %1").arg(i), QString("user%1@example.com").arg(i % 50),
+                  QString("p4ssw0rd-%1").arg(i));
+
+        item.setUrl(QString("https://www.example%1.com/login").arg(i % 97));
+        item.setNotes(QString("Security question: pet %1\nAnswer: fish").arg(i));
+        item.setFavorite(i % 10 == 0);
+
+        items << item;
+    }
+
+    return items;
+}
+
+/* Bytes allocated from the heap, -1 if unknown.
+ */
+qint64 StoreTest::allocatedBytes()
+{
+#if defined(__GLIBC__)
+    struct mallinfo info = mallinfo();
+
+    return qint64(unsigned(info.uordblks)) + qint64(unsigned(info.hblkhd));
+#else
+    return -1;
+#endif
+}
+
+void StoreTest::report(const char *what, qint64 bytes)
+{
+    if(allocatedBytes() < 0)
+        qDebug("%s: heap use is not available", what);
+    else
+        qDebug("%s: %.1f bytes/item", what, double(bytes) / ITEM_COUNT);
+}
+
+QTEST_APPLESS_MAIN(StoreTest)
+
+#include "tst_store.moc"
@@ -0,0 +1,15 @@
+#-------------------------------------------------
+#
+# Tests and benchmarks, each a standalone QtTest program.
+# Build all with: qmake && make
+#
+#-------------------------------------------------
+
+TEMPLATE = subdirs
+
+SUBDIRS += journaltest \
+    codectest \
+    searchtest \
+    securitytest \
+    storetest \
+    layouttest
@@ -0,0 +1,409 @@
+/*
+ * This file is part of Fort.
+ *
+ * Fort is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Fort is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Fort.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2015 Niko Rosvall <niko@ideabyte.net>
+ *
+ */
+
+#include "vaultmigrator.h"
+#include <QFile>
+#include <QTextStream>
+#include <QStringList>
+#include <QHash>
+#include <QSet>
+#include <QMutexLocker>
+#include <QtAlgorithms>
+#include "environment.h"
+#include "vaultstorage.h"
+#include "recordcipher.h"
+#include "item.h"
+#include "itemcodec.h"
+
+/* Constructor. Records are upgraded with the current key
+ * of the ring, older keys are used to decrypt them.
+ */
+VaultMigrator::VaultMigrator(const KeyRing &keys, QMutex *storageMutex)
+    : _keys(keys), _storageMutex(storageMutex), _batchSize(500), _batchDelay(100),
+      _stopRequested(false), _complete(false)
+{
+    _progress.running = false;
+    _progress.totalRecords = 0;
+    _progress.processedRecords = 0;
+    _progress.upgradedRecords = 0;
+}
+
+/* Set how many records are processed in one batch.
+ */
+void VaultMigrator::setBatchSize(int size)
+{
+    _batchSize = qMax(1, size);
+}
+
+/* Set how long the thread sleeps between the batches.
+ */
+void VaultMigrator::setBatchDelay(int milliseconds)
+{
+    _batchDelay = qMax(0, milliseconds);
+}
+
+/* Ask the thread to stop after the current batch.
+ * Call wait() to block until it has stopped.
+ */
+void VaultMigrator::stop()
+{
+    QMutexLocker locker(&_stateMutex);
+    _stopRequested = true;
+}
+
+bool VaultMigrator::stopRequested()
+{
+    QMutexLocker locker(&_stateMutex);
+    return _stopRequested;
+}
+
+/* Returns true once every record is in
+ * the current format.
+ */
+bool VaultMigrator::isComplete()
+{
+    QMutexLocker locker(&_stateMutex);
+    return _complete;
+}
+
+/* Get the progress counters. Safe to call while
+ * the migration is running.
+ */
+MigrationProgress VaultMigrator::progress()
+{
+    QMutexLocker locker(&_stateMutex);
+    return _progress;
+}
+
+/* Migration sets _lastErrorMessage on failure.
+ * This method is used to access that message.
+ */
+QString VaultMigrator::getLastErrorMessage()
+{
+    QMutexLocker locker(&_stateMutex);
+    return _lastErrorMessage;
+}
+
+void VaultMigrator::fail(const QString &message)
+{
+    QMutexLocker locker(&_stateMutex);
+    _lastErrorMessage = message;
+    _progress.running = false;
+}
+
+/* Thread entry point.
+ */
+void VaultMigrator::run()
+{
+    int current = RecordCipher::currentFormat();
+    int format = 0;
+    int target = 0;
+    QString lastId;
+    QStringList ids;
+    RecordCipher cipher(_keys);
+    bool journaled = false;
+    QStringList pending;
+    bool complete = false;
+    int cursor = 0;
+
+    //Continue an interrupted sweep towards the same format
+    if(!readState(format, target, lastId))
+        format = 0;
+
+    if(!listRecords(ids, false))
+        return;
+
+    //Guids are sorted, so records removed meanwhile
+    //do not move the position of the rest
+    if(target == current)
+        cursor = qUpperBound(ids.begin(), ids.end(), lastId) - ids.begin();
+
+    {
+        QMutexLocker locker(&_stateMutex);
+        _progress.running = true;
+        _progress.totalRecords = ids.count();
+        _progress.processedRecords = cursor;
+    }
+
+    while(!stopRequested())
+    {
+        while(cursor < ids.count() && !stopRequested())
+        {
+            QStringList batch = ids.mid(cursor, _batchSize);
+            QHash<QString, QByteArray> records;
+
+            {
+                QMutexLocker locker(_storageMutex);
+                VaultStorage storage;
+
+                if(!storage.open())
+                {
+                    fail(storage.getLastErrorMessage());
+                    return;
+                }
+
+                foreach(QString id, batch)
+                {
+                    QByteArray record = storage.readRecord(id);
+                    QByteArray upgraded;
+
+                    //Removed since the sweep started or already written in the current format
+                    if(record.isEmpty() || RecordCipher::recordFormat(record) == current)
+                        continue;
+
+                    QString errorMessage;
+
+                    if(!upgrade(cipher, id, record, upgraded, errorMessage))
+                    {
+                        fail(errorMessage);
+                        return;
+                    }
+
+                    records.insert(id, upgraded);
+                }
+
+                //Batches of a packed vault are journaled and compacted once at the end
+                if(storage.isPacked())
+                {
+                    storage.setJournaled(true);
+                    journaled = journaled || !records.isEmpty();
+                }
+
+                if(!records.isEmpty() && !storage.commit(records, QSet<QString>()))
+                {
+                    fail(storage.getLastErrorMessage());
+                    return;
+                }
+            }
+
+            cursor += batch.count();
+            writeState(format, current, batch.last());
+
+            {
+                QMutexLocker locker(&_stateMutex);
+                _progress.processedRecords = qMin(_progress.processedRecords + batch.count(),
+                                                  _progress.totalRecords);
+                _progress.upgradedRecords += records.count();
+            }
+
+            if(cursor < ids.count())
+                msleep(_batchDelay);
+        }
+
+        if(stopRequested())
+            break;
+
+        //The vault is marked migrated only once every stored
+        //record is known to be in the current format
+        if(!listRecords(ids, true))
+            return;
+
+        if(ids.isEmpty())
+        {
+            complete = true;
+            break;
+        }
+
+        //Same records left again, they can't be read
+        if(ids == pending)
+        {
+            fail("Unable to upgrade the remaining items.");
+            return;
+        }
+
+        pending = ids;
+        cursor = 0;
+    }
+
+    if(complete && journaled)
+    {
+        QMutexLocker locker(_storageMutex);
+        VaultStorage storage;
+
+        if(!storage.compact())
+        {
+            fail(storage.getLastErrorMessage());
+            return;
+        }
+    }
+
+    if(complete)
+        writeState(current, current, QString());
+
+    QMutexLocker locker(&_stateMutex);
+    _progress.running = false;
+    _complete = complete;
+}
+
+/* List the guids of the stored records, sorted. If pendingOnly is
+ * set, only records not in the current format are listed. Returns
+ * false on failure, the migration has then failed.
+ */
+bool VaultMigrator::listRecords(QStringList &ids, bool pendingOnly)
+{
+    QMutexLocker locker(_storageMutex);
+    VaultStorage storage;
+
+    ids.clear();
+
+    if(!storage.open())
+    {
+        fail(storage.getLastErrorMessage());
+        return false;
+    }
+
+    foreach(QString id, storage.recordIds())
+    {
+        if(!pendingOnly || RecordCipher::recordFormat(storage.readRecord(id)) !=
+                RecordCipher::currentFormat())
+            ids << id;
+    }
+
+    ids.sort();
+
+    return true;
+}
+
+/* Static method.
+ *
+ * Decrypt a record of any supported format with the key it was
+ * encrypted with and encrypt it again in the current format with
+ * the current key. Metadata is converted to the binary item format,
+ * sealed secrets in the text format are kept as they are readable.
+ *
+ * Returns false on failure, errorMessage is set then.
+ */
+bool VaultMigrator::upgrade(RecordCipher &cipher, const QString &id, const QByteArray &record,
+                            QByteArray &upgraded, QString &errorMessage)
+{
+    QByteArray meta;
+    QByteArray sealedSecrets;
+    QByteArray secrets;
+    bool decoded = true;
+
+    if(!cipher.openMeta(id, record, meta, sealedSecrets))
+    {
+        errorMessage = cipher.getLastErrorMessage();
+        return false;
+    }
+
+    if(sealedSecrets.isEmpty())
+    {
+        //Whole item is in the record, split it
+        Item item = ItemCodec::decodeItem(meta, &decoded);
+
+        meta.fill(0);
+        meta = ItemCodec::encodeMeta(item);
+        //Secrets of a whole item record are plain, encoding can't fail
+        ItemCodec::encodeSecrets(item, secrets);
+        item.wipe();
+    }
+    else
+    {
+        if(!cipher.openSecrets(id, sealedSecrets, secrets))
+        {
+            errorMessage = cipher.getLastErrorMessage();
+            meta.fill(0);
+            return false;
+        }
+
+        if(!ItemCodec::isBinary(meta))
+        {
+            Item item = ItemCodec::decodeMeta(meta, &decoded);
+
+            meta.fill(0);
+            meta = ItemCodec::encodeMeta(item);
+        }
+    }
+
+    if(!decoded)
+    {
+        errorMessage = "Unable to decode the item " + id + ". Corrupted data?";
+        meta.fill(0);
+        secrets.fill(0);
+        return false;
+    }
+
+    bool success = cipher.seal(id, meta, secrets, upgraded);
+
+    if(!success)
+        errorMessage = cipher.getLastErrorMessage();
+
+    meta.fill(0);
+    secrets.fill(0);
+
+    return success;
+}
+
+/* Static method.
+ *
+ * Returns true if some records may not be in the current format.
+ * Only the persisted state is read, records are not looked at.
+ */
+bool VaultMigrator::isDue()
+{
+    int format;
+    int target;
+    QString lastId;
+
+    return !readState(format, target, lastId) || format != RecordCipher::currentFormat();
+}
+
+/* Static method.
+ *
+ * Read the persisted format state: the format every record has
+ * reached, the format being migrated to and the guid of the last
+ * record processed. Returns false if there is no state.
+ */
+bool VaultMigrator::readState(int &format, int &target, QString &lastId)
+{
+    QFile file(Environment::ensurePath() + FORT_FORMAT_FILE);
+
+    if(!file.open(QIODevice::ReadOnly | QIODevice::Text))
+        return false;
+
+    QTextStream in(&file);
+    QString line = in.readLine();
+    bool formatOk = false;
+    bool targetOk = false;
+
+    file.close();
+
+    if(line.count('$') < 2)
+        return false;
+
+    format = line.section('$', 0, 0).toInt(&formatOk);
+    target = line.section('$', 1, 1).toInt(&targetOk);
+    lastId = line.section('$', 2);
+
+    return formatOk && targetOk;
+}
+
+/* Static method.
+ *
+ * Persist the format state, see VaultMigrator::readState()
+ * File is replaced atomically, see Environment::replaceFile()
+ */
+bool VaultMigrator::writeState(int format, int target, const QString &lastId)
+{
+    QString line = QString("%1$%2$%3\n").arg(format).arg(target).arg(lastId);
+
+    return Environment::replaceFile(Environment::ensurePath() + FORT_FORMAT_FILE, line.toUtf8());
+}
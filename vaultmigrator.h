@@ -0,0 +1,93 @@
+/*
+ * This file is part of Fort.
+ *
+ * Fort is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Fort is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Fort.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2015 Niko Rosvall <niko@ideabyte.net>
+ *
+ */
+
+#ifndef VAULTMIGRATOR_H
+#define VAULTMIGRATOR_H
+
+#include <QThread>
+#include <QMutex>
+#include <QString>
+#include <QStringList>
+#include "keyring.h"
+
+class RecordCipher;
+
+/* Progress of a vault format migration.
+ */
+struct MigrationProgress
+{
+    bool running;
+    int totalRecords;
+    int processedRecords;
+    int upgradedRecords;
+};
+
+/* Upgrades stored records to the current format on a background thread.
+ *
+ * Records of any supported format are read on unlock and records written
+ * for any reason are written in the current format, so nothing has to be
+ * converted up front. The migrator sweeps the rest in batches sorted by
+ * guid, holding the storage mutex for each batch and sleeping between
+ * them. The format of a record is read from its header, records already
+ * in the current format are skipped without decrypting them.
+ *
+ * The format every record has reached, and the progress towards the
+ * current one, is persisted to fort.format after every batch. Checking
+ * whether a migration is due only reads that file. A final pass checks
+ * every record before the vault is marked migrated. Batches of a packed
+ * vault are journaled and the vault is rewritten once at the end.
+ */
+class VaultMigrator : public QThread
+{
+public:
+    VaultMigrator(const KeyRing &keys, QMutex *storageMutex);
+    void setBatchSize(int size);
+    void setBatchDelay(int milliseconds);
+    void stop();
+    bool isComplete();
+    MigrationProgress progress();
+    QString getLastErrorMessage();
+    static bool isDue();
+    static bool upgrade(RecordCipher &cipher, const QString &id, const QByteArray &record,
+                        QByteArray &upgraded, QString &errorMessage);
+    static bool readState(int &format, int &target, QString &lastId);
+    static bool writeState(int format, int target, const QString &lastId);
+
+protected:
+    void run();
+
+private:
+    KeyRing _keys;
+    QMutex *_storageMutex;
+    QMutex _stateMutex;
+    int _batchSize;
+    int _batchDelay;
+    bool _stopRequested;
+    bool _complete;
+    MigrationProgress _progress;
+    QString _lastErrorMessage;
+    bool listRecords(QStringList &ids, bool pendingOnly);
+    bool stopRequested();
+    void fail(const QString &message);
+
+    Q_DISABLE_COPY(VaultMigrator)
+};
+
+#endif // VAULTMIGRATOR_H
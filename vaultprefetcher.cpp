@@ -0,0 +1,77 @@
+/*
+ * This file is part of Fort.
+ *
+ * Fort is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Fort is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Fort.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2015 Niko Rosvall <niko@ideabyte.net>
+ *
+ */
+
+#include "vaultprefetcher.h"
+#include <QFile>
+#include <QTextStream>
+#include "environment.h"
+
+/* Constructor.
+ */
+VaultPrefetcher::VaultPrefetcher() : _ready(false), _hasLegacyIV(false)
+{
+}
+
+/* Thread entry point.
+ */
+void VaultPrefetcher::run()
+{
+    QFile ivFile(Environment::ensurePath() + FORT_IV_FILE);
+
+    if(ivFile.open(QIODevice::ReadOnly | QIODevice::Text))
+    {
+        QTextStream in(&ivFile);
+        _legacyIV = in.readAll();
+        _hasLegacyIV = true;
+        ivFile.close();
+    }
+
+    _ready = _storage.open() && _storage.preload();
+}
+
+/* Returns true if all records were read. Only valid
+ * once the thread has finished.
+ */
+bool VaultPrefetcher::isReady()
+{
+    return isFinished() && _ready;
+}
+
+/* Get the storage holding the prefetched records.
+ * Only valid if isReady() returns true.
+ */
+VaultStorage *VaultPrefetcher::storage()
+{
+    return &_storage;
+}
+
+/* Returns true if fort.iv was found.
+ */
+bool VaultPrefetcher::hasLegacyIV()
+{
+    return _hasLegacyIV;
+}
+
+/* Get the contents of fort.iv.
+ */
+QString VaultPrefetcher::legacyIV()
+{
+    return _legacyIV;
+}
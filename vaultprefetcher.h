@@ -0,0 +1,56 @@
+/*
+ * This file is part of Fort.
+ *
+ * Fort is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Fort is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Fort.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2015 Niko Rosvall <niko@ideabyte.net>
+ *
+ */
+
+#ifndef VAULTPREFETCHER_H
+#define VAULTPREFETCHER_H
+
+#include <QThread>
+#include <QString>
+#include "vaultstorage.h"
+
+/* Reads all encrypted records and the initialization vector of older
+ * versions of Fort into memory on a background thread.
+ *
+ * Started when the login dialog is shown, so the disk reads overlap
+ * with the user typing the passphrase and decryption after OK is
+ * CPU bound. Records are ciphertext, they need no wiping.
+ */
+class VaultPrefetcher : public QThread
+{
+public:
+    VaultPrefetcher();
+    bool isReady();
+    VaultStorage *storage();
+    bool hasLegacyIV();
+    QString legacyIV();
+
+protected:
+    void run();
+
+private:
+    VaultStorage _storage;
+    bool _ready;
+    bool _hasLegacyIV;
+    QString _legacyIV;
+
+    Q_DISABLE_COPY(VaultPrefetcher)
+};
+
+#endif // VAULTPREFETCHER_H
@@ -0,0 +1,1106 @@
+/*
+ * This file is part of Fort.
+ *
+ * Fort is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Fort is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Fort.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2015 Niko Rosvall <niko@ideabyte.net>
+ *
+ */
+
+#include "vaultstorage.h"
+#include <QDir>
+#include <QFileInfo>
+#include <QDirIterator>
+#include <QCryptographicHash>
+#include <QList>
+#include <QPair>
+#include <QtEndian>
+#include <QStringList>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "environment.h"
+#include "settingsparser.h"
+
+/* Packed vault file layout, all integers are little endian:
+ *
+ * Header: magic "FVLT", quint32 version, quint32 record count, quint32 reserved
+ * Index:  for each record quint16 id length, id (latin1), quint64 offset, quint32 length
+ * Data:   records stored contiguously, offsets are from the start of the file
+ */
+#define VAULT_MAGIC "FVLT"
+#define VAULT_VERSION 1
+#define VAULT_HEADER_SIZE 16
+#define RECORD_FILE_SUFFIX ".plain.enc"
+
+/* Journal file layout, all integers are little endian:
+ *
+ * Header: magic "FJNL", quint32 version
+ * Entry:  quint8 type, quint16 id length, id (latin1), quint32 data length,
+ *         data, quint32 CRC-32 of the entry up to the checksum
+ *
+ * Version 1 journals have a quint16 qChecksum() instead of the CRC-32.
+ * They are still read and appended to until compaction removes them.
+ *
+ * Entries of one commit are followed by a commit entry, entries without
+ * one were torn by a crash and are ignored. Damage followed by a later
+ * commit is corruption, see VaultStorage::isJournalCorrupted()
+ */
+#define JOURNAL_MAGIC "FJNL"
+#define JOURNAL_VERSION 2
+#define JOURNAL_HEADER_SIZE 8
+#define JOURNAL_ENTRY_SIZE 7
+#define JOURNAL_PUT 1
+#define JOURNAL_REMOVE 2
+#define JOURNAL_COMMIT 3
+#define JOURNAL_COMPACT_SIZE (4 * 1024 * 1024)
+
+/* CRC-32 lookup table, the polynomial of zlib and PNG.
+ */
+struct Crc32Table
+{
+    quint32 entries[256];
+
+    Crc32Table()
+    {
+        for(quint32 i = 0; i < 256; i++)
+        {
+            quint32 c = i;
+
+            for(int k = 0; k < 8; k++)
+                c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+
+            entries[i] = c;
+        }
+    }
+};
+
+static const Crc32Table crc32Table;
+
+/* CRC-32 of length bytes of data.
+ */
+static quint32 crc32(const uchar *data, qint64 length)
+{
+    quint32 c = 0xffffffff;
+
+    for(qint64 i = 0; i < length; i++)
+        c = crc32Table.entries[(c ^ data[i]) & 0xff] ^ (c >> 8);
+
+    return c ^ 0xffffffff;
+}
+
+/* Size of the checksum of a journal entry in the given version.
+ */
+static int journalChecksumSize(quint32 version)
+{
+    return version == 1 ? 2 : 4;
+}
+
+/* Constructor. Read the wanted layout from the configuration file.
+ */
+VaultStorage::VaultStorage()
+{
+    SettingsParser parser;
+
+    _packed = parser.getBoolean("packedvault");
+    _sharded = parser.getBoolean("shardedvault");
+    _journaled = parser.getBoolean("journalvault");
+    _map = NULL;
+    _mapSize = 0;
+    _journalMap = NULL;
+    _journalSize = 0;
+    _journalVersion = JOURNAL_VERSION;
+}
+
+/* Deconstructor. Unmap the vault and journal files.
+ */
+VaultStorage::~VaultStorage()
+{
+    close();
+}
+
+/* Build the record index. The packed vault file is mapped to memory
+ * and only its index is parsed, record data is paged in when read.
+ * Per item files, flat and sharded, are listed without reading them.
+ *
+ * If a record exists in several layouts, the copy in the wanted layout
+ * is used as commit() writes it first. The journal is replayed last,
+ * its records replace the ones of all the layouts.
+ *
+ * Returns false if the vault or the journal file exists but can't be read.
+ */
+bool VaultStorage::open()
+{
+    close();
+
+    _path = Environment::ensurePath();
+
+    QHash<QString, Location> flat;
+    QHash<QString, Location> sharded;
+
+    listRecordFiles(RecordFile, flat);
+    listRecordFiles(ShardFile, sharded);
+
+    if(!_packed)
+    {
+        _index = _sharded ? sharded : flat;
+        mergeIndex(_sharded ? flat : sharded);
+    }
+
+    if(!mapVaultFile())
+        return false;
+
+    if(_packed)
+    {
+        mergeIndex(flat);
+        mergeIndex(sharded);
+    }
+
+    return mapJournalFile();
+}
+
+/* List item files of the flat or the sharded layout.
+ */
+void VaultStorage::listRecordFiles(Source source, QHash<QString, Location> &files)
+{
+    QStringList filters;
+    filters << QString("*") + RECORD_FILE_SUFFIX;
+
+    QDirIterator::IteratorFlags flags = QDirIterator::NoIteratorFlags;
+    QString path = _path;
+
+    if(source == ShardFile)
+    {
+        path += FORT_SHARD_DIR;
+        flags = QDirIterator::Subdirectories;
+    }
+
+    QDirIterator entries(path, filters, QDir::Files | QDir::NoDotAndDotDot, flags);
+
+    while(entries.hasNext())
+    {
+        entries.next();
+
+        QString id = entries.fileName();
+        id.chop(strlen(RECORD_FILE_SUFFIX));
+
+        Location location;
+        location.offset = 0;
+        location.length = entries.fileInfo().size();
+        location.source = source;
+
+        files.insert(id, location);
+    }
+}
+
+/* Add records to _index which are not found in it already.
+ */
+void VaultStorage::mergeIndex(const QHash<QString, Location> &locations)
+{
+    QHash<QString, Location>::const_iterator i;
+
+    for(i = locations.constBegin(); i != locations.constEnd(); ++i)
+        if(!_index.contains(i.key()))
+            _index.insert(i.key(), i.value());
+}
+
+/* Map the packed vault file, if it exists, and read its index.
+ * Records of the file are added to _index.
+ */
+bool VaultStorage::mapVaultFile()
+{
+    _vaultFile.setFileName(_path + FORT_VAULT_FILE);
+
+    if(!_vaultFile.exists())
+        return true;
+
+    if(!_vaultFile.open(QIODevice::ReadOnly))
+    {
+        _lastErrorMessage = "Unable to open the vault file.";
+        return false;
+    }
+
+    _mapSize = _vaultFile.size();
+
+    if(_mapSize >= VAULT_HEADER_SIZE)
+        _map = _vaultFile.map(0, _mapSize);
+
+    if(_map == NULL || memcmp(_map, VAULT_MAGIC, 4) != 0 ||
+            qFromLittleEndian<quint32>(_map + 4) != VAULT_VERSION)
+    {
+        _lastErrorMessage = "Vault file is corrupted or of unknown version.";
+        close();
+        return false;
+    }
+
+    quint32 count = qFromLittleEndian<quint32>(_map + 8);
+    quint32 parsed = 0;
+    const uchar *p = _map + VAULT_HEADER_SIZE;
+    const uchar *end = _map + _mapSize;
+
+    for(; parsed < count; parsed++)
+    {
+        if(end - p < 2)
+            break;
+
+        quint16 idLength = qFromLittleEndian<quint16>(p);
+        p += 2;
+
+        if(end - p < idLength + 12)
+            break;
+
+        QString id = QString::fromLatin1(reinterpret_cast<const char*>(p), idLength);
+        p += idLength;
+
+        Location location;
+        location.offset = qFromLittleEndian<quint64>(p);
+        location.length = qFromLittleEndian<quint32>(p + 8);
+        location.source = VaultFile;
+        p += 12;
+
+        if(location.offset < VAULT_HEADER_SIZE || location.offset + location.length > _mapSize)
+        {
+            _lastErrorMessage = "Vault file is corrupted.";
+            close();
+            return false;
+        }
+
+        if(!_index.contains(id))
+            _index.insert(id, location);
+    }
+
+    if(parsed != count)
+    {
+        _lastErrorMessage = "Vault file is corrupted.";
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+/* Map the journal file, if it exists, and replay its committed
+ * entries on top of _index. Removed records are collected to
+ * _journalRemoved, so a snapshot can delete their item files.
+ *
+ * A torn tail is not an error, _journalSize is set to the end
+ * of the last complete commit and later appends overwrite the rest.
+ * Damage before a complete commit is reported and nothing is cut.
+ */
+bool VaultStorage::mapJournalFile()
+{
+    _journalFile.setFileName(_path + FORT_JOURNAL_FILE);
+
+    if(!_journalFile.exists())
+        return true;
+
+    if(!_journalFile.open(QIODevice::ReadOnly))
+    {
+        _lastErrorMessage = "Unable to open the journal file.";
+        return false;
+    }
+
+    qint64 size = _journalFile.size();
+
+    //Crashed while writing the header
+    if(size < JOURNAL_HEADER_SIZE)
+        return true;
+
+    _journalMap = _journalFile.map(0, size);
+
+    if(_journalMap != NULL)
+        _journalVersion = qFromLittleEndian<quint32>(_journalMap + 4);
+
+    if(_journalMap == NULL || memcmp(_journalMap, JOURNAL_MAGIC, 4) != 0 ||
+            _journalVersion < 1 || _journalVersion > JOURNAL_VERSION)
+    {
+        _lastErrorMessage = "Journal file is corrupted or of unknown version.";
+        close();
+        return false;
+    }
+
+    QList<QPair<QString, Location> > pending;
+    const uchar *start = _journalMap + JOURNAL_HEADER_SIZE;
+    const uchar *p = start;
+    const uchar *end = _journalMap + size;
+
+    _journalSize = JOURNAL_HEADER_SIZE;
+
+    while(p < end)
+    {
+        qint64 entrySize = journalEntrySize(p, end, _journalVersion);
+
+        if(entrySize < 0)
+        {
+            if(isJournalCorrupted(p, end, _journalVersion))
+            {
+                _lastErrorMessage = "Journal file is corrupted.";
+                close();
+                return false;
+            }
+
+            break;
+        }
+
+        quint8 type = *p;
+        quint16 idLength = qFromLittleEndian<quint16>(p + 1);
+        quint32 length = qFromLittleEndian<quint32>(p + 3 + idLength);
+
+        if(type == JOURNAL_COMMIT)
+        {
+            for(int i = 0; i < pending.count(); i++)
+            {
+                const QString &id = pending[i].first;
+
+                if(pending[i].second.length >= 0)
+                {
+                    _index.insert(id, pending[i].second);
+                    _journalRemoved.remove(id);
+                }
+                else
+                {
+                    _index.remove(id);
+                    _journalRemoved << id;
+                }
+            }
+
+            pending.clear();
+            _journalSize = p + entrySize - _journalMap;
+        }
+        else if(type == JOURNAL_PUT || type == JOURNAL_REMOVE)
+        {
+            Location location;
+            location.offset = p + 7 + idLength - _journalMap;
+            location.length = type == JOURNAL_PUT ? (qint64)length : -1;
+            location.source = JournalFile;
+
+            pending << qMakePair(QString::fromLatin1(reinterpret_cast<const char*>(p + 3), idLength),
+                                 location);
+        }
+
+        p += entrySize;
+    }
+
+    return true;
+}
+
+/* Returns the size of the journal entry at p if it is complete,
+ * of a known type and passes its checksum, otherwise -1.
+ */
+qint64 VaultStorage::journalEntrySize(const uchar *p, const uchar *end, quint32 version)
+{
+    int checksumSize = journalChecksumSize(version);
+
+    if(end - p < JOURNAL_ENTRY_SIZE + checksumSize)
+        return -1;
+
+    quint8 type = *p;
+    quint16 idLength = qFromLittleEndian<quint16>(p + 1);
+
+    if(type != JOURNAL_PUT && type != JOURNAL_REMOVE && type != JOURNAL_COMMIT)
+        return -1;
+
+    if(end - p < JOURNAL_ENTRY_SIZE + checksumSize + idLength)
+        return -1;
+
+    quint32 length = qFromLittleEndian<quint32>(p + 3 + idLength);
+    qint64 entrySize = JOURNAL_ENTRY_SIZE + checksumSize + idLength + (qint64)length;
+
+    if(end - p < entrySize)
+        return -1;
+
+    const uchar *checksum = p + entrySize - checksumSize;
+
+    if(version == 1)
+    {
+        if(qChecksum(reinterpret_cast<const char*>(p), (uint)(entrySize - 2)) !=
+                qFromLittleEndian<quint16>(checksum))
+            return -1;
+    }
+    else if(crc32(p, entrySize - 4) != qFromLittleEndian<quint32>(checksum))
+    {
+        return -1;
+    }
+
+    return entrySize;
+}
+
+/* Returns true if the journal entry at bad, which failed to parse,
+ * is corruption of a commit that was synced to disk rather than the
+ * torn tail of a crash.
+ *
+ * A commit is appended only after the one before it is synced, so
+ * only the last commit can be torn. The entry belongs to an earlier
+ * commit if anything follows the first commit entry after it, or if
+ * it is a damaged commit entry followed by a complete commit.
+ */
+bool VaultStorage::isJournalCorrupted(const uchar *bad, const uchar *end, quint32 version)
+{
+    QByteArray commit;
+    appendJournalEntry(commit, JOURNAL_COMMIT, QString(), QByteArray(), version);
+
+    QByteArray rest = QByteArray::fromRawData(reinterpret_cast<const char*>(bad), end - bad);
+    int next = rest.indexOf(commit, 1);
+
+    if(next >= 0 && next + commit.length() < rest.length())
+        return true;
+
+    //A damaged commit entry has the size of an intact one
+    const uchar *p = bad + commit.length();
+
+    while(p < end)
+    {
+        qint64 entrySize = journalEntrySize(p, end, version);
+
+        if(entrySize < 0)
+            return false;
+
+        if(*p == JOURNAL_COMMIT)
+            return true;
+
+        p += entrySize;
+    }
+
+    return false;
+}
+
+/* Unmap the vault and journal files and forget the record index.
+ */
+void VaultStorage::close()
+{
+    if(_map != NULL)
+        _vaultFile.unmap(_map);
+
+    if(_vaultFile.isOpen())
+        _vaultFile.close();
+
+    if(_journalMap != NULL)
+        _journalFile.unmap(_journalMap);
+
+    if(_journalFile.isOpen())
+        _journalFile.close();
+
+    _map = NULL;
+    _mapSize = 0;
+    _journalMap = NULL;
+    _journalSize = 0;
+    _journalVersion = JOURNAL_VERSION;
+    _journalRemoved.clear();
+    _index.clear();
+    _preloaded.clear();
+}
+
+/* Returns true if records are written to the packed
+ * vault file, false if one file per item is used.
+ */
+bool VaultStorage::isPacked()
+{
+    return _packed;
+}
+
+/* Append commits to the journal regardless of the "journalvault"
+ * configuration property. Used for bulk writes to a packed vault,
+ * which are compacted once they are done, see VaultStorage::compact()
+ */
+void VaultStorage::setJournaled(bool journaled)
+{
+    _journaled = journaled;
+}
+
+/* Return guids of all the records found by open().
+ */
+QStringList VaultStorage::recordIds()
+{
+    return _index.keys();
+}
+
+/* Return true if open() found any records.
+ */
+bool VaultStorage::hasRecords()
+{
+    return !_index.isEmpty();
+}
+
+/* Return the encrypted record of an item.
+ *
+ * Records of the packed vault are not copied, the returned data points
+ * to the mapped file and is valid until the storage is closed.
+ * Method can be called from multiple threads at the same time.
+ *
+ * An empty array is returned if the record can't be read.
+ */
+QByteArray VaultStorage::readRecord(const QString &id)
+{
+    QHash<QString, QByteArray>::const_iterator preloaded = _preloaded.constFind(id);
+
+    if(preloaded != _preloaded.constEnd())
+        return preloaded.value();
+
+    QHash<QString, Location>::const_iterator i = _index.constFind(id);
+
+    if(i == _index.constEnd())
+        return QByteArray();
+
+    if(i.value().source == VaultFile)
+        return QByteArray::fromRawData(reinterpret_cast<const char*>(_map + i.value().offset),
+                                       i.value().length);
+
+    if(i.value().source == JournalFile)
+        return QByteArray::fromRawData(reinterpret_cast<const char*>(_journalMap + i.value().offset),
+                                       i.value().length);
+
+    QFile file(recordFilePath(id, i.value().source));
+    QByteArray data;
+
+    if(file.open(QIODevice::ReadOnly))
+    {
+        data = file.readAll();
+        file.close();
+    }
+
+    return data;
+}
+
+/* Read every record into memory, so later readRecord() calls
+ * do no disk access. Records of the packed vault file are copied
+ * out of the mapping, which pages the whole file in.
+ *
+ * Must not be called while other threads read records.
+ * Returns false if any of the records can't be read.
+ */
+bool VaultStorage::preload()
+{
+    QHash<QString, QByteArray> records;
+    QHash<QString, Location>::const_iterator i;
+
+    for(i = _index.constBegin(); i != _index.constEnd(); ++i)
+    {
+        QByteArray record = readRecord(i.key());
+
+        if(record.isEmpty())
+        {
+            _lastErrorMessage = "Unable to read the item.";
+            return false;
+        }
+
+        //Deep copy, raw data of the packed and journal files points into the mapping
+        records.insert(i.key(), QByteArray(record.constData(), record.length()));
+    }
+
+    _preloaded = records;
+
+    return true;
+}
+
+/* Write changed records and delete removed ones. Records are appended
+ * to the journal if it is enabled, otherwise they are written in the
+ * wanted layout, see VaultStorage::writeSnapshot()
+ *
+ * Storage is closed after the call. Returns true on success, on failure
+ * the last error message is set.
+ */
+bool VaultStorage::commit(const QHash<QString, QByteArray> &records, const QSet<QString> &removed)
+{
+    bool success;
+
+    if(_journaled)
+        success = (!_path.isEmpty() || open()) && appendJournal(records, removed);
+    else
+        success = writeSnapshot(records, removed);
+
+    close();
+
+    return success;
+}
+
+/* Returns true once the journal has grown large enough
+ * to be folded into the records, see VaultStorage::compact()
+ */
+bool VaultStorage::needsCompaction()
+{
+    return QFileInfo(Environment::ensurePath() + FORT_JOURNAL_FILE).size() >= JOURNAL_COMPACT_SIZE;
+}
+
+/* Returns true if records were found by open() outside of
+ * the wanted layout, see VaultStorage::compact()
+ */
+bool VaultStorage::needsConversion()
+{
+    Source wanted = _packed ? VaultFile : fileSource();
+    QHash<QString, Location>::const_iterator i;
+
+    for(i = _index.constBegin(); i != _index.constEnd(); ++i)
+    {
+        Source source = i.value().source;
+
+        if(source != wanted && !(source == JournalFile && _journaled))
+            return true;
+    }
+
+    return false;
+}
+
+/* Fold the journal and records found in the other layouts into
+ * the wanted layout. Journal is removed only after the records are
+ * written, replaying it again after a crash is harmless. Also used
+ * to convert a vault once the layout is changed.
+ *
+ * Storage is closed after the call. Returns true on success.
+ */
+bool VaultStorage::compact()
+{
+    bool success = open() && writeSnapshot(QHash<QString, QByteArray>(), QSet<QString>());
+
+    close();
+
+    return success;
+}
+
+/* Write changed records and delete removed ones in the wanted layout.
+ * Records found in the other layouts or in the journal are migrated to
+ * the wanted one and the journal is removed.
+ *
+ * The packed vault file is rewritten as a whole to a temporary file that
+ * replaces the old one, existing records are copied without decrypting them.
+ * Item files are written to temporary files, which are all synced before
+ * any of them is renamed. Directories of the renamed files are synced once
+ * the renames are done, before old copies and the journal are removed.
+ */
+bool VaultStorage::writeSnapshot(const QHash<QString, QByteArray> &records, const QSet<QString> &removed)
+{
+    bool success = true;
+    QHash<QString, Location>::const_iterator i;
+
+    if(_path.isEmpty())
+        _path = Environment::ensurePath();
+
+    //Item files of records removed in the journal are still on disk
+    QSet<QString> deleted = removed + _journalRemoved;
+
+    foreach(QString id, records.keys())
+        deleted.remove(id);
+
+    if(_packed)
+    {
+        QHash<QString, QByteArray> all = records;
+
+        for(i = _index.constBegin(); i != _index.constEnd(); ++i)
+        {
+            if(deleted.contains(i.key()) || records.contains(i.key()))
+                continue;
+
+            //Nothing is replaced or removed if a record can't be copied
+            QByteArray data = readRecord(i.key());
+
+            if(data.isEmpty())
+            {
+                _lastErrorMessage = "Unable to read the item " + i.key() + ". Disk or permission error?";
+                return false;
+            }
+
+            all.insert(i.key(), data);
+        }
+
+        success = writeVaultFile(all);
+
+        if(success && !syncDirectory(_path))
+        {
+            _lastErrorMessage = "Unable to write the vault file. Disk full or permission error?";
+            success = false;
+        }
+
+        //Records are now in the vault file, remove migrated item files
+        if(success)
+        {
+            for(i = _index.constBegin(); i != _index.constEnd(); ++i)
+                if(i.value().source == RecordFile || i.value().source == ShardFile)
+                    QFile::remove(recordFilePath(i.key(), i.value().source));
+
+            foreach(QString id, deleted)
+                removeRecordFiles(id);
+        }
+    }
+    else
+    {
+        QHash<QString, QByteArray>::const_iterator r;
+        QStringList written;
+
+        for(r = records.constBegin(); r != records.constEnd(); ++r)
+        {
+            success = writeRecordFile(r.key(), r.value()) && success;
+            written << r.key();
+        }
+
+        //Migrate records of the other layouts to item files
+        for(i = _index.constBegin(); i != _index.constEnd(); ++i)
+        {
+            if(i.value().source != fileSource() && !deleted.contains(i.key()) &&
+                    !records.contains(i.key()))
+            {
+                //Temporary files written so far are removed below, and the
+                //old layouts and the journal are left in place
+                QByteArray data = readRecord(i.key());
+
+                if(data.isEmpty())
+                {
+                    _lastErrorMessage = "Unable to read the item " + i.key() + ". Disk or permission error?";
+                    success = false;
+                    break;
+                }
+
+                success = writeRecordFile(i.key(), data) && success;
+                written << i.key();
+            }
+        }
+
+        //Barrier: every record is on disk before any replaces an old one
+        foreach(QString id, written)
+        {
+            if(!success)
+                break;
+
+            success = syncFile(recordFilePath(id, fileSource()) + ".tmp");
+        }
+
+        QSet<QString> directories;
+
+        foreach(QString id, written)
+        {
+            QString path = recordFilePath(id, fileSource());
+
+            if(!success || ::rename(QFile::encodeName(path + ".tmp").constData(),
+                                    QFile::encodeName(path).constData()) != 0)
+            {
+                QFile::remove(path + ".tmp");
+                success = false;
+            }
+
+            QString dir = QFileInfo(path).path();
+            directories << dir;
+
+            //Shard directories may be new, so their parents are synced too
+            if(_sharded)
+                directories << QFileInfo(dir).path() << _path + FORT_SHARD_DIR << _path;
+        }
+
+        //Renames are durable before old copies and the journal go away
+        foreach(QString dir, directories)
+        {
+            if(!success)
+                break;
+
+            success = syncDirectory(dir);
+        }
+
+        if(!success && _lastErrorMessage.isEmpty())
+            _lastErrorMessage = "Unable to write the item files. Disk full or permission error?";
+
+        if(success)
+        {
+            //Copies left in the other item file layout
+            for(i = _index.constBegin(); i != _index.constEnd(); ++i)
+            {
+                Source source = i.value().source;
+
+                if((source == RecordFile || source == ShardFile) && source != fileSource())
+                    QFile::remove(recordFilePath(i.key(), source));
+            }
+
+            foreach(QString id, deleted)
+                removeRecordFiles(id);
+        }
+
+        if(success && _vaultFile.exists())
+        {
+            close();
+            QFile::remove(_path + FORT_VAULT_FILE);
+        }
+    }
+
+    //Records of the journal are now in the snapshot
+    if(success && QFile::exists(_path + FORT_JOURNAL_FILE))
+    {
+        close();
+        QFile::remove(_path + FORT_JOURNAL_FILE);
+    }
+
+    return success;
+}
+
+/* Append records and removals to the journal followed by a commit
+ * entry and sync it to disk. Only the changes are written, existing
+ * records are not touched. A torn tail left by a crash is cut off
+ * first, see VaultStorage::mapJournalFile()
+ */
+bool VaultStorage::appendJournal(const QHash<QString, QByteArray> &records, const QSet<QString> &removed)
+{
+    QByteArray entries;
+    QHash<QString, QByteArray>::const_iterator r;
+    qint64 validSize = _journalSize;
+
+    //Entries are written in the version of an existing journal
+    quint32 version = validSize < JOURNAL_HEADER_SIZE ? JOURNAL_VERSION : _journalVersion;
+
+    for(r = records.constBegin(); r != records.constEnd(); ++r)
+        appendJournalEntry(entries, JOURNAL_PUT, r.key(), r.value(), version);
+
+    foreach(QString id, removed)
+        appendJournalEntry(entries, JOURNAL_REMOVE, id, QByteArray(), version);
+
+    appendJournalEntry(entries, JOURNAL_COMMIT, QString(), QByteArray(), version);
+
+    //Tail is rewritten, unmap it first
+    close();
+
+    QFile file(_path + FORT_JOURNAL_FILE);
+
+    if(!file.open(QIODevice::ReadWrite))
+    {
+        _lastErrorMessage = "Unable to write the journal file. Permission error?";
+        return false;
+    }
+
+    bool success;
+
+    if(validSize < JOURNAL_HEADER_SIZE)
+    {
+        uchar header[JOURNAL_HEADER_SIZE];
+        memcpy(header, JOURNAL_MAGIC, 4);
+        qToLittleEndian<quint32>(JOURNAL_VERSION, header + 4);
+
+        success = file.resize(0) &&
+                file.write(reinterpret_cast<const char*>(header), JOURNAL_HEADER_SIZE) == JOURNAL_HEADER_SIZE;
+    }
+    else
+    {
+        success = file.resize(validSize) && file.seek(validSize);
+    }
+
+    success = success && file.write(entries) == entries.length() &&
+            file.flush() && fsync(file.handle()) == 0;
+    file.close();
+
+    //A new journal file is durable only once its directory is synced
+    if(success && validSize < JOURNAL_HEADER_SIZE)
+        success = syncDirectory(_path);
+
+    if(!success)
+        _lastErrorMessage = "Unable to write the journal file. Disk full or permission error?";
+
+    return success;
+}
+
+/* Append one journal entry and its checksum of the given
+ * journal version to a buffer.
+ */
+void VaultStorage::appendJournalEntry(QByteArray &entries, int type, const QString &id,
+                                      const QByteArray &data, quint32 version)
+{
+    QByteArray idData = id.toLatin1();
+    int start = entries.length();
+    uchar field[4];
+
+    field[0] = type;
+    entries.append(reinterpret_cast<const char*>(field), 1);
+
+    qToLittleEndian<quint16>(idData.length(), field);
+    entries.append(reinterpret_cast<const char*>(field), 2);
+    entries.append(idData);
+
+    qToLittleEndian<quint32>(data.length(), field);
+    entries.append(reinterpret_cast<const char*>(field), 4);
+    entries.append(data);
+
+    if(version == 1)
+    {
+        qToLittleEndian<quint16>(qChecksum(entries.constData() + start, entries.length() - start), field);
+        entries.append(reinterpret_cast<const char*>(field), 2);
+    }
+    else
+    {
+        qToLittleEndian<quint32>(crc32(reinterpret_cast<const uchar*>(entries.constData()) + start,
+                                       entries.length() - start), field);
+        entries.append(reinterpret_cast<const char*>(field), 4);
+    }
+}
+
+/* Write all the records to a new vault file. The file is written to
+ * a temporary file and synced to disk before it replaces the old one,
+ * so a crash never leaves a partially written vault behind.
+ */
+bool VaultStorage::writeVaultFile(const QHash<QString, QByteArray> &records)
+{
+    QStringList ids = records.keys();
+    ids.sort();
+
+    qint64 offset = VAULT_HEADER_SIZE;
+
+    foreach(QString id, ids)
+        offset += 2 + id.length() + 12;
+
+    QByteArray header(VAULT_HEADER_SIZE, 0);
+    uchar *h = reinterpret_cast<uchar*>(header.data());
+    memcpy(h, VAULT_MAGIC, 4);
+    qToLittleEndian<quint32>(VAULT_VERSION, h + 4);
+    qToLittleEndian<quint32>(ids.count(), h + 8);
+
+    QByteArray index;
+    index.reserve(offset - VAULT_HEADER_SIZE);
+
+    foreach(QString id, ids)
+    {
+        QByteArray idData = id.toLatin1();
+        uchar entry[12];
+
+        qToLittleEndian<quint16>(idData.length(), entry);
+        index.append(reinterpret_cast<const char*>(entry), 2);
+        index.append(idData);
+
+        qToLittleEndian<quint64>(offset, entry);
+        qToLittleEndian<quint32>(records.value(id).length(), entry + 8);
+        index.append(reinterpret_cast<const char*>(entry), 12);
+
+        offset += records.value(id).length();
+    }
+
+    QString vaultPath = _path + FORT_VAULT_FILE;
+    QString tmpPath = vaultPath + ".tmp";
+    QFile file(tmpPath);
+
+    if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        _lastErrorMessage = "Unable to write the vault file. Permission error?";
+        return false;
+    }
+
+    bool success = file.write(header) == header.length() &&
+            file.write(index) == index.length();
+
+    foreach(QString id, ids)
+    {
+        if(!success)
+            break;
+
+        const QByteArray &data = records.value(id);
+        success = file.write(data) == data.length();
+    }
+
+    success = success && file.flush() && fsync(file.handle()) == 0;
+    file.close();
+
+    if(!success || ::rename(QFile::encodeName(tmpPath).constData(),
+                          QFile::encodeName(vaultPath).constData()) != 0)
+    {
+        QFile::remove(tmpPath);
+        _lastErrorMessage = "Unable to write the vault file. Disk full or permission error?";
+        return false;
+    }
+
+    return true;
+}
+
+/* Write one record to a temporary file next to its item file.
+ * Temporary file replaces the item file once all the records of
+ * a commit are synced, see VaultStorage::commit()
+ */
+bool VaultStorage::writeRecordFile(const QString &id, const QByteArray &data)
+{
+    QString path = recordFilePath(id, fileSource());
+
+    if(_sharded)
+        QDir().mkpath(QFileInfo(path).path());
+
+    QFile file(path + ".tmp");
+
+    if(file.open(QIODevice::WriteOnly | QIODevice::Truncate) &&
+            file.write(data) == data.length())
+    {
+        file.close();
+        return true;
+    }
+
+    _lastErrorMessage = "Unable to write the item file. Permission error?";
+
+    return false;
+}
+
+/* Flush a written file to disk.
+ */
+bool VaultStorage::syncFile(const QString &path)
+{
+    QFile file(path);
+
+    if(!file.open(QIODevice::ReadOnly))
+        return false;
+
+    bool success = fsync(file.handle()) == 0;
+    file.close();
+
+    return success;
+}
+
+/* Flush the entries of a directory, such as renamed files,
+ * to disk.
+ */
+bool VaultStorage::syncDirectory(const QString &path)
+{
+    int fd = ::open(QFile::encodeName(path).constData(), O_RDONLY);
+
+    if(fd < 0)
+        return false;
+
+    bool success = fsync(fd) == 0;
+    ::close(fd);
+
+    return success;
+}
+
+/* Delete the item files of a record in both item file layouts.
+ */
+void VaultStorage::removeRecordFiles(const QString &id)
+{
+    QFile::remove(recordFilePath(id, RecordFile));
+    QFile::remove(recordFilePath(id, ShardFile));
+}
+
+/* Return the item file layout records are written in.
+ */
+VaultStorage::Source VaultStorage::fileSource()
+{
+    return _sharded ? ShardFile : RecordFile;
+}
+
+/* Return the path of the item file of a record in the flat
+ * or the sharded layout. Sharded files are placed by the
+ * first two bytes of the MD5 hash of the guid.
+ */
+QString VaultStorage::recordFilePath(const QString &id, Source source)
+{
+    if(source != ShardFile)
+        return _path + id + RECORD_FILE_SUFFIX;
+
+    QByteArray hash = QCryptographicHash::hash(id.toUtf8(), QCryptographicHash::Md5).toHex();
+
+    return _path + FORT_SHARD_DIR + "/" + QString::fromLatin1(hash.constData(), 2) + "/" +
+           QString::fromLatin1(hash.constData() + 2, 2) + "/" + id + RECORD_FILE_SUFFIX;
+}
+
+/* VaultStorage methods set _lastErrorMessage on failure.
+ * This method is used to access that message.
+ */
+QString VaultStorage::getLastErrorMessage()
+{
+    return _lastErrorMessage;
+}
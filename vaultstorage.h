@@ -0,0 +1,116 @@
+/*
+ * This file is part of Fort.
+ *
+ * Fort is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Fort is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Fort.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2015 Niko Rosvall <niko@ideabyte.net>
+ *
+ */
+
+#ifndef VAULTSTORAGE_H
+#define VAULTSTORAGE_H
+
+#include <QString>
+#include <QStringList>
+#include <QHash>
+#include <QSet>
+#include <QFile>
+#include <QByteArray>
+
+/* Encrypted item records are stored either one file per item
+ * (<guid>.plain.enc) or packed into a single vault file.
+ *
+ * If the "shardedvault" configuration property is set, item files are
+ * spread to records/xx/yy/ subdirectories by a hash of the guid, so no
+ * directory holds more than a few files even in very large vaults.
+ *
+ * All layouts are always readable. Records are written in the
+ * layout selected by the "packedvault" configuration property and
+ * records found in the other layouts are migrated on commit.
+ *
+ * If the "journalvault" configuration property is set, commits are
+ * appended to a journal file instead and the journal is replayed on
+ * top of the records on open. compact() folds the journal back into
+ * the selected layout.
+ */
+class VaultStorage
+{
+public:
+    VaultStorage();
+    ~VaultStorage();
+    bool open();
+    void close();
+    bool isPacked();
+    void setJournaled(bool journaled);
+    QStringList recordIds();
+    bool hasRecords();
+    QByteArray readRecord(const QString &id);
+    bool preload();
+    bool commit(const QHash<QString, QByteArray> &records, const QSet<QString> &removed);
+    bool needsCompaction();
+    bool compact();
+    bool needsConversion();
+    QString getLastErrorMessage();
+
+private:
+    enum Source
+    {
+        RecordFile,
+        ShardFile,
+        VaultFile,
+        JournalFile
+    };
+
+    struct Location
+    {
+        qint64 offset;
+        qint64 length;
+        Source source;
+    };
+
+    QString _path;
+    bool _packed;
+    bool _sharded;
+    bool _journaled;
+    QFile _vaultFile;
+    uchar *_map;
+    qint64 _mapSize;
+    QFile _journalFile;
+    uchar *_journalMap;
+    qint64 _journalSize;
+    quint32 _journalVersion;
+    QSet<QString> _journalRemoved;
+    QHash<QString, Location> _index;
+    QHash<QString, QByteArray> _preloaded;
+    QString _lastErrorMessage;
+    void listRecordFiles(Source source, QHash<QString, Location> &files);
+    void mergeIndex(const QHash<QString, Location> &locations);
+    bool mapVaultFile();
+    bool mapJournalFile();
+    static qint64 journalEntrySize(const uchar *p, const uchar *end, quint32 version);
+    static bool isJournalCorrupted(const uchar *bad, const uchar *end, quint32 version);
+    bool writeSnapshot(const QHash<QString, QByteArray> &records, const QSet<QString> &removed);
+    bool writeVaultFile(const QHash<QString, QByteArray> &records);
+    bool appendJournal(const QHash<QString, QByteArray> &records, const QSet<QString> &removed);
+    static void appendJournalEntry(QByteArray &entries, int type, const QString &id,
+                                   const QByteArray &data, quint32 version);
+    bool writeRecordFile(const QString &id, const QByteArray &data);
+    bool syncFile(const QString &path);
+    bool syncDirectory(const QString &path);
+    void removeRecordFiles(const QString &id);
+    Source fileSource();
+    QString recordFilePath(const QString &id, Source source);
+};
+
+#endif // VAULTSTORAGE_H
@@ -0,0 +1,282 @@
+/*
+ * This file is part of Fort.
+ *
+ * Fort is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Fort is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Fort.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2015 Niko Rosvall <niko@ideabyte.net>
+ *
+ */
+
+#include "writebehind.h"
+#include <QMutexLocker>
+#include "vaultstorage.h"
+
+/* Constructor. Thread is started by the caller.
+ */
+WriteBehind::WriteBehind(QMutex *storageMutex)
+    : _storageMutex(storageMutex), _inFlight(false), _inFlightCount(0), _failed(false),
+      _compactFailed(false), _retry(false), _stopRequested(false), _compactRequested(false), _requested(0),
+      _completed(0), _delay(200),
+      _lastFlushMs(0)
+{
+}
+
+/* Queue records to be written and guids of records to be
+ * removed. Queued data of the same guids is replaced.
+ */
+void WriteBehind::enqueue(const QHash<QString, QByteArray> &records, const QSet<QString> &removed)
+{
+    QMutexLocker locker(&_mutex);
+
+    if(isEmpty())
+        _oldestPending.start();
+
+    QHash<QString, QByteArray>::const_iterator i;
+
+    for(i = records.constBegin(); i != records.constEnd(); ++i)
+    {
+        _removed.remove(i.key());
+        _records.insert(i.key(), i.value());
+    }
+
+    foreach(QString id, removed)
+    {
+        _records.remove(id);
+        _removed << id;
+    }
+
+    _retry = true;
+    _wake.wakeOne();
+}
+
+/* Wait until everything queued is written. A compaction asked
+ * for is done as well, so none is left to run after the caller
+ * goes on, e.g. locks. Returns false if committing records failed,
+ * see WriteBehind::getLastErrorMessage()
+ */
+bool WriteBehind::flush()
+{
+    QMutexLocker locker(&_mutex);
+
+    if(isEmpty() && !_inFlight && !_compactRequested)
+        return !_failed;
+
+    int ticket = ++_requested;
+    _retry = true;
+    _wake.wakeOne();
+
+    while(_completed < ticket)
+        _flushed.wait(&_mutex);
+
+    return !_failed && isEmpty();
+}
+
+/* Set how long the thread waits for more changes
+ * before writing.
+ */
+void WriteBehind::setDelay(int milliseconds)
+{
+    QMutexLocker locker(&_mutex);
+    _delay = qMax(0, milliseconds);
+}
+
+/* Ask the thread to convert the storage to the wanted layout,
+ * see VaultStorage::compact(). Done with the next write, or
+ * after the delay if nothing is queued.
+ */
+void WriteBehind::compactLater()
+{
+    QMutexLocker locker(&_mutex);
+    _compactRequested = true;
+    _retry = true;
+    _wake.wakeOne();
+}
+
+/* Stop the thread and wait for it to finish. Records
+ * not flushed are dropped.
+ */
+void WriteBehind::stop()
+{
+    {
+        QMutexLocker locker(&_mutex);
+        _stopRequested = true;
+        _wake.wakeOne();
+    }
+
+    wait();
+}
+
+/* Get the state of the queue.
+ */
+WriteBehindStatus WriteBehind::status()
+{
+    QMutexLocker locker(&_mutex);
+    WriteBehindStatus status;
+
+    status.queueDepth = _records.count() + _removed.count() + _inFlightCount;
+    status.oldestPendingMs = status.queueDepth > 0 ? _oldestPending.elapsed() : 0;
+    status.lastFlushMs = _lastFlushMs;
+    status.failed = _failed;
+    status.compactionFailed = _compactFailed;
+
+    return status;
+}
+
+/* Returns the error of the last failed write.
+ */
+QString WriteBehind::getLastErrorMessage()
+{
+    QMutexLocker locker(&_mutex);
+    return _lastErrorMessage;
+}
+
+/* Write the queue whenever there are changes. Changes which
+ * arrive before the delay has passed are written together.
+ * After a failure, the queue is written again only once
+ * something is queued or a flush is requested.
+ */
+void WriteBehind::run()
+{
+    QMutexLocker locker(&_mutex);
+
+    forever
+    {
+        while(!_stopRequested && _requested == _completed &&
+              ((_failed && !_retry) || (isEmpty() && !_compactRequested)))
+            _wake.wait(&_mutex);
+
+        if(_stopRequested)
+            break;
+
+        //Wait until the delay has passed since the first change, every
+        //enqueue wakes the thread up. Flush requests do not wait.
+        QElapsedTimer delayTimer;
+        delayTimer.start();
+        qint64 remaining = _delay;
+
+        while(!_stopRequested && _requested == _completed && remaining > 0)
+        {
+            _wake.wait(&_mutex, remaining);
+            remaining = _delay - delayTimer.elapsed();
+        }
+
+        if(_stopRequested)
+            break;
+
+        int ticket = _requested;
+        bool compact = _compactRequested;
+        QHash<QString, QByteArray> records = _records;
+        QSet<QString> removed = _removed;
+
+        _records.clear();
+        _removed.clear();
+        _inFlight = true;
+        _inFlightCount = records.count() + removed.count();
+        _retry = false;
+        _compactRequested = false;
+
+        bool success = true;
+        bool compacted = true;
+        QElapsedTimer timer;
+        timer.start();
+
+        if(_inFlightCount > 0 || compact)
+        {
+            locker.unlock();
+            success = write(records, removed, compact, compacted);
+            locker.relock();
+        }
+
+        _inFlight = false;
+        _inFlightCount = 0;
+        _failed = !success;
+
+        //A compaction not reached because committing failed is tried
+        //again with the records. A failed one is dropped, it is asked
+        //for again on the next unlock or once the journal grows.
+        if(success)
+            _compactFailed = !compacted;
+        else if(compact)
+            _compactRequested = true;
+
+        if(success)
+        {
+            _lastFlushMs = timer.elapsed();
+        }
+        else
+        {
+            //Keep what failed unless something newer was queued
+            QHash<QString, QByteArray>::const_iterator i;
+
+            for(i = records.constBegin(); i != records.constEnd(); ++i)
+            {
+                if(!_records.contains(i.key()) && !_removed.contains(i.key()))
+                    _records.insert(i.key(), i.value());
+            }
+
+            foreach(QString id, removed)
+            {
+                if(!_records.contains(id))
+                    _removed << id;
+            }
+        }
+
+        if(isEmpty())
+            _oldestPending.invalidate();
+
+        _completed = ticket;
+        _flushed.wakeAll();
+    }
+}
+
+/* Returns true if nothing is queued.
+ */
+bool WriteBehind::isEmpty()
+{
+    return _records.isEmpty() && _removed.isEmpty();
+}
+
+/* Commit records to the storage holding the storage mutex.
+ * A journal grown past its limit, or the whole storage if asked
+ * to, is compacted right after. A failed compaction leaves the
+ * storage as it was and sets compacted to false, the committed
+ * records are kept. Returns false if committing failed.
+ */
+bool WriteBehind::write(const QHash<QString, QByteArray> &records, const QSet<QString> &removed,
+                        bool compact, bool &compacted)
+{
+    QMutexLocker locker(_storageMutex);
+    VaultStorage storage;
+
+    if(!records.isEmpty() || !removed.isEmpty())
+    {
+        if(!storage.open() || !storage.commit(records, removed))
+        {
+            QMutexLocker stateLocker(&_mutex);
+            _lastErrorMessage = storage.getLastErrorMessage();
+            return false;
+        }
+    }
+
+    compacted = true;
+
+    if((compact || storage.needsCompaction()) && !storage.compact())
+    {
+        QMutexLocker stateLocker(&_mutex);
+        _lastErrorMessage = storage.getLastErrorMessage();
+        compacted = false;
+    }
+
+    return true;
+}
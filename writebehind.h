@@ -0,0 +1,100 @@
+/*
+ * This file is part of Fort.
+ *
+ * Fort is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Fort is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Fort.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2015 Niko Rosvall <niko@ideabyte.net>
+ *
+ */
+
+#ifndef WRITEBEHIND_H
+#define WRITEBEHIND_H
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QHash>
+#include <QSet>
+#include <QString>
+#include <QByteArray>
+#include <QElapsedTimer>
+
+/* State of the write behind queue.
+ */
+struct WriteBehindStatus
+{
+    int queueDepth;
+    qint64 oldestPendingMs;
+    qint64 lastFlushMs;
+    bool failed;
+    bool compactionFailed;
+};
+
+/* Writes encrypted records to the storage on a background thread.
+ *
+ * Records and removals are queued by guid, a newer record of the same
+ * guid replaces the queued one. The thread waits a moment after the
+ * first change so changes done together are written together, then
+ * commits the queue while holding the storage mutex.
+ *
+ * flush() is a barrier, it returns once everything queued before the
+ * call is written or writing has failed. Records of a failed write stay
+ * queued and are tried again on the next change or flush. A storage
+ * journal grown past its limit is compacted on this thread as well, as
+ * are records left in another layout, see WriteBehind::compactLater()
+ *
+ * A failed compaction leaves the committed records in place, so it does
+ * not fail flush(). It is only reported by status().
+ */
+class WriteBehind : public QThread
+{
+public:
+    WriteBehind(QMutex *storageMutex);
+    void enqueue(const QHash<QString, QByteArray> &records, const QSet<QString> &removed);
+    bool flush();
+    void setDelay(int milliseconds);
+    void compactLater();
+    void stop();
+    WriteBehindStatus status();
+    QString getLastErrorMessage();
+
+protected:
+    void run();
+
+private:
+    QMutex *_storageMutex;
+    QMutex _mutex;
+    QWaitCondition _wake;
+    QWaitCondition _flushed;
+    QHash<QString, QByteArray> _records;
+    QSet<QString> _removed;
+    QElapsedTimer _oldestPending;
+    bool _inFlight;
+    int _inFlightCount;
+    bool _failed;
+    bool _compactFailed;
+    bool _retry;
+    bool _stopRequested;
+    bool _compactRequested;
+    int _requested;
+    int _completed;
+    int _delay;
+    qint64 _lastFlushMs;
+    QString _lastErrorMessage;
+    bool isEmpty();
+    bool write(const QHash<QString, QByteArray> &records, const QSet<QString> &removed,
+               bool compact, bool &compacted);
+};
+
+#endif // WRITEBEHIND_H